@@ -0,0 +1,320 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Voice_pool.hpp"
+#include "Wavetable.hpp"
+#include "Modulation.hpp"
+#include "Envelope.hpp"
+#include "Mixer.hpp"
+#include "Filter.hpp"
+#include "Delay.hpp"
+#include "Unison.hpp"
+#include "Sampler.hpp"
+#include "Render_budget.hpp"
+
+// Block based audio renderer. Has no Arduino/FreeRTOS dependencies so the
+// same code runs on the board (feeding the DAC DMA buffer) and on the host
+// (benchmarks).
+
+// Samples rendered per half of the DMA double buffer
+constexpr size_t AUDIO_BLOCK_SIZE = 64;
+constexpr size_t AUDIO_BUFFER_SIZE = 2 * AUDIO_BLOCK_SIZE;
+
+// Per slot oscillator phase, or Q16 position in the sample for sampler voices,
+// owned by the audio task
+uint32_t phaseAccs[MAX_VOICES] = {};
+uint8_t voiceGeneration[MAX_VOICES] = {};
+
+// Output gain reached at the end of the last block, so changes in voice count
+// or volume ramp instead of stepping
+uint32_t outputGain = 0;
+
+// Filter on the mix, set by the control task and run by the audio task
+StereoFilter outputFilter;
+
+// Unison setting, from the control task
+Unison voiceUnison;
+
+// Increment offsets of each slot's unison side oscillators for the current block
+int32_t unisonSteps[MAX_VOICES][UNISON_MAX_SIDES];
+
+// Echo and chorus on the mix after the filter. Holds the delay line, so it is
+// defined alongside the other control task settings
+extern DelayEffects delayEffects;
+
+// Render time accounting, which sets the key scan's polyphony cap
+extern RenderBudget renderBudget;
+
+// Per voice state for one block, gathered into contiguous arrays
+struct VoiceBlock
+{
+  uint8_t slots[MAX_VOICES];
+  uint32_t phases[MAX_VOICES];
+  uint32_t increments[MAX_VOICES];
+  int32_t deltas[MAX_VOICES];
+  // Envelope level times pan gain for each side, Q15
+  int32_t leftGains[MAX_VOICES];
+  int32_t rightGains[MAX_VOICES];
+  int32_t leftDeltas[MAX_VOICES];
+  int32_t rightDeltas[MAX_VOICES];
+  // Mixed channels after the gain, Q15, ahead of the filter and soft clip
+  int32_t left[AUDIO_BLOCK_SIZE];
+  int32_t right[AUDIO_BLOCK_SIZE];
+};
+
+// Block state, about 3 KB, kept out of the audio task's stack. Only
+// renderBlock uses these, from one task
+VoiceBlock voiceBlock;
+// Band-limited table each voice reads in the block
+const int16_t *voiceTables[MAX_VOICES];
+
+// Sample loop shared by every waveform: advances each voice, reads it with
+// lookup(voice, phase) and mixes it into both channels. The sampler's lookup
+// takes the phase by reference to wrap it round its loop
+template <typename Lookup>
+inline void mixVoices(size_t n, VoiceBlock &v, int count, uint32_t gain, int32_t gainDelta, Lookup lookup)
+{
+  for (size_t s = 0; s < n; s++)
+  {
+    int32_t left = 0;
+    int32_t right = 0;
+    for (int i = 0; i < count; i++)
+    {
+      v.phases[i] += v.increments[i];
+      v.increments[i] += v.deltas[i];
+      v.leftGains[i] += v.leftDeltas[i];
+      v.rightGains[i] += v.rightDeltas[i];
+      int32_t value = lookup(i, v.phases[i]);
+      left += (value * v.leftGains[i]) >> 15;
+      right += (value * v.rightGains[i]) >> 15;
+    }
+    gain += gainDelta;
+    v.left[s] = applyGain(left, gain);
+    v.right[s] = applyGain(right, gain);
+  }
+}
+
+// Band-limited table for each voice, chosen once per block from the highest
+// increment it reaches, raised by headroom / 256 for detuned oscillators
+inline void selectMipTables(const int16_t **tables, size_t n, const VoiceBlock &v, int count,
+                            const MipWavetable &wave, uint32_t headroom)
+{
+  for (int i = 0; i < count; i++)
+  {
+    uint32_t highest = v.deltas[i] > 0 ? v.increments[i] + v.deltas[i] * (int32_t)n : v.increments[i];
+    tables[i] = wave.levels[mipLevel(highest + (uint32_t)(((uint64_t)highest * headroom) >> 8))];
+  }
+}
+
+// Mixes voices with their unison side oscillators
+inline void renderUnison(size_t n, VoiceBlock &v, int count, int waveform, int sides, uint32_t gain,
+                         int32_t gainDelta)
+{
+  for (int i = 0; i < count; i++)
+  {
+    voiceUnison.detuneSteps(v.increments[i], unisonSteps[v.slots[i]]);
+  }
+  const int32_t centreGain = voiceUnison.centreGain();
+  const uint32_t sideGains = voiceUnison.sideGains();
+
+  if (waveform == WAVE_SINE)
+  {
+    mixVoices(n, v, count, gain, gainDelta, [&](int i, uint32_t phase) {
+      uint8_t slot = v.slots[i];
+      return unisonSample<WAVETABLE_BITS, UNISON_PACKED_KERNEL>(sineTable.samples, phase, v.increments[i],
+                                                                unisonPhases[slot], unisonSteps[slot], sides,
+                                                                centreGain, sideGains);
+    });
+  }
+  else
+  {
+    // The widest preset detunes by 30 cents, under 2%
+    selectMipTables(voiceTables, n, v, count, mipWavetable(waveform), 5);
+    mixVoices(n, v, count, gain, gainDelta, [&](int i, uint32_t phase) {
+      uint8_t slot = v.slots[i];
+      return unisonSample<MIP_TABLE_BITS, UNISON_PACKED_KERNEL>(voiceTables[i], phase, v.increments[i],
+                                                                unisonPhases[slot], unisonSteps[slot], sides,
+                                                                centreGain, sideGains);
+    });
+  }
+}
+
+// Mixes voices playing a sample. Their phase increments are scaled into steps
+// through the sample and the slot phases carry their positions
+inline void renderSamples(size_t n, VoiceBlock &v, int count, const Sample &sample, uint32_t gain,
+                          int32_t gainDelta)
+{
+  for (int i = 0; i < count; i++)
+  {
+    uint32_t first = samplePositionStep(v.increments[i], sample.pitchScale);
+    uint32_t last = samplePositionStep(v.increments[i] + v.deltas[i] * (int32_t)n, sample.pitchScale);
+    v.increments[i] = first;
+    v.deltas[i] = ((int32_t)(last - first)) / (int32_t)n;
+  }
+
+  const SampleReader reader = sampleReader(sample);
+  switch (sample.format)
+  {
+  case SAMPLE_S8:
+    mixVoices(n, v, count, gain, gainDelta,
+              [&reader](int, uint32_t &position) { return sampleLookup<SAMPLE_S8>(reader, position); });
+    break;
+  case SAMPLE_U8:
+    mixVoices(n, v, count, gain, gainDelta,
+              [&reader](int, uint32_t &position) { return sampleLookup<SAMPLE_U8>(reader, position); });
+    break;
+  default:
+    mixVoices(n, v, count, gain, gainDelta,
+              [&reader](int, uint32_t &position) { return sampleLookup<SAMPLE_S16>(reader, position); });
+    break;
+  }
+}
+
+// Renders n (up to AUDIO_BLOCK_SIZE) stereo frames of the voices in frame
+// into out, with the pitch of every voice scaled by a Q16 multiplier ramping
+// from pitchStart to pitchEnd and its level by its envelope, which is advanced
+// by n samples. Waveforms from WAVE_SAMPLE on play samplerBank, without
+// unison. The mix then goes through outputFilter, delayEffects and the soft clip.
+// Below full quality (see RenderQuality) parts of this are simplified or skipped.
+// The waveform test is hoisted out of the sample loop so each case is a tight
+// loop over the contiguous increment and phase arrays for one sample.
+void renderBlock(uint32_t *out, size_t n, const VoiceFrame &frame, VoiceEnvelopes &envelopes, int waveform,
+                 int volume, uint32_t pitchStart = MOD_UNITY, uint32_t pitchEnd = MOD_UNITY)
+{
+  // Gather each audible slot's phase and envelope ramp for the block, restarting
+  // the slot if it now plays a new note. Voices whose release has finished are
+  // skipped until the scan task frees them
+  const uint32_t voiceStart = renderClock();
+  VoiceBlock &v = voiceBlock;
+  int count = 0;
+  // Short of time, the governor has the block rendered more cheaply
+  const int quality = renderBudget.quality();
+  const int fullSides = voiceUnison.update();
+  int sides = fullSides;
+  if (quality >= QUALITY_MINIMAL)
+  {
+    sides = 0;
+  }
+  else if (quality >= QUALITY_HALF_UNISON)
+  {
+    sides = sides / 4 * 2;
+  }
+  // Voices beyond what fits in the deadline are left out until the scan
+  // steals them
+  const bool sampled = waveform >= WAVE_SAMPLE;
+  const int limit = renderBudget.beginVoices(sampled ? 1 : 1 + sides, sampled ? 1 : 1 + fullSides);
+  for (int i = 0; i < frame.count; i++)
+  {
+    uint8_t slot = frame.slot[i];
+    if (voiceGeneration[slot] != frame.generation[i])
+    {
+      voiceGeneration[slot] = frame.generation[i];
+      phaseAccs[slot] = 0;
+      Unison::restart(slot);
+      envelopes.trigger(slot, frame.generation[i]);
+    }
+    if (envelopes.idle(slot) || count == limit)
+    {
+      continue;
+    }
+
+    int32_t level = envelopes.level(slot);
+    int32_t levelEnd = envelopes.advance(slot, frame.held[i], n);
+    int32_t panLeft = panTable.left[frame.pan[i]];
+    int32_t panRight = panTable.right[frame.pan[i]];
+
+    // Modulated phase increment, stepped linearly across the block
+    uint32_t first = modulateStep(frame.stepSize[i], pitchStart);
+    uint32_t last = modulateStep(frame.stepSize[i], pitchEnd);
+
+    v.slots[count] = slot;
+    v.phases[count] = phaseAccs[slot];
+    v.increments[count] = first;
+    v.deltas[count] = ((int32_t)(last - first)) / (int32_t)n;
+    v.leftGains[count] = (level * panLeft) >> 15;
+    v.rightGains[count] = (level * panRight) >> 15;
+    v.leftDeltas[count] = (((levelEnd * panLeft) >> 15) - v.leftGains[count]) / (int32_t)n;
+    v.rightDeltas[count] = (((levelEnd * panRight) >> 15) - v.rightGains[count]) / (int32_t)n;
+    count++;
+  }
+
+  // Silence still runs through an active filter or delay so its tail rings out
+  if (count == 0 && outputFilter.type() == FILTER_OFF && !delayEffects.active())
+  {
+    outputGain = 0;
+    for (size_t s = 0; s < n; s++)
+    {
+      out[s] = DAC_MIDSCALE_STEREO;
+    }
+    return;
+  }
+
+  uint32_t gainEnd = mixGain(count, volume);
+  int32_t gainDelta = ((int32_t)gainEnd - (int32_t)outputGain) / (int32_t)n;
+
+  if (count == 0)
+  {
+    memset(v.left, 0, n * sizeof(v.left[0]));
+    memset(v.right, 0, n * sizeof(v.right[0]));
+  }
+  else if (waveform >= WAVE_SAMPLE)
+  {
+    renderSamples(n, v, count, *samplerBank[waveform - WAVE_SAMPLE], outputGain, gainDelta);
+  }
+  else if (sides > 0)
+  {
+    renderUnison(n, v, count, waveform, sides, outputGain, gainDelta);
+  }
+  else if (waveform == WAVE_SINE)
+  {
+    mixVoices(n, v, count, outputGain, gainDelta,
+              [](int, uint32_t phase) { return wavetableLookup(sineTable.samples, phase); });
+  }
+  else
+  {
+    selectMipTables(voiceTables, n, v, count, mipWavetable(waveform), 0);
+    mixVoices(n, v, count, outputGain, gainDelta,
+              [](int i, uint32_t phase) { return wavetableLookup<MIP_TABLE_BITS>(voiceTables[i], phase); });
+  }
+  outputGain = gainEnd;
+  renderBudget.addVoices(count, renderClock() - voiceStart);
+
+  if (quality < QUALITY_MINIMAL)
+  {
+    outputFilter.process(v.left, v.right, n);
+  }
+  if (quality < QUALITY_NO_DELAY)
+  {
+    delayEffects.process(v.left, v.right, n);
+  }
+  else
+  {
+    delayEffects.suspend();
+  }
+  for (size_t s = 0; s < n; s++)
+  {
+    out[s] = stereoFrame(softClip(v.left[s]), softClip(v.right[s]));
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    phaseAccs[v.slots[i]] = v.phases[i];
+  }
+}
+
+// Renders a block in segments that end on the modulator's arpeggio steps, so
+// each step changes pitch on its exact sample
+void renderModulatedBlock(uint32_t *out, size_t n, const VoiceFrame &frame, VoiceEnvelopes &envelopes,
+                          PitchModulator &modulator, int waveform, int volume)
+{
+  size_t done = 0;
+  while (done < n)
+  {
+    uint32_t pitchStart, pitchEnd;
+    size_t length = modulator.nextSegment(n - done, &pitchStart, &pitchEnd);
+    renderBlock(out + done, length, frame, envelopes, waveform, volume, pitchStart, pitchEnd);
+    done += length;
+  }
+}
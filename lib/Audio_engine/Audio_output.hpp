@@ -0,0 +1,102 @@
+#pragma once
+#include <Arduino.h>
+#include <HardwareTimer.h>
+#include <STM32FreeRTOS.h>
+
+#include "Audio_engine.hpp"
+
+// Stereo DAC output driven by TIM6 TRGO with a circular DMA transfer out of
+// audioBuffer. Each word is written to the dual 12-bit register, updating both
+// channels on the same trigger. The half/full transfer interrupts wake the
+// render task, which refills the half of the buffer that the DMA has just
+// finished reading.
+
+uint32_t audioBuffer[AUDIO_BUFFER_SIZE];
+volatile uint8_t renderHalf = 0;
+TaskHandle_t audioRenderHandle = NULL;
+
+DAC_HandleTypeDef hdac;
+DMA_HandleTypeDef hdmaDac;
+
+extern "C" void DMA1_Channel3_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdmaDac);
+}
+
+// Wake the render task with the half of the buffer it should fill next
+void notifyRender(uint8_t half)
+{
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  renderHalf = half;
+  if (audioRenderHandle != NULL)
+  {
+    vTaskNotifyGiveFromISR(audioRenderHandle, &higherPriorityTaskWoken);
+  }
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+void audioHalfTransferCallback(DMA_HandleTypeDef *hdma)
+{
+  notifyRender(0);
+}
+
+void audioTransferCallback(DMA_HandleTypeDef *hdma)
+{
+  notifyRender(1);
+}
+
+void initAudioOutput(uint32_t sampleRate)
+{
+  for (size_t i = 0; i < AUDIO_BUFFER_SIZE; i++)
+  {
+    audioBuffer[i] = DAC_MIDSCALE_STEREO;
+  }
+
+  __HAL_RCC_DAC1_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  // DAC channel 1 (PA4 / OUTR_PIN) and channel 2 (PA5 / OUTL_PIN), both
+  // converted on every TIM6 update
+  hdac.Instance = DAC1;
+  HAL_DAC_Init(&hdac);
+  DAC_ChannelConfTypeDef dacConfig = {};
+  dacConfig.DAC_SampleAndHold = DAC_SAMPLEANDHOLD_DISABLE;
+  dacConfig.DAC_Trigger = DAC_TRIGGER_T6_TRGO;
+  dacConfig.DAC_OutputBuffer = DAC_OUTPUTBUFFER_ENABLE;
+  dacConfig.DAC_ConnectOnChipPeripheral = DAC_CHIPCONNECT_DISABLE;
+  dacConfig.DAC_UserTrimming = DAC_TRIMMING_FACTORY;
+  HAL_DAC_ConfigChannel(&hdac, &dacConfig, DAC_CHANNEL_1);
+  HAL_DAC_ConfigChannel(&hdac, &dacConfig, DAC_CHANNEL_2);
+
+  // DMA1 channel 3, request 6 is DAC channel 1, which paces both channels
+  hdmaDac.Instance = DMA1_Channel3;
+  hdmaDac.Init.Request = DMA_REQUEST_6;
+  hdmaDac.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  hdmaDac.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdmaDac.Init.MemInc = DMA_MINC_ENABLE;
+  hdmaDac.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  hdmaDac.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  hdmaDac.Init.Mode = DMA_CIRCULAR;
+  hdmaDac.Init.Priority = DMA_PRIORITY_HIGH;
+  HAL_DMA_Init(&hdmaDac);
+  __HAL_LINKDMA(&hdac, DMA_Handle1, hdmaDac);
+  hdmaDac.XferHalfCpltCallback = audioHalfTransferCallback;
+  hdmaDac.XferCpltCallback = audioTransferCallback;
+
+  // Must be at or below configMAX_SYSCALL_INTERRUPT_PRIORITY to use the FromISR API
+  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+
+  // Sample clock: TIM6 update event routed to TRGO
+  HardwareTimer *audioTimer = new HardwareTimer(TIM6);
+  audioTimer->setOverflow(sampleRate, HERTZ_FORMAT);
+  TIM6->CR2 = (TIM6->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
+
+  // HAL_DAC_Start_DMA only targets one channel's register, so the transfer into
+  // the dual register is started directly
+  HAL_DMA_Start_IT(&hdmaDac, (uint32_t)audioBuffer, (uint32_t)&DAC1->DHR12RD, AUDIO_BUFFER_SIZE);
+  SET_BIT(DAC1->CR, DAC_CR_DMAEN1);
+  HAL_DAC_Start(&hdac, DAC_CHANNEL_1);
+  HAL_DAC_Start(&hdac, DAC_CHANNEL_2);
+  audioTimer->resume();
+}
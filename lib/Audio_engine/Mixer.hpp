@@ -0,0 +1,161 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Voice_pool.hpp"
+#include "Wavetable.hpp"
+#include "Envelope.hpp"
+
+// Output stage of the renderer. Voices are panned into left and right sums,
+// scaled by a gain looked up from the voice count and volume knob, and shaped
+// by a soft-clip table straight into 12-bit DAC codes, so the per sample path
+// has no divide, no float and no hard clamp.
+
+// Volume knob positions 0 - 8
+constexpr int MIX_VOLUME_STEPS = 9;
+
+// Peak of one voice at full volume relative to DAC full scale. Voices add up
+// with 1 / sqrt(count) and the soft clip absorbs the peaks where they line up
+constexpr double MIX_HEADROOM = 0.75;
+
+// The soft clip is linear up to the knee and bends smoothly into full scale
+constexpr double SOFT_CLIP_KNEE = 0.75;
+
+// Soft-clip input covers +-4x full scale in Q15
+constexpr int SOFT_CLIP_BITS = 10;
+constexpr size_t SOFT_CLIP_SIZE = 1 << SOFT_CLIP_BITS;
+constexpr int32_t SOFT_CLIP_LIMIT = 4 << 15;
+constexpr int SOFT_CLIP_FRAC_BITS = 18 - SOFT_CLIP_BITS;
+
+// DAC is driven in 12-bit right aligned mode
+constexpr uint16_t DAC_MIDSCALE = 2048;
+
+// One output frame as the DAC's dual 12-bit register takes it: right
+// (channel 1, OUTR_PIN) in the low half, left (channel 2, OUTL_PIN) in the high half
+constexpr uint32_t stereoFrame(uint16_t left, uint16_t right)
+{
+  return right | ((uint32_t)left << 16);
+}
+
+constexpr uint32_t DAC_MIDSCALE_STEREO = stereoFrame(DAC_MIDSCALE, DAC_MIDSCALE);
+
+struct MixGainTable
+{
+  // Q16 gain for each voice count and volume
+  uint16_t gain[MAX_VOICES + 1][MIX_VOLUME_STEPS];
+};
+
+struct PanTable
+{
+  int16_t left[PAN_RIGHT + 1];
+  int16_t right[PAN_RIGHT + 1];
+};
+
+struct SoftClipTable
+{
+  uint16_t dac[SOFT_CLIP_SIZE + 1];
+};
+
+constexpr double constexprSqrt(double x)
+{
+  double root = x > 1 ? x : 1;
+  for (int i = 0; i < 30; i++)
+  {
+    root = (root + x / root) / 2;
+  }
+  return root;
+}
+
+constexpr MixGainTable makeMixGainTable()
+{
+  MixGainTable table = {};
+  for (size_t count = 1; count <= MAX_VOICES; count++)
+  {
+    for (int volume = 0; volume < MIX_VOLUME_STEPS; volume++)
+    {
+      double gain = MIX_HEADROOM * volume / (MIX_VOLUME_STEPS - 1) / constexprSqrt((double)count);
+      table.gain[count][volume] = (uint16_t)(gain * 65536 + 0.5);
+    }
+  }
+  return table;
+}
+
+// Constant power pan law: the two gains are the cosine and sine of a quarter turn
+constexpr PanTable makePanTable()
+{
+  PanTable table = {};
+  for (int pan = 0; pan <= PAN_RIGHT; pan++)
+  {
+    double angle = WAVETABLE_PI / 2 * pan / PAN_RIGHT;
+    table.left[pan] = toQ15(constexprCos(angle));
+    table.right[pan] = toQ15(constexprSin(angle));
+  }
+  return table;
+}
+
+// Linear up to the knee, then a tanh shaped bend that meets it with the same
+// slope and levels out at full scale
+constexpr double softClipCurve(double x)
+{
+  double magnitude = x < 0 ? -x : x;
+  if (magnitude > SOFT_CLIP_KNEE)
+  {
+    double z = 2 * (magnitude - SOFT_CLIP_KNEE) / (1 - SOFT_CLIP_KNEE);
+    double e = constexprExp(-z);
+    magnitude = SOFT_CLIP_KNEE + (1 - SOFT_CLIP_KNEE) * (1 - e) / (1 + e);
+  }
+  return x < 0 ? -magnitude : magnitude;
+}
+
+constexpr SoftClipTable makeSoftClipTable()
+{
+  SoftClipTable table = {};
+  for (size_t i = 0; i <= SOFT_CLIP_SIZE; i++)
+  {
+    double x = (double)((int32_t)(i << SOFT_CLIP_FRAC_BITS) - SOFT_CLIP_LIMIT) / 32768;
+    table.dac[i] = (uint16_t)(DAC_MIDSCALE + softClipCurve(x) * (DAC_MIDSCALE - 1) + 0.5);
+  }
+  return table;
+}
+
+constexpr MixGainTable mixGainTable = makeMixGainTable();
+constexpr PanTable panTable = makePanTable();
+constexpr SoftClipTable softClipTable = makeSoftClipTable();
+
+// Q16 mix gain for a voice count (0 - MAX_VOICES) and volume knob position
+inline uint32_t mixGain(int count, int volume)
+{
+  volume = volume < 0 ? 0 : (volume >= MIX_VOLUME_STEPS ? MIX_VOLUME_STEPS - 1 : volume);
+  return mixGainTable.gain[count][volume];
+}
+
+// DAC code for a Q15 sample (32768 is full scale), interpolated from the soft-clip table
+inline uint16_t softClip(int32_t sample)
+{
+  if (sample < -SOFT_CLIP_LIMIT)
+  {
+    sample = -SOFT_CLIP_LIMIT;
+  }
+  else if (sample > SOFT_CLIP_LIMIT - 1)
+  {
+    sample = SOFT_CLIP_LIMIT - 1;
+  }
+  uint32_t position = (uint32_t)(sample + SOFT_CLIP_LIMIT);
+  uint32_t index = position >> SOFT_CLIP_FRAC_BITS;
+  int32_t frac = position & ((1 << SOFT_CLIP_FRAC_BITS) - 1);
+  int32_t a = softClipTable.dac[index];
+  int32_t b = softClipTable.dac[index + 1];
+  return (uint16_t)(a + (((b - a) * frac) >> SOFT_CLIP_FRAC_BITS));
+}
+
+// Scales a Q15 channel sum by a Q16 gain
+inline int32_t applyGain(int32_t sum, uint32_t gain)
+{
+  return (int32_t)(((int64_t)sum * gain) >> 16);
+}
+
+// Mixes a Q15 channel sum with a Q16 gain into a DAC code
+inline uint16_t mixChannel(int32_t sum, uint32_t gain)
+{
+  return softClip(applyGain(sum, gain));
+}
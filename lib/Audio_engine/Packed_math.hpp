@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include "Wavetable.hpp"
+
+#if defined(__ARM_FEATURE_DSP)
+#include <arm_acle.h>
+#endif
+
+// Pairs of Q15 values packed into one 32-bit word, low half first, and the
+// Cortex-M4 dual 16-bit multiply-accumulate instructions that work on them.
+// Other targets, including the host build, get plain C++ versions with the
+// same results, so the kernels built on these run and can be checked anywhere.
+
+// The compiler turns this into a single PKHBT on the M4
+inline uint32_t pack16(int32_t low, int32_t high)
+{
+  return (uint16_t)low | (uint32_t)high << 16;
+}
+
+// Two adjacent 16-bit entries of a table as one word, with a single load
+inline uint32_t loadPair(const int16_t *entries)
+{
+  uint32_t pair;
+  memcpy(&pair, entries, sizeof(pair));
+  return pair;
+}
+
+// low(x) * low(y) + high(x) * high(y)
+inline int32_t smuad(uint32_t x, uint32_t y)
+{
+#if defined(__ARM_FEATURE_DSP)
+  return __smuad((int32_t)x, (int32_t)y);
+#else
+  return (int32_t)(int16_t)x * (int16_t)y + (int32_t)(int16_t)(x >> 16) * (int16_t)(y >> 16);
+#endif
+}
+
+// acc + low(x) * low(y) + high(x) * high(y)
+inline int32_t smlad(uint32_t x, uint32_t y, int32_t acc)
+{
+#if defined(__ARM_FEATURE_DSP)
+  return __smlad((int32_t)x, (int32_t)y, acc);
+#else
+  return acc + smuad(x, y);
+#endif
+}
+
+// Wavetable read as wavetableLookup, with the interpolation done as one dual
+// multiply of the neighbouring entries by (1 - frac, frac). The fraction is
+// 14 bits so 1 - frac still fits a signed half word
+template <int BITS = WAVETABLE_BITS>
+inline int32_t wavetableLookupPacked(const int16_t *table, uint32_t phase)
+{
+  constexpr int FRAC_BITS = 32 - BITS;
+  uint32_t index = phase >> FRAC_BITS;
+  int32_t frac = (phase >> (FRAC_BITS - 14)) & 0x3FFF;
+  return smuad(loadPair(table + index), pack16(0x4000 - frac, frac)) >> 14;
+}
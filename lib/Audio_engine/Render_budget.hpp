@@ -0,0 +1,385 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if !defined(__arm__)
+#include <chrono>
+#endif
+
+#include "Voice_pool.hpp"
+
+// Measures what each block costs to render and works out how many voices fit
+// in the time before the DMA needs it, so the key scan can cap polyphony
+// before a chord of notes makes the audio task miss its deadline. Times are in
+// clock cycles on the board, from the Cortex-M4 DWT cycle counter, and in
+// nanoseconds on the host.
+//
+// The cap only takes effect at the next scan, so the renderer also holds
+// itself to the voices that fit in the deadline. Costs are counted per
+// oscillator, so when unison is turned on that limit falls in the same block;
+// a block that overruns, or whose oscillators suddenly cost far more, raises
+// the estimates at once instead of easing them up. A governor also steps the
+// render quality down while the blocks run close to the deadline, and back up
+// once they have been well clear of it for a while.
+
+// Share of each block's deadline the renderer may use. The rest is left for
+// the key scan, controls, display and CAN tasks it preempts
+constexpr uint32_t RENDER_BUDGET_PERCENT = 70;
+
+// Share of the deadline the renderer fills before it leaves voices out
+constexpr uint32_t RENDER_CUT_PERCENT = 90;
+
+// Fewest voices the budget will cut down to, so one slow block cannot silence
+// the keyboard
+constexpr uint8_t RENDER_MIN_VOICES = 4;
+
+// Rise in an oscillator's cost over the estimate, in eighths, taken as a jump
+// rather than noise
+constexpr uint32_t RENDER_JUMP_EIGHTHS = 12;
+
+// Blocks over which the worst case is taken for the headroom telemetry, 190 ms
+constexpr uint32_t RENDER_WINDOW_BLOCKS = 64;
+
+// Quality levels, each dropping more than the one before
+enum RenderQuality : int8_t
+{
+  QUALITY_GOVERNED = -1,
+  QUALITY_FULL = 0,
+  // Unison down to its inner pair of side oscillators
+  QUALITY_HALF_UNISON,
+  // Echo and chorus bypassed
+  QUALITY_NO_DELAY,
+  // Unison and the filter off as well
+  QUALITY_MINIMAL
+};
+
+// Governor thresholds, as percentages of the deadline. A step down when the
+// average block time goes over GOVERNOR_DOWN_PERCENT, or any one block over
+// GOVERNOR_PANIC_PERCENT. A step up once the average, scaled by what the
+// level above was seen to cost, would have stayed under GOVERNOR_UP_PERCENT
+// for GOVERNOR_RECOVER_BLOCKS (370 ms)
+constexpr uint32_t GOVERNOR_DOWN_PERCENT = 80;
+constexpr uint32_t GOVERNOR_PANIC_PERCENT = 95;
+constexpr uint32_t GOVERNOR_UP_PERCENT = 75;
+constexpr uint32_t GOVERNOR_RECOVER_BLOCKS = 128;
+// Blocks after a step over which the new level's cost is measured, before
+// the average can cause another
+constexpr uint32_t GOVERNOR_SETTLE_BLOCKS = 16;
+// A step up that has to be taken back waits twice as long next time, up to
+// this many times GOVERNOR_RECOVER_BLOCKS (1.5 s), so full quality returns
+// within a few seconds of the load going
+constexpr uint32_t GOVERNOR_MAX_BACKOFF = 4;
+
+#if defined(__arm__)
+constexpr uint32_t RENDER_CLOCK_DEFAULT_HZ = 80000000;
+
+// Turns on the DWT cycle counter (DEMCR.TRCENA, then DWT_CTRL.CYCCNTENA)
+inline void startRenderClock()
+{
+  *(volatile uint32_t *)0xE000EDFC |= 1u << 24;
+  *(volatile uint32_t *)0xE0001004 = 0;
+  *(volatile uint32_t *)0xE0001000 |= 1u;
+}
+
+inline uint32_t renderClock()
+{
+  return *(volatile uint32_t *)0xE0001004;
+}
+#else
+constexpr uint32_t RENDER_CLOCK_DEFAULT_HZ = 1000000000;
+
+inline void startRenderClock() {}
+
+inline uint32_t renderClock()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+class RenderBudget
+{
+public:
+  RenderBudget(uint32_t sampleRate, size_t blockSize) : m_sampleRate(sampleRate), m_blockSize(blockSize)
+  {
+    start(RENDER_CLOCK_DEFAULT_HZ);
+  }
+
+  // Starts the clock and sets the deadline from its rate. The host benchmark
+  // gives a slower rate than the real one to stand in for a slower CPU
+  void start(uint32_t clockHz)
+  {
+    startRenderClock();
+    m_deadline = (uint32_t)((uint64_t)clockHz * m_blockSize / m_sampleRate);
+    m_budget = (uint32_t)((uint64_t)m_deadline * RENDER_BUDGET_PERCENT / 100);
+    m_cutBudget = (uint32_t)((uint64_t)m_deadline * RENDER_CUT_PERCENT / 100);
+  }
+
+  // Audio task side. Before each segment, with the oscillators each voice
+  // plays in it and would play at full quality, the most voices renderBlock
+  // may mix. Normally above the key scan's cap, this only leaves voices out
+  // between a rise in cost and the scan that steals them. Every voice while
+  // the quality is held
+  int beginVoices(int oscillators, int fullOscillators)
+  {
+    m_oscillators = oscillators;
+    m_voiceOscillators = fullOscillators;
+    if (m_fixedQuality != QUALITY_GOVERNED)
+    {
+      return MAX_VOICES;
+    }
+    return fit(m_cutBudget, oscillators);
+  }
+
+  // Then the voices it mixed and the time spent on them
+  void addVoices(int count, uint32_t cycles)
+  {
+    m_blockVoices = count > m_blockVoices ? count : m_blockVoices;
+    int oscillators = count * m_oscillators;
+    m_blockOscillators = oscillators > m_blockOscillators ? oscillators : m_blockOscillators;
+    m_blockVoiceCycles += cycles;
+  }
+
+  // Quality to render the next block at
+  int quality() const { return m_quality; }
+
+  // Holds the quality at a level instead of governing it, or governs it again
+  // given QUALITY_GOVERNED. For measuring each level, and for offline renders
+  void fixQuality(int level)
+  {
+    m_fixedQuality = level;
+    if (level != QUALITY_GOVERNED)
+    {
+      setQuality(level);
+    }
+  }
+
+  // After each block, with the time the whole block took. Estimates rise
+  // quickly and fall slowly, so the limit errs towards fewer voices. Each is
+  // fed the lower of the last two blocks' costs, so a single slow block, as
+  // when an interrupt lands in it, is not taken for a rise, unless it overran
+  // or its oscillators cost half as much again as estimated. Below full
+  // quality they only rise, so the cap stays where full quality needs it
+  void endBlock(uint32_t cycles)
+  {
+    uint32_t voiceCycles = m_blockVoiceCycles < cycles ? m_blockVoiceCycles : cycles;
+    uint32_t perOscillator = m_blockOscillators > 0 ? voiceCycles / m_blockOscillators : 0;
+    bool full = m_quality == QUALITY_FULL;
+    if (cycles > m_deadline)
+    {
+      raise(&m_fixedCost, &m_lastFixed, cycles - voiceCycles);
+    }
+    if (cycles > m_deadline || (perOscillator << COST_SHIFT) * 8 > m_voiceCost * RENDER_JUMP_EIGHTHS)
+    {
+      raise(&m_voiceCost, &m_lastVoice, perOscillator);
+    }
+    track(&m_fixedCost, &m_lastFixed, cycles - voiceCycles, full);
+    if (m_blockOscillators > 0)
+    {
+      track(&m_voiceCost, &m_lastVoice, perOscillator, full);
+    }
+    if (m_fixedQuality == QUALITY_GOVERNED)
+    {
+      govern(cycles);
+    }
+
+    // The scan's cap is for voices at full quality
+    __atomic_store_n(&m_limit, (uint8_t)fit(m_budget, m_voiceOscillators), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_voices, (uint8_t)m_blockVoices, __ATOMIC_RELAXED);
+    if (cycles > m_deadline)
+    {
+      __atomic_add_fetch(&m_overruns, 1, __ATOMIC_RELAXED);
+    }
+
+    m_windowPeak = cycles > m_windowPeak ? cycles : m_windowPeak;
+    if (++m_windowBlocks == RENDER_WINDOW_BLOCKS)
+    {
+      int32_t headroom = 100 - (int32_t)((uint64_t)m_windowPeak * 100 / m_deadline);
+      __atomic_store_n(&m_headroom, (int8_t)(headroom < -100 ? -100 : headroom), __ATOMIC_RELAXED);
+      m_windowPeak = 0;
+      m_windowBlocks = 0;
+    }
+    m_blockVoices = 0;
+    m_blockOscillators = 0;
+    m_blockVoiceCycles = 0;
+  }
+
+  // Key scan side. Voices that fit in the budget, for VoiceAllocator::setPolyphony
+  uint8_t voiceLimit() const { return __atomic_load_n(&m_limit, __ATOMIC_RELAXED); }
+
+  // Telemetry: voices in the last block, percent of the deadline left in the
+  // slowest block of the last window (negative if it overran) and blocks that
+  // missed the deadline since start
+  uint8_t voices() const { return __atomic_load_n(&m_voices, __ATOMIC_RELAXED); }
+  int8_t headroom() const { return __atomic_load_n(&m_headroom, __ATOMIC_RELAXED); }
+  uint32_t overruns() const { return __atomic_load_n(&m_overruns, __ATOMIC_RELAXED); }
+  // Quality level, and average block time as a percentage of the deadline
+  int qualityLevel() const { return __atomic_load_n(&m_qualityLevel, __ATOMIC_RELAXED); }
+  uint32_t load() const { return __atomic_load_n(&m_averageLoad, __ATOMIC_RELAXED) >> COST_SHIFT; }
+
+  uint32_t deadline() const { return m_deadline; }
+
+private:
+  // Costs are kept in Q4 for the slow fall
+  static constexpr int COST_SHIFT = 4;
+
+  // Voices of the given oscillators each that the estimates fit in budget
+  uint32_t fit(uint32_t budget, int oscillators) const
+  {
+    uint32_t fixed = m_fixedCost >> COST_SHIFT;
+    uint32_t perVoice = ((m_voiceCost >> COST_SHIFT) + 1) * (oscillators > 1 ? oscillators : 1);
+    uint32_t limit = budget > fixed ? (budget - fixed) / perVoice : 0;
+    return limit < RENDER_MIN_VOICES ? RENDER_MIN_VOICES : (limit > MAX_VOICES ? MAX_VOICES : limit);
+  }
+
+  // Takes a cost straight up to cycles, if higher
+  static void raise(uint32_t *estimate, uint32_t *last, uint32_t cycles)
+  {
+    if ((cycles << COST_SHIFT) > *estimate)
+    {
+      *estimate = cycles << COST_SHIFT;
+      *last = cycles;
+    }
+  }
+
+  static void track(uint32_t *estimate, uint32_t *last, uint32_t cycles, bool fall)
+  {
+    uint32_t lower = cycles < *last ? cycles : *last;
+    *last = cycles;
+    int32_t error = (int32_t)((lower << COST_SHIFT) - *estimate);
+    if (error > 0 || fall)
+    {
+      *estimate += error > 0 ? error / 2 : error / 32;
+    }
+  }
+
+  void govern(uint32_t cycles)
+  {
+    uint32_t percent = (uint32_t)((uint64_t)cycles * 100 / m_deadline);
+    percent = percent > 255 ? 255 : percent;
+    // Average over about 8 blocks
+    uint32_t averageLoad = m_averageLoad + ((int32_t)(percent << COST_SHIFT) - (int32_t)m_averageLoad) / 8;
+    __atomic_store_n(&m_averageLoad, averageLoad, __ATOMIC_RELAXED);
+    uint32_t average = averageLoad >> COST_SHIFT;
+    m_sinceUp++;
+
+    if (m_settle > 0)
+    {
+      m_settleSum += percent;
+      if (--m_settle == 0)
+      {
+        measureStep();
+      }
+    }
+
+    if (m_quality < QUALITY_MINIMAL &&
+        (percent > GOVERNOR_PANIC_PERCENT || (m_settle == 0 && average > GOVERNOR_DOWN_PERCENT)))
+    {
+      // Going straight back down after a step up: wait longer before the next
+      if (m_sinceUp < GOVERNOR_RECOVER_BLOCKS && m_backoff < GOVERNOR_MAX_BACKOFF)
+      {
+        m_backoff *= 2;
+      }
+      m_stepFrom = averageLoad > (percent << COST_SHIFT) ? averageLoad : percent << COST_SHIFT;
+      step(m_quality + 1);
+      m_calm = 0;
+    }
+    else if (m_quality > QUALITY_FULL && m_settle == 0 &&
+             ((average * m_ratio[m_quality - 1]) >> 8) < GOVERNOR_UP_PERCENT)
+    {
+      if (++m_calm >= GOVERNOR_RECOVER_BLOCKS * m_backoff)
+      {
+        m_stepFrom = averageLoad;
+        step(m_quality - 1);
+        m_calm = 0;
+        m_sinceUp = 0;
+      }
+    }
+    else
+    {
+      m_calm = 0;
+    }
+    // A step up that held for a while earns back the shorter wait
+    if (m_sinceUp == GOVERNOR_RECOVER_BLOCKS && m_backoff > 1)
+    {
+      m_backoff /= 2;
+    }
+  }
+
+  // How much dearer the upper of the last two levels is, from the load before
+  // the step and the blocks since. A step cut short by the next still counts
+  // if it ran for half the settling time
+  void measureStep()
+  {
+    uint32_t blocks = GOVERNOR_SETTLE_BLOCKS - m_settle;
+    if (m_stepLevel == m_quality || blocks < GOVERNOR_SETTLE_BLOCKS / 2)
+    {
+      return;
+    }
+    uint32_t after = (m_settleSum << COST_SHIFT) / blocks + 1;
+    bool down = m_quality > m_stepLevel;
+    uint32_t ratio = down ? (m_stepFrom << 8) / after : (after << 8) / (m_stepFrom + 1);
+    m_ratio[down ? m_stepLevel : m_quality] = ratio < 256 ? 256 : ratio;
+  }
+
+  void step(int level)
+  {
+    if (m_settle > 0)
+    {
+      measureStep();
+    }
+    m_stepLevel = m_quality;
+    setQuality(level);
+    m_settle = GOVERNOR_SETTLE_BLOCKS;
+    m_settleSum = 0;
+  }
+
+  void setQuality(int level)
+  {
+    m_quality = level;
+    __atomic_store_n(&m_qualityLevel, (int8_t)level, __ATOMIC_RELAXED);
+  }
+
+  uint32_t m_sampleRate;
+  size_t m_blockSize;
+  uint32_t m_deadline = 0;
+  uint32_t m_budget = 0;
+  uint32_t m_cutBudget = 0;
+
+  // Audio task state
+  int m_blockVoices = 0;
+  int m_blockOscillators = 0;
+  uint32_t m_blockVoiceCycles = 0;
+  // Per oscillator, and the rest of the block
+  uint32_t m_voiceCost = 0;
+  uint32_t m_fixedCost = 0;
+  uint32_t m_lastVoice = 0;
+  uint32_t m_lastFixed = 0;
+  // Oscillators a voice plays in this segment, and at full quality
+  int m_oscillators = 1;
+  int m_voiceOscillators = 1;
+  uint32_t m_windowPeak = 0;
+  uint32_t m_windowBlocks = 0;
+  int m_quality = QUALITY_FULL;
+  int m_fixedQuality = QUALITY_GOVERNED;
+  uint32_t m_settle = 0;
+  uint32_t m_settleSum = 0;
+  // Level before the last step and the Q4 average load at it
+  int m_stepLevel = QUALITY_FULL;
+  uint32_t m_stepFrom = 0;
+  // Cost of each level over the one below it, Q8, until measured taken as a
+  // little over what each step saves with unison and the echo on
+  uint32_t m_ratio[QUALITY_MINIMAL] = {576, 384, 1024};
+  uint32_t m_calm = 0;
+  uint32_t m_sinceUp = GOVERNOR_RECOVER_BLOCKS;
+  uint32_t m_backoff = 1;
+
+  // Read by the other tasks
+  uint8_t m_limit = MAX_VOICES;
+  uint8_t m_voices = 0;
+  int8_t m_headroom = 100;
+  uint32_t m_overruns = 0;
+  int8_t m_qualityLevel = QUALITY_FULL;
+  // Q4 percent of the deadline
+  uint32_t m_averageLoad = 0;
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "Voice_pool.hpp"
+#include "Wavetable.hpp"
+#include "Packed_math.hpp"
+
+// Unison: each voice plays a centre oscillator plus pairs detuned either side
+// of it, for a supersaw style thickening of any waveform. The centre
+// oscillator runs on the voice's usual phase; the sides keep their own phases
+// and add a fixed offset to the voice's increment each sample.
+//
+// The sides come in pairs, so each pair can be read, packed into one word and
+// weighted with a single dual multiply-accumulate (SMLAD on the M4).
+
+constexpr int UNISON_MAX_OSCILLATORS = 7;
+constexpr int UNISON_MAX_SIDES = UNISON_MAX_OSCILLATORS - 1;
+
+// The packed kernel can only win with the DSP instructions behind it; on the
+// host, with the portable fallbacks, benchUnison shows it no faster than the
+// scalar one. Until the ENABLE_TESTING build's cycle counts show it winning on
+// the board, the scalar kernel renders everywhere. Build with
+// -DUNISON_PACKED=1 to use the packed one on the M4
+#ifndef UNISON_PACKED
+#define UNISON_PACKED 0
+#endif
+
+#if UNISON_PACKED && defined(__ARM_FEATURE_DSP)
+constexpr bool UNISON_PACKED_KERNEL = true;
+#else
+constexpr bool UNISON_PACKED_KERNEL = false;
+#endif
+
+// Level of the side oscillators relative to the centre
+constexpr float UNISON_SIDE_LEVEL = 0.7f;
+
+struct UnisonPreset
+{
+  const char *name;
+  uint8_t oscillators;
+  uint8_t cents;
+};
+
+// Odd oscillator counts only, cents is the detune of the outermost pair
+constexpr UnisonPreset unisonPresets[] = {
+    {"3 x 8c", 3, 8},
+    {"5 x 12c", 5, 12},
+    {"7 x 18c", 7, 18},
+    {"7 x 30c", 7, 30},
+};
+constexpr int UNISON_PRESET_COUNT = sizeof(unisonPresets) / sizeof(unisonPresets[0]);
+constexpr int UNISON_OFF = -1;
+
+// Per slot side oscillator phases, owned by the audio task
+uint32_t unisonPhases[MAX_VOICES][UNISON_MAX_SIDES] = {};
+
+class Unison
+{
+public:
+  // Control task side. A preset from unisonPresets, or UNISON_OFF
+  void set(int preset)
+  {
+    __atomic_store_n(&m_preset, (int8_t)(preset >= 0 && preset < UNISON_PRESET_COUNT ? preset : UNISON_OFF),
+                     __ATOMIC_RELAXED);
+  }
+
+  // Audio task side. Picks up a new setting and returns the number of side
+  // oscillators to render, 0 when unison is off
+  int update()
+  {
+    int8_t preset = __atomic_load_n(&m_preset, __ATOMIC_RELAXED);
+    if (preset != m_cachedPreset)
+    {
+      m_cachedPreset = preset;
+      m_sides = preset == UNISON_OFF ? 0 : unisonPresets[preset].oscillators - 1;
+      if (m_sides > 0)
+      {
+        updateDetune(unisonPresets[preset]);
+      }
+    }
+    return m_sides;
+  }
+
+  // Side oscillators start spread round the cycle so they do not all peak together
+  static void restart(uint8_t slot)
+  {
+    for (int o = 0; o < UNISON_MAX_SIDES; o++)
+    {
+      unisonPhases[slot][o] = (o + 1) * 0x9E3779B9u;
+    }
+  }
+
+  // Per sample increment offsets of the side oscillators for a voice increment
+  void detuneSteps(uint32_t increment, int32_t *steps) const
+  {
+    for (int o = 0; o < m_sides; o++)
+    {
+      steps[o] = (int32_t)(((int64_t)increment * m_detune[o]) >> 24);
+    }
+  }
+
+  int32_t centreGain() const { return m_centreGain; }
+  // Side gain in both halves, for a packed pair
+  uint32_t sideGains() const { return pack16(m_sideGain, m_sideGain); }
+
+private:
+  void updateDetune(const UnisonPreset &preset)
+  {
+    // Pairs spread evenly out to the preset's detune, up then down
+    int pairs = m_sides / 2;
+    for (int p = 0; p < pairs; p++)
+    {
+      float cents = (float)preset.cents * (p + 1) / pairs;
+      float up = powf(2.0f, cents / 1200.0f);
+      m_detune[2 * p] = (int32_t)((up - 1) * (1 << 24));
+      m_detune[2 * p + 1] = (int32_t)((1 / up - 1) * (1 << 24));
+    }
+    // Keeps the summed power of the uncorrelated oscillators at one voice's
+    float centre = 1 / sqrtf(1 + m_sides * UNISON_SIDE_LEVEL * UNISON_SIDE_LEVEL);
+    m_centreGain = (int32_t)(centre * (1 << 14) + 0.5f);
+    m_sideGain = (int32_t)(centre * UNISON_SIDE_LEVEL * (1 << 14) + 0.5f);
+  }
+
+  int8_t m_preset = UNISON_OFF;
+
+  // Audio task state
+  int8_t m_cachedPreset = UNISON_OFF;
+  int m_sides = 0;
+  // Frequency ratio minus one of each side oscillator, Q24
+  int32_t m_detune[UNISON_MAX_SIDES] = {};
+  // Q14, so a full scale sample on every oscillator cannot overflow the sum
+  int32_t m_centreGain = 1 << 14;
+  int32_t m_sideGain = 0;
+};
+
+// One sample of a unison voice: advances the side oscillators of a slot by the
+// voice increment plus their detune and mixes them with the centre oscillator
+// at phase. Packed uses the dual multiply kernel, otherwise each oscillator is
+// read and weighted on its own, which is kept for comparison
+template <int BITS, bool Packed>
+inline int32_t unisonSample(const int16_t *table, uint32_t phase, uint32_t increment, uint32_t *phases,
+                            const int32_t *steps, int sides, int32_t centreGain, uint32_t sideGains)
+{
+  if (Packed)
+  {
+    int32_t acc = wavetableLookupPacked<BITS>(table, phase) * centreGain;
+    for (int o = 0; o < sides; o += 2)
+    {
+      phases[o] += increment + steps[o];
+      phases[o + 1] += increment + steps[o + 1];
+      uint32_t pair = pack16(wavetableLookupPacked<BITS>(table, phases[o]),
+                             wavetableLookupPacked<BITS>(table, phases[o + 1]));
+      acc = smlad(pair, sideGains, acc);
+    }
+    return acc >> 14;
+  }
+  else
+  {
+    int32_t sideGain = (int16_t)sideGains;
+    int32_t acc = wavetableLookup<BITS>(table, phase) * centreGain;
+    for (int o = 0; o < sides; o++)
+    {
+      phases[o] += increment + steps[o];
+      acc += wavetableLookup<BITS>(table, phases[o]) * sideGain;
+    }
+    return acc >> 14;
+  }
+}
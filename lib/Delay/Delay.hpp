@@ -0,0 +1,277 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Wavetable.hpp"
+
+// Time based effects on the stereo mix: a tempo synced echo with feedback, and
+// chorus / flanger reading the line at a modulated fractional delay. Both share
+// one mono delay line in a static buffer sized at compile time to a RAM budget.
+// The control task picks an effect and preset; the audio task rebuilds its Q16
+// timings only when that changes.
+
+// RAM given to the delay effects, line and state together
+constexpr size_t DELAY_RAM_BUDGET = 16 * 1024;
+// Part of it kept for the state alongside the line
+constexpr size_t DELAY_STATE_BYTES = 64;
+
+// Bits stored per sample. 8 is noisier but doubles the longest delay; build
+// with -DDELAY_SAMPLE_BITS=8 to use it
+#ifndef DELAY_SAMPLE_BITS
+#define DELAY_SAMPLE_BITS 16
+#endif
+
+#if DELAY_SAMPLE_BITS == 8
+typedef int8_t DelaySample;
+#else
+typedef int16_t DelaySample;
+#endif
+
+// Samples that fit the rest of the budget, 8160 (370 ms at 22050 Hz) for
+// 16-bit samples
+constexpr size_t DELAY_LENGTH = (DELAY_RAM_BUDGET - DELAY_STATE_BYTES) / sizeof(DelaySample);
+constexpr int DELAY_STORE_SHIFT = 16 - 8 * sizeof(DelaySample);
+
+enum DelayMode : uint8_t
+{
+  DELAY_OFF = 0,
+  DELAY_ECHO,
+  DELAY_CHORUS
+};
+
+struct EchoPreset
+{
+  const char *name;
+  float beats;
+  float feedback;
+  float mix;
+};
+
+// Echo times in beats, all of which fit the line from 108 BPM up. Any longer
+// than the line at slower tempos are shortened to fit
+constexpr EchoPreset echoPresets[] = {
+    {"1/16", 0.25f, 0.45f, 0.4f},
+    {"1/8 trip", 1.0f / 3, 0.4f, 0.4f},
+    {"1/8", 0.5f, 0.4f, 0.4f},
+    {"1/4 trip", 2.0f / 3, 0.35f, 0.35f},
+};
+constexpr int ECHO_PRESET_COUNT = sizeof(echoPresets) / sizeof(echoPresets[0]);
+
+struct ChorusPreset
+{
+  const char *name;
+  float delayMs;
+  float depthMs;
+  float rateHz;
+  float feedback;
+  float mix;
+};
+
+// The two channels read at opposite LFO phases, which widens the image
+constexpr ChorusPreset chorusPresets[] = {
+    {"Chorus", 12.0f, 4.0f, 0.8f, 0.0f, 0.5f},
+    {"Ensemble", 20.0f, 6.0f, 0.35f, 0.2f, 0.6f},
+    {"Flanger", 2.0f, 1.6f, 0.2f, 0.6f, 0.5f},
+};
+constexpr int CHORUS_PRESET_COUNT = sizeof(chorusPresets) / sizeof(chorusPresets[0]);
+
+class DelayEffects
+{
+public:
+  explicit DelayEffects(uint32_t sampleRate) : m_sampleRate(sampleRate) {}
+
+  // Control task side. The mode, preset and tempo are stored together so the
+  // audio task never sees half of a change
+  void set(int mode, int preset, int bpm)
+  {
+    int presets = mode == DELAY_ECHO ? ECHO_PRESET_COUNT : CHORUS_PRESET_COUNT;
+    mode = mode == DELAY_ECHO || mode == DELAY_CHORUS ? mode : DELAY_OFF;
+    preset = preset < 0 ? 0 : (preset >= presets ? presets - 1 : preset);
+    bpm = bpm < 1 ? 1 : (bpm > 255 ? 255 : bpm);
+    __atomic_store_n(&m_settings, (uint32_t)mode | (uint32_t)preset << 8 | (uint32_t)bpm << 16, __ATOMIC_RELAXED);
+  }
+
+  // Audio task side. True while an effect is on, so its tail has to be run on silence
+  bool active() const
+  {
+    return (__atomic_load_n(&m_settings, __ATOMIC_RELAXED) & 0xFF) != DELAY_OFF;
+  }
+
+  // Delay in samples the echo is set to, for checking on the host
+  uint32_t echoSamples() const { return m_delay >> 16; }
+
+  // Adds the effect to n Q15 samples of each channel in place
+  void process(int32_t *left, int32_t *right, size_t n)
+  {
+    uint32_t settings = __atomic_load_n(&m_settings, __ATOMIC_RELAXED);
+    if (settings != m_cachedSettings)
+    {
+      update(settings);
+    }
+
+    if (m_mode == DELAY_ECHO)
+    {
+      processEcho(left, right, n);
+    }
+    else if (m_mode == DELAY_CHORUS)
+    {
+      processChorus(left, right, n);
+    }
+  }
+
+  // Audio task side. Skips the effect for a block, when the renderer is short
+  // of time. It starts again from an empty line rather than replaying old audio
+  void suspend()
+  {
+    m_mode = DELAY_OFF;
+    m_cachedSettings = SETTINGS_NONE;
+  }
+
+private:
+  // Never a valid setting, so the next process() picks the real one up again
+  static constexpr uint32_t SETTINGS_NONE = 0xFF;
+
+  static int32_t toQ15(float value)
+  {
+    return (int32_t)(value * 32768 + 0.5f);
+  }
+
+  static DelaySample store(int32_t sample)
+  {
+    sample = sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample);
+    return (DelaySample)(sample >> DELAY_STORE_SHIFT);
+  }
+
+  int32_t load(uint32_t index) const
+  {
+    return (int32_t)m_line[index] * (1 << DELAY_STORE_SHIFT);
+  }
+
+  // Index samples (up to DELAY_LENGTH) behind the next write
+  uint32_t behind(uint32_t samples) const
+  {
+    return m_write >= samples ? m_write - samples : m_write + DELAY_LENGTH - samples;
+  }
+
+  void write(int32_t sample)
+  {
+    m_line[m_write] = store(sample);
+    m_write = m_write + 1 == DELAY_LENGTH ? 0 : m_write + 1;
+  }
+
+  // Line value delay (Q16 samples) behind the next write, interpolated linearly
+  int32_t read(uint32_t delay) const
+  {
+    uint32_t index = behind((delay + 0xFFFF) >> 16);
+    int32_t a = load(index);
+    int32_t b = load(index + 1 == DELAY_LENGTH ? 0 : index + 1);
+    int32_t frac = ((0u - delay) >> 1) & 0x7FFF;
+    return a + (((b - a) * frac) >> 15);
+  }
+
+  // Samples of a block before reads reach back delay samples (whole) into
+  // what was written since the effect changed. Until then they read silence
+  size_t unwritten(uint32_t delay) const
+  {
+    return delay > m_written ? delay - m_written : 0;
+  }
+
+  void advanceWritten(size_t n)
+  {
+    m_written = m_written + n < DELAY_LENGTH ? m_written + n : DELAY_LENGTH;
+  }
+
+  void update(uint32_t settings)
+  {
+    DelayMode mode = (DelayMode)(settings & 0xFF);
+    int preset = (settings >> 8) & 0xFF;
+    int bpm = (settings >> 16) & 0xFF;
+    const float samplesPerMs = m_sampleRate / 1000.0f;
+
+    // Switching effect starts from an empty line rather than replaying old
+    // audio. Reads of what has not been written since are taken as silence,
+    // so the 16 KB line is never cleared in the render path
+    if (mode != m_mode)
+    {
+      m_written = 0;
+      m_lfoPhase = 0;
+    }
+
+    if (mode == DELAY_ECHO)
+    {
+      const EchoPreset &p = echoPresets[preset];
+      float samples = p.beats * 60.0f * m_sampleRate / bpm;
+      samples = samples > DELAY_LENGTH - 1 ? DELAY_LENGTH - 1 : samples;
+      m_delay = (uint32_t)(samples + 0.5f) << 16;
+      m_feedback = toQ15(p.feedback);
+      m_mix = toQ15(p.mix);
+    }
+    else if (mode == DELAY_CHORUS)
+    {
+      const ChorusPreset &p = chorusPresets[preset];
+      m_delay = (uint32_t)(p.delayMs * samplesPerMs * 65536.0f);
+      m_depth = (uint32_t)(p.depthMs * samplesPerMs * 65536.0f);
+      m_lfoStep = (uint32_t)(p.rateHz / m_sampleRate * 4294967296.0f);
+      m_feedback = toQ15(p.feedback);
+      m_mix = toQ15(p.mix);
+    }
+    m_mode = mode;
+    m_cachedSettings = settings;
+  }
+
+  void processEcho(int32_t *left, int32_t *right, size_t n)
+  {
+    const uint32_t delay = m_delay >> 16;
+    const size_t silent = unwritten(delay);
+    for (size_t s = 0; s < n; s++)
+    {
+      int32_t echo = s >= silent ? load(behind(delay)) : 0;
+      int32_t in = (left[s] + right[s]) >> 1;
+      write(in + ((echo * m_feedback) >> 15));
+      int32_t wet = (echo * m_mix) >> 15;
+      left[s] += wet;
+      right[s] += wet;
+    }
+    advanceWritten(n);
+  }
+
+  void processChorus(int32_t *left, int32_t *right, size_t n)
+  {
+    // Farthest back either tap reads
+    const size_t silent = unwritten(((m_delay + m_depth) >> 16) + 1);
+    for (size_t s = 0; s < n; s++)
+    {
+      m_lfoPhase += m_lfoStep;
+      int32_t lfo = wavetableLookup(sineTable.samples, m_lfoPhase);
+      int32_t offset = (int32_t)(((int64_t)m_depth * lfo) >> 15);
+      int32_t tapLeft = s >= silent ? read(m_delay + offset) : 0;
+      int32_t tapRight = s >= silent ? read(m_delay - offset) : 0;
+
+      int32_t in = (left[s] + right[s]) >> 1;
+      write(in + ((tapLeft * m_feedback) >> 15));
+      left[s] += (tapLeft * m_mix) >> 15;
+      right[s] += (tapRight * m_mix) >> 15;
+    }
+    advanceWritten(n);
+  }
+
+  uint32_t m_sampleRate;
+  uint32_t m_settings = 0;
+
+  // Audio task state
+  uint32_t m_cachedSettings = 0;
+  DelayMode m_mode = DELAY_OFF;
+  // Q16 samples, and for the chorus the LFO swing either side of m_delay
+  uint32_t m_delay = 0;
+  uint32_t m_depth = 0;
+  uint32_t m_lfoPhase = 0;
+  uint32_t m_lfoStep = 0;
+  int32_t m_feedback = 0;
+  int32_t m_mix = 0;
+  uint32_t m_write = 0;
+  // Samples written since the effect last changed, up to DELAY_LENGTH
+  uint32_t m_written = 0;
+  DelaySample m_line[DELAY_LENGTH] = {};
+};
+
+static_assert(sizeof(DelayEffects) <= DELAY_RAM_BUDGET, "DelayEffects exceeds DELAY_RAM_BUDGET");
@@ -0,0 +1,219 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Voice_pool.hpp"
+#include "Wavetable.hpp"
+
+// Per-voice ADSR envelopes in Q15, advanced by the audio task once per
+// rendered block, or segment of one, and ramped linearly across it by the
+// renderer. Each segment walks a 32-bit position through an exponential curve
+// table, so the shape costs one table lookup per voice per block and no exp()
+// at run time.
+//
+// The key scan task keeps a released note's slot busy until finished() reports
+// that its release has reached silence, then frees it.
+
+constexpr int32_t ENVELOPE_MAX = 32767;
+
+// Knob positions 0 - 8 for each parameter
+constexpr int ENVELOPE_STEPS = 9;
+
+// Attack, decay and release time for each knob position
+constexpr uint16_t envelopeTimesMs[ENVELOPE_STEPS] = {3, 10, 25, 50, 100, 250, 500, 1000, 2000};
+
+constexpr int ENVELOPE_CURVE_BITS = 8;
+constexpr size_t ENVELOPE_CURVE_SIZE = 1 << ENVELOPE_CURVE_BITS;
+
+// How far the exponential falls over a segment, e^-5 = -43 dB before it is
+// pulled to exactly zero at the end
+constexpr double ENVELOPE_CURVATURE = 5.0;
+
+struct EnvelopeCurve
+{
+  int16_t samples[ENVELOPE_CURVE_SIZE + 1];
+};
+
+// Falls from ENVELOPE_MAX to 0. Decay and release read it directly, attack
+// reads it upside down for a fast start that eases into the peak
+constexpr EnvelopeCurve makeEnvelopeCurve(double curvature)
+{
+  EnvelopeCurve curve = {};
+  const double floor = constexprExp(-curvature);
+  for (size_t i = 0; i <= ENVELOPE_CURVE_SIZE; i++)
+  {
+    double value = (constexprExp(-curvature * i / ENVELOPE_CURVE_SIZE) - floor) / (1 - floor);
+    curve.samples[i] = (int16_t)(value * ENVELOPE_MAX + 0.5);
+  }
+  return curve;
+}
+
+constexpr EnvelopeCurve envelopeCurve = makeEnvelopeCurve(ENVELOPE_CURVATURE);
+
+enum EnvelopeStage : uint8_t
+{
+  ENVELOPE_IDLE = 0,
+  ENVELOPE_ATTACK,
+  ENVELOPE_DECAY,
+  ENVELOPE_SUSTAIN,
+  ENVELOPE_RELEASE
+};
+
+class VoiceEnvelopes
+{
+public:
+  explicit VoiceEnvelopes(uint32_t sampleRate) : m_sampleRate(sampleRate)
+  {
+    setShape(0, 0, ENVELOPE_STEPS - 1, 0);
+  }
+
+  // Control task side. Takes knob positions (0 - 8); sustain is a fraction of full level
+  void setShape(int attack, int decay, int sustain, int release)
+  {
+    __atomic_store_n(&m_attackRate, segmentRate(attack), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_decayRate, segmentRate(decay), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_sustain, ENVELOPE_MAX * clampStep(sustain) / (ENVELOPE_STEPS - 1), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_releaseRate, segmentRate(release), __ATOMIC_RELAXED);
+  }
+
+  // Key scan task side. True once the note given this generation of the slot
+  // has finished its release
+  bool finished(uint8_t slot, uint8_t generation) const
+  {
+    return __atomic_load_n(&m_finished[slot], __ATOMIC_ACQUIRE) == generation;
+  }
+
+  // Audio task side. Starts the attack for a new note in the slot, from
+  // whatever level the slot's previous note had reached
+  void trigger(uint8_t slot, uint8_t generation)
+  {
+    __atomic_store_n(&m_finished[slot], (uint8_t)(generation - 1), __ATOMIC_RELAXED);
+    m_generation[slot] = generation;
+    m_stage[slot] = ENVELOPE_ATTACK;
+    m_from[slot] = m_level[slot];
+    m_position[slot] = 0;
+  }
+
+  int32_t level(uint8_t slot) const { return m_level[slot]; }
+  bool idle(uint8_t slot) const { return m_stage[slot] == ENVELOPE_IDLE; }
+
+  // Advances a slot by n samples and returns its level at the end of them.
+  // Releases the voice once held is false
+  int32_t advance(uint8_t slot, bool held, size_t n)
+  {
+    uint8_t stage = m_stage[slot];
+    if (!held && stage != ENVELOPE_IDLE && stage != ENVELOPE_RELEASE)
+    {
+      stage = ENVELOPE_RELEASE;
+      m_from[slot] = m_level[slot];
+      m_position[slot] = 0;
+    }
+
+    int32_t level = m_level[slot];
+    int32_t sustain = __atomic_load_n(&m_sustain, __ATOMIC_RELAXED);
+    switch (stage)
+    {
+    case ENVELOPE_ATTACK:
+      if (step(slot, __atomic_load_n(&m_attackRate, __ATOMIC_RELAXED), n))
+      {
+        level = ENVELOPE_MAX;
+        stage = ENVELOPE_DECAY;
+      }
+      else
+      {
+        level = m_from[slot] + (((ENVELOPE_MAX - m_from[slot]) * (ENVELOPE_MAX - curveAt(m_position[slot]))) >> 15);
+      }
+      break;
+
+    case ENVELOPE_DECAY:
+      if (step(slot, __atomic_load_n(&m_decayRate, __ATOMIC_RELAXED), n))
+      {
+        level = sustain;
+        stage = ENVELOPE_SUSTAIN;
+      }
+      else
+      {
+        level = sustain + (((ENVELOPE_MAX - sustain) * curveAt(m_position[slot])) >> 15);
+      }
+      break;
+
+    case ENVELOPE_SUSTAIN:
+      // Follows the knob, the block ramp smooths the change
+      level = sustain;
+      break;
+
+    case ENVELOPE_RELEASE:
+      if (step(slot, __atomic_load_n(&m_releaseRate, __ATOMIC_RELAXED), n))
+      {
+        level = 0;
+        stage = ENVELOPE_IDLE;
+        __atomic_store_n(&m_finished[slot], m_generation[slot], __ATOMIC_RELEASE);
+      }
+      else
+      {
+        level = (m_from[slot] * curveAt(m_position[slot])) >> 15;
+      }
+      break;
+
+    default:
+      level = 0;
+      break;
+    }
+
+    m_stage[slot] = stage;
+    m_level[slot] = level;
+    return level;
+  }
+
+private:
+  static int clampStep(int step)
+  {
+    return step < 0 ? 0 : (step >= ENVELOPE_STEPS ? ENVELOPE_STEPS - 1 : step);
+  }
+
+  // Position increment per sample for a segment lasting the knob's time
+  uint32_t segmentRate(int step) const
+  {
+    uint64_t samples = (uint64_t)envelopeTimesMs[clampStep(step)] * m_sampleRate / 1000;
+    return (uint32_t)((1ull << 32) / (samples < 2 ? 2 : samples));
+  }
+
+  // Moves a segment on by n samples, returning true once it has finished
+  bool step(uint8_t slot, uint32_t rate, size_t n)
+  {
+    uint64_t position = m_position[slot] + (uint64_t)rate * n;
+    if (position > UINT32_MAX)
+    {
+      m_position[slot] = 0;
+      return true;
+    }
+    m_position[slot] = (uint32_t)position;
+    return false;
+  }
+
+  // Linearly interpolated curve value at a segment position
+  static int32_t curveAt(uint32_t position)
+  {
+    constexpr int FRAC_BITS = 32 - ENVELOPE_CURVE_BITS;
+    uint32_t index = position >> FRAC_BITS;
+    int32_t frac = (position >> (FRAC_BITS - 15)) & 0x7FFF;
+    int32_t a = envelopeCurve.samples[index];
+    int32_t b = envelopeCurve.samples[index + 1];
+    return a + (((b - a) * frac) >> 15);
+  }
+
+  uint32_t m_sampleRate;
+
+  uint32_t m_attackRate = 0;
+  uint32_t m_decayRate = 0;
+  int32_t m_sustain = ENVELOPE_MAX;
+  uint32_t m_releaseRate = 0;
+
+  // Per slot state, owned by the audio task apart from m_finished
+  uint8_t m_stage[MAX_VOICES] = {};
+  int32_t m_level[MAX_VOICES] = {};
+  int32_t m_from[MAX_VOICES] = {};
+  uint32_t m_position[MAX_VOICES] = {};
+  uint8_t m_generation[MAX_VOICES] = {};
+  uint8_t m_finished[MAX_VOICES] = {};
+};
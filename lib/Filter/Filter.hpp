@@ -0,0 +1,232 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Wavetable.hpp"
+
+// Resonant state-variable filter on the stereo mix, before the soft clip.
+// Uses the trapezoidal (zero delay feedback) form, which stays stable and in
+// tune up to the top of the cutoff range. The prewarped cutoff gains come from
+// a constexpr table, and the audio task only rebuilds the Q28 coefficients when
+// a setting changes, so the per sample path is integer multiply-adds with no
+// tan() or divide.
+
+enum FilterType : uint8_t
+{
+  FILTER_OFF = 0,
+  FILTER_LOW_PASS,
+  FILTER_BAND_PASS,
+  FILTER_HIGH_PASS,
+  FILTER_TYPE_COUNT
+};
+
+constexpr const char *filterTypeNames[FILTER_TYPE_COUNT] = {"Off", "Low", "Band", "High"};
+
+// Cutoff knob positions, spaced evenly in pitch below the top cutoff
+constexpr int FILTER_CUTOFF_STEPS = 64;
+constexpr int FILTER_STEPS_PER_OCTAVE = 7;
+// Top cutoff as a fraction of the sample rate, 9.9 kHz at 22050 Hz. The
+// lowest is 9 octaves down, 19 Hz
+constexpr double FILTER_TOP_CUTOFF = 0.45;
+
+// Resonance knob positions 0 - 8, from Q 0.5 (no peak) to Q 20
+constexpr int FILTER_RESONANCE_STEPS = 9;
+constexpr double FILTER_MIN_DAMPING = 0.05;
+constexpr double FILTER_DAMPING_LOG = -3.6888794541139363; // ln(FILTER_MIN_DAMPING / 2)
+
+constexpr int FILTER_COEFF_BITS = 28;
+// Extra bits of precision the filter state carries below the Q15 samples, so
+// the integrators still move at the lowest cutoffs. Leaves room for +-4x full
+// scale at Q 20
+constexpr int FILTER_STATE_BITS = 6;
+
+struct FilterCutoffTable
+{
+  // Cutoff as a fraction of the sample rate, and its prewarped gain tan(pi * cutoff)
+  float ratio[FILTER_CUTOFF_STEPS];
+  float gain[FILTER_CUTOFF_STEPS];
+};
+
+struct FilterResonanceTable
+{
+  // Damping, 1 / Q
+  float damping[FILTER_RESONANCE_STEPS];
+};
+
+constexpr FilterCutoffTable makeFilterCutoffTable()
+{
+  FilterCutoffTable table = {};
+  for (int step = 0; step < FILTER_CUTOFF_STEPS; step++)
+  {
+    int below = FILTER_CUTOFF_STEPS - 1 - step;
+    double ratio = FILTER_TOP_CUTOFF * constexprExp(-0.6931471805599453 * below / FILTER_STEPS_PER_OCTAVE);
+    double angle = WAVETABLE_PI * ratio;
+    table.ratio[step] = (float)ratio;
+    table.gain[step] = (float)(constexprSin(angle) / constexprCos(angle));
+  }
+  return table;
+}
+
+// Damping falls geometrically so each knob step adds the same number of dB of peak
+constexpr FilterResonanceTable makeFilterResonanceTable()
+{
+  FilterResonanceTable table = {};
+  for (int step = 0; step < FILTER_RESONANCE_STEPS; step++)
+  {
+    double fraction = (double)step / (FILTER_RESONANCE_STEPS - 1);
+    // 2 * (FILTER_MIN_DAMPING / 2) ^ fraction
+    table.damping[step] = (float)(2 * constexprExp(FILTER_DAMPING_LOG * fraction));
+  }
+  return table;
+}
+
+constexpr FilterCutoffTable filterCutoffTable = makeFilterCutoffTable();
+constexpr FilterResonanceTable filterResonanceTable = makeFilterResonanceTable();
+
+// Cutoff of a knob position in Hz, for the display
+inline uint32_t filterCutoffHz(int step, uint32_t sampleRate)
+{
+  step = step < 0 ? 0 : (step >= FILTER_CUTOFF_STEPS ? FILTER_CUTOFF_STEPS - 1 : step);
+  return (uint32_t)(filterCutoffTable.ratio[step] * sampleRate + 0.5f);
+}
+
+class StereoFilter
+{
+public:
+  StereoFilter()
+  {
+    set(FILTER_OFF, FILTER_CUTOFF_STEPS - 1, 0);
+  }
+
+  // Control task side. Takes knob positions; the three are stored together so
+  // the audio task never sees half of a change
+  void set(int type, int cutoff, int resonance)
+  {
+    type = type < 0 ? 0 : (type >= FILTER_TYPE_COUNT ? FILTER_TYPE_COUNT - 1 : type);
+    cutoff = cutoff < 0 ? 0 : (cutoff >= FILTER_CUTOFF_STEPS ? FILTER_CUTOFF_STEPS - 1 : cutoff);
+    resonance = resonance < 0 ? 0 : (resonance >= FILTER_RESONANCE_STEPS ? FILTER_RESONANCE_STEPS - 1 : resonance);
+    __atomic_store_n(&m_settings, (uint32_t)type | (uint32_t)cutoff << 8 | (uint32_t)resonance << 16,
+                     __ATOMIC_RELAXED);
+  }
+
+  // Audio task side. Filters n Q15 samples of each channel in place
+  void process(int32_t *left, int32_t *right, size_t n)
+  {
+    uint32_t settings = __atomic_load_n(&m_settings, __ATOMIC_RELAXED);
+    if (settings != m_cachedSettings)
+    {
+      updateCoefficients(settings);
+    }
+
+    switch (m_type)
+    {
+    case FILTER_LOW_PASS:
+      processChannels<FILTER_LOW_PASS>(left, right, n);
+      break;
+    case FILTER_BAND_PASS:
+      processChannels<FILTER_BAND_PASS>(left, right, n);
+      break;
+    case FILTER_HIGH_PASS:
+      processChannels<FILTER_HIGH_PASS>(left, right, n);
+      break;
+    default:
+      break;
+    }
+  }
+
+  FilterType type() const { return m_type; }
+
+private:
+  struct State
+  {
+    int32_t ic1 = 0;
+    int32_t ic2 = 0;
+  };
+
+  static int32_t toCoeff(float value)
+  {
+    return (int32_t)(value * (1 << FILTER_COEFF_BITS) + 0.5f);
+  }
+
+  static int32_t mulCoeff(int32_t coeff, int32_t x)
+  {
+    return (int32_t)(((int64_t)coeff * x) >> FILTER_COEFF_BITS);
+  }
+
+  void updateCoefficients(uint32_t settings)
+  {
+    FilterType type = (FilterType)(settings & 0xFF);
+    float g = filterCutoffTable.gain[(settings >> 8) & 0xFF];
+    float k = filterResonanceTable.damping[(settings >> 16) & 0xFF];
+    float a1 = 1 / (1 + g * (g + k));
+    m_a1 = toCoeff(a1);
+    m_a2 = toCoeff(g * a1);
+    m_a3 = toCoeff(g * g * a1);
+    m_k = toCoeff(k);
+
+    // Start from rest when the filter is switched in, so old state does not thump
+    if (type != m_type)
+    {
+      m_left = State();
+      m_right = State();
+    }
+    m_type = type;
+    m_cachedSettings = settings;
+  }
+
+  template <FilterType Type>
+  void processChannels(int32_t *left, int32_t *right, size_t n)
+  {
+    processChannel<Type>(left, n, m_left);
+    processChannel<Type>(right, n, m_right);
+  }
+
+  template <FilterType Type>
+  void processChannel(int32_t *x, size_t n, State &state)
+  {
+    const int32_t a1 = m_a1;
+    const int32_t a2 = m_a2;
+    const int32_t a3 = m_a3;
+    const int32_t k = m_k;
+    int32_t ic1 = state.ic1;
+    int32_t ic2 = state.ic2;
+    for (size_t s = 0; s < n; s++)
+    {
+      int32_t v0 = x[s] * (1 << FILTER_STATE_BITS);
+      int32_t v3 = v0 - ic2;
+      int32_t band = mulCoeff(a1, ic1) + mulCoeff(a2, v3);
+      int32_t low = ic2 + mulCoeff(a2, ic1) + mulCoeff(a3, v3);
+      ic1 = 2 * band - ic1;
+      ic2 = 2 * low - ic2;
+      int32_t y;
+      if (Type == FILTER_LOW_PASS)
+      {
+        y = low;
+      }
+      else if (Type == FILTER_BAND_PASS)
+      {
+        // Scaled by the damping so the peak is at unity whatever the resonance
+        y = mulCoeff(k, band);
+      }
+      else
+      {
+        y = v0 - mulCoeff(k, band) - low;
+      }
+      x[s] = y >> FILTER_STATE_BITS;
+    }
+    state.ic1 = ic1;
+    state.ic2 = ic2;
+  }
+
+  uint32_t m_settings = 0;
+
+  // Audio task state
+  uint32_t m_cachedSettings = UINT32_MAX;
+  FilterType m_type = FILTER_OFF;
+  int32_t m_a1 = 0;
+  int32_t m_a2 = 0;
+  int32_t m_a3 = 0;
+  int32_t m_k = 0;
+  State m_left;
+  State m_right;
+};
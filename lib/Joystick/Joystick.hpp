@@ -0,0 +1,160 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Joystick filtering and calibration, free of the hardware so it can run on
+// recorded ADC traces on the host. The ADC converts both axes continuously
+// (Joystick_adc.hpp) and hands each batch of samples to Joystick::update from
+// its DMA interrupt. Every axis is smoothed by a one-pole low pass in fixed
+// point, its centre is taken from the first samples after power up, while the
+// stick is left alone, and a deadzone around the centre reads as zero.
+//
+// Positions run from -JOYSTICK_SCALE at the low end of the stick's travel to
+// JOYSTICK_SCALE at the high end, measured from the edge of the deadzone so
+// they are continuous through it. Both axes are published together in one
+// word, so any task reads the latest pair with a single load and no lock.
+
+constexpr int JOYSTICK_AXES = 2;
+constexpr int JOYSTICK_X = 0;
+constexpr int JOYSTICK_Y = 1;
+
+// 12-bit ADC counts, after the hardware has averaged 16 conversions
+constexpr int32_t JOYSTICK_FULL_SCALE = 4095;
+// Each axis is converted 16 times at 640.5 + 12.5 cycles of a 20 MHz ADC
+// clock, alternating with the other axis
+constexpr uint32_t JOYSTICK_SAMPLE_HZ = 20000000 / (16 * 653 * JOYSTICK_AXES);
+
+// Low pass weight of each new sample, 1 / 2^shift, about 4 ms
+constexpr int JOYSTICK_SMOOTHING_SHIFT = 2;
+// Extra fraction bits the filter keeps
+constexpr int JOYSTICK_FILTER_BITS = 4;
+// Samples averaged for the centre, about 70 ms
+constexpr int JOYSTICK_CALIBRATION_SAMPLES = 64;
+// Half width of the deadzone, 5% of full scale
+constexpr int32_t JOYSTICK_DEADZONE = 205;
+// Full travel is taken 2% short of either rail, which noise and the stick's
+// own stops keep it from reaching
+constexpr int32_t JOYSTICK_END_MARGIN = 82;
+
+// Position at either end
+constexpr int32_t JOYSTICK_SCALE = 4096;
+
+struct JoystickCalibration
+{
+  int32_t centre = JOYSTICK_FULL_SCALE / 2;
+  int32_t low = JOYSTICK_END_MARGIN;
+  int32_t high = JOYSTICK_FULL_SCALE - JOYSTICK_END_MARGIN;
+  int32_t deadzone = JOYSTICK_DEADZONE;
+};
+
+struct JoystickPosition
+{
+  int16_t x;
+  int16_t y;
+};
+
+class JoystickAxis
+{
+public:
+  void sample(uint16_t adc)
+  {
+    const int32_t value = (int32_t)adc << JOYSTICK_FILTER_BITS;
+    if (m_samples == 0)
+    {
+      m_state = value;
+    }
+    m_state += (value - m_state) >> JOYSTICK_SMOOTHING_SHIFT;
+    if (m_samples < JOYSTICK_CALIBRATION_SAMPLES)
+    {
+      m_sum += adc;
+      if (++m_samples == JOYSTICK_CALIBRATION_SAMPLES)
+      {
+        m_calibration.centre = (m_sum + JOYSTICK_CALIBRATION_SAMPLES / 2) / JOYSTICK_CALIBRATION_SAMPLES;
+      }
+    }
+  }
+
+  bool calibrated() const { return m_samples == JOYSTICK_CALIBRATION_SAMPLES; }
+
+  // Smoothed level in ADC counts
+  int32_t filtered() const
+  {
+    return (m_state + (1 << (JOYSTICK_FILTER_BITS - 1))) >> JOYSTICK_FILTER_BITS;
+  }
+
+  // Smoothed level as a position, zero until calibrated
+  int32_t position() const
+  {
+    if (!calibrated())
+    {
+      return 0;
+    }
+    const JoystickCalibration &c = m_calibration;
+    const int32_t offset = filtered() - c.centre;
+    if (offset > c.deadzone)
+    {
+      const int32_t span = c.high - c.centre - c.deadzone;
+      return span > 0 && offset - c.deadzone < span ? (offset - c.deadzone) * JOYSTICK_SCALE / span
+                                                    : JOYSTICK_SCALE;
+    }
+    if (offset < -c.deadzone)
+    {
+      const int32_t span = c.centre - c.low - c.deadzone;
+      return span > 0 && -offset - c.deadzone < span ? (offset + c.deadzone) * JOYSTICK_SCALE / span
+                                                     : -JOYSTICK_SCALE;
+    }
+    return 0;
+  }
+
+  const JoystickCalibration &calibration() const { return m_calibration; }
+
+  // Replaces the centre found at power up, and the ends and deadzone
+  void calibrate(const JoystickCalibration &calibration)
+  {
+    m_calibration = calibration;
+    m_samples = JOYSTICK_CALIBRATION_SAMPLES;
+  }
+
+private:
+  int32_t m_state = 0;
+  int32_t m_sum = 0;
+  int m_samples = 0;
+  JoystickCalibration m_calibration;
+};
+
+class Joystick
+{
+public:
+  // Samples interleaved x, y, x, y..., from the ADC's DMA interrupt. Publishes
+  // the positions after the batch
+  void update(const volatile uint16_t *samples, size_t scans)
+  {
+    for (size_t i = 0; i < scans; i++)
+    {
+      m_axes[JOYSTICK_X].sample(samples[JOYSTICK_AXES * i + JOYSTICK_X]);
+      m_axes[JOYSTICK_Y].sample(samples[JOYSTICK_AXES * i + JOYSTICK_Y]);
+    }
+    const uint32_t packed = (uint16_t)m_axes[JOYSTICK_X].position() |
+                            (uint32_t)(uint16_t)m_axes[JOYSTICK_Y].position() << 16;
+    __atomic_store_n(&m_latest, packed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_scans, scans, __ATOMIC_RELAXED);
+  }
+
+  // Latest positions of both axes, from any task
+  JoystickPosition position() const
+  {
+    const uint32_t packed = __atomic_load_n(&m_latest, __ATOMIC_RELAXED);
+    return {(int16_t)(packed & 0xFFFF), (int16_t)(packed >> 16)};
+  }
+
+  // Samples taken of each axis since start
+  uint32_t scans() const { return __atomic_load_n(&m_scans, __ATOMIC_RELAXED); }
+
+  // Only while the ADC is stopped, or on the host
+  JoystickAxis &axis(int axis) { return m_axes[axis]; }
+
+private:
+  JoystickAxis m_axes[JOYSTICK_AXES];
+  uint32_t m_latest = 0;
+  uint32_t m_scans = 0;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <Arduino.h>
+
+#include "Joystick.hpp"
+
+// Both joystick axes sampled continuously by ADC1 in scan mode, with a
+// circular DMA transfer into joystickBuffer. The ADC averages 16 conversions
+// of each axis in hardware before it writes a result, so nothing waits on a
+// conversion and no task calls analogRead. The half/full transfer interrupts
+// pass each half of the buffer to the joystick's filters.
+
+// Scans of both axes in each half of the buffer, about 4 ms
+constexpr size_t JOYSTICK_HALF_SCANS = 4;
+constexpr size_t JOYSTICK_BUFFER_SIZE = 2 * JOYSTICK_HALF_SCANS * JOYSTICK_AXES;
+
+volatile uint16_t joystickBuffer[JOYSTICK_BUFFER_SIZE];
+Joystick joystick;
+
+ADC_HandleTypeDef hadcJoystick;
+DMA_HandleTypeDef hdmaJoystick;
+
+extern "C" void DMA1_Channel1_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdmaJoystick);
+}
+
+extern "C" void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+  joystick.update(joystickBuffer, JOYSTICK_HALF_SCANS);
+}
+
+extern "C" void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+  joystick.update(&joystickBuffer[JOYSTICK_BUFFER_SIZE / 2], JOYSTICK_HALF_SCANS);
+}
+
+// x and y are the pins' ADC1 channels, converted in that order
+void initJoystickInput(uint32_t xChannel, uint32_t yChannel)
+{
+  __HAL_RCC_ADC_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  // Continuous conversion of the two channels from the 80 MHz bus clock / 4,
+  // each averaged over 16 conversions and shifted back to 12 bits
+  hadcJoystick.Instance = ADC1;
+  hadcJoystick.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
+  hadcJoystick.Init.Resolution = ADC_RESOLUTION_12B;
+  hadcJoystick.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+  hadcJoystick.Init.ScanConvMode = ADC_SCAN_ENABLE;
+  hadcJoystick.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+  hadcJoystick.Init.LowPowerAutoWait = DISABLE;
+  hadcJoystick.Init.ContinuousConvMode = ENABLE;
+  hadcJoystick.Init.NbrOfConversion = JOYSTICK_AXES;
+  hadcJoystick.Init.DiscontinuousConvMode = DISABLE;
+  hadcJoystick.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+  hadcJoystick.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+  hadcJoystick.Init.DMAContinuousRequests = ENABLE;
+  hadcJoystick.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+  hadcJoystick.Init.OversamplingMode = ENABLE;
+  hadcJoystick.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_16;
+  hadcJoystick.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
+  hadcJoystick.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+  hadcJoystick.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+  HAL_ADC_Init(&hadcJoystick);
+
+  ADC_ChannelConfTypeDef channelConfig = {};
+  channelConfig.SamplingTime = ADC_SAMPLETIME_640CYCLES_5;
+  channelConfig.SingleDiff = ADC_SINGLE_ENDED;
+  channelConfig.OffsetNumber = ADC_OFFSET_NONE;
+  channelConfig.Channel = xChannel;
+  channelConfig.Rank = ADC_REGULAR_RANK_1;
+  HAL_ADC_ConfigChannel(&hadcJoystick, &channelConfig);
+  channelConfig.Channel = yChannel;
+  channelConfig.Rank = ADC_REGULAR_RANK_2;
+  HAL_ADC_ConfigChannel(&hadcJoystick, &channelConfig);
+  HAL_ADCEx_Calibration_Start(&hadcJoystick, ADC_SINGLE_ENDED);
+
+  // DMA1 channel 1, request 0 is ADC1
+  hdmaJoystick.Instance = DMA1_Channel1;
+  hdmaJoystick.Init.Request = DMA_REQUEST_0;
+  hdmaJoystick.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdmaJoystick.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdmaJoystick.Init.MemInc = DMA_MINC_ENABLE;
+  hdmaJoystick.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdmaJoystick.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  hdmaJoystick.Init.Mode = DMA_CIRCULAR;
+  hdmaJoystick.Init.Priority = DMA_PRIORITY_LOW;
+  HAL_DMA_Init(&hdmaJoystick);
+  __HAL_LINKDMA(&hadcJoystick, DMA_Handle, hdmaJoystick);
+
+  // Below the audio DMA, which must never wait for the joystick
+  HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 7, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  HAL_ADC_Start_DMA(&hadcJoystick, (uint32_t *)joystickBuffer, JOYSTICK_BUFFER_SIZE);
+}
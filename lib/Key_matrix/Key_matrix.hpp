@@ -0,0 +1,255 @@
+#pragma once
+#include <stdint.h>
+
+// The key and knob switch matrix: rows 0 - 2 are the 12 keys, rows 3 - 6 the
+// knobs' quadrature pairs, their push buttons, the joystick button and the
+// handshake inputs from neighbouring keyboards. Each row has four columns,
+// which read low while a switch is closed. The row address also picks one of
+// the output latches (display enable and reset, the handshake outputs), which
+// takes the output bit whenever its row is driven.
+//
+// On the board a timer interrupt scans the matrix one row per tick: each tick
+// reads the row driven at the tick before, which has had the whole tick to
+// settle, so nothing waits, then drives the next row in matrixSchedule. The
+// key rows come round every fourth tick, the knobs' quadrature rows three
+// times in 32 ticks and the button rows once.
+// Rows are published into a single word, so readers see each row whole and
+// only the interrupt drives the row select lines. scan() reads all seven rows
+// at once, waiting for each, for use before the timer starts and on the host.
+//
+// Every key has an integrator, counting up for each sample it reads closed and
+// down for each it reads open. A key is pressed once its count reaches
+// DEBOUNCE_SAMPLES and released once it falls back to zero, so bounces shorter
+// than that many samples never change it. Each change is queued as a KeyEvent
+// stamped with the tick it was seen at.
+//
+// KeyMatrix reaches the pins through a Pins class, the register level one in
+// Matrix_pins.hpp on the board or MockMatrixPins (src/host/Mock_matrix.hpp)
+// on the host, which provides:
+//   void select(uint8_t row, bool out)  row enable low, then the address and output bit
+//   void enable()                       row enable high, driving the row
+//   void disable()                      row enable low
+//   void settle()                       waits for the columns to follow the row
+//   uint8_t columns()                   the four columns, C0 in bit 0
+
+constexpr int MATRIX_ROWS = 7;
+constexpr int MATRIX_COLUMNS = 4;
+constexpr int MATRIX_KEY_ROWS = 3;
+
+// A frame holds row r in bits 4r to 4r + 3. Nothing pressed reads all ones
+constexpr uint32_t MATRIX_OPEN = (1u << (MATRIX_COLUMNS * MATRIX_ROWS)) - 1;
+
+// Output latch bits, by row address
+constexpr uint8_t MATRIX_DEN_BIT = 3;
+constexpr uint8_t MATRIX_DRST_BIT = 4;
+constexpr uint8_t MATRIX_HKOW_BIT = 5;
+constexpr uint8_t MATRIX_HKOE_BIT = 6;
+
+// Scan interrupt rate, and the rows read at successive ticks
+constexpr uint32_t MATRIX_TICK_HZ = 2000;
+constexpr uint8_t matrixSchedule[] = {0, 1, 2, 3, 0, 1, 2, 4, 0, 1, 2, 3, 0, 1, 2, 4,
+                                      0, 1, 2, 3, 0, 1, 2, 4, 0, 1, 2, 5, 0, 1, 2, 6};
+constexpr int MATRIX_SCHEDULE_LENGTH = sizeof(matrixSchedule);
+
+// Agreeing samples a key needs to change, at one sample per 2 ms
+constexpr uint8_t DEBOUNCE_SAMPLES = 3;
+
+constexpr int KEY_EVENT_QUEUE_LENGTH = 32;
+
+struct KeyEvent
+{
+  // Scan tick the change was seen at
+  uint32_t tick;
+  uint8_t key;
+  bool pressed;
+};
+
+// Lock free ring for one writer and one reader: the writer only moves the
+// head and the reader only the tail, each publishing its slot with a release
+// store the other side acquires. N must be a power of two
+template <class T, uint32_t N>
+class EventQueue
+{
+  static_assert((N & (N - 1)) == 0, "EventQueue length must be a power of two");
+
+public:
+  // False, dropping the event, if the reader has fallen N behind
+  bool push(const T &event)
+  {
+    const uint32_t head = m_head;
+    if (head - __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) == N)
+    {
+      return false;
+    }
+    m_events[head & (N - 1)] = event;
+    __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool pop(T *event)
+  {
+    const uint32_t tail = m_tail;
+    if (__atomic_load_n(&m_head, __ATOMIC_ACQUIRE) == tail)
+    {
+      return false;
+    }
+    *event = m_events[tail & (N - 1)];
+    __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  T m_events[N];
+  uint32_t m_head = 0;
+  uint32_t m_tail = 0;
+};
+
+// Column levels of one row
+inline uint8_t matrixRow(uint32_t frame, int row)
+{
+  return (frame >> (MATRIX_COLUMNS * row)) & 0x0F;
+}
+
+// Keys held, C in bit 0
+inline uint16_t matrixKeys(uint32_t frame)
+{
+  return ~frame & 0x0FFF;
+}
+
+template <class Pins>
+class KeyMatrix
+{
+public:
+  explicit KeyMatrix(Pins &pins) : m_pins(pins) {}
+
+  // Sets an output latch now, and keeps it at that level through every scan
+  // after. Only before the scan timer starts
+  void setOutput(uint8_t bit, bool value)
+  {
+    m_outputs = value ? m_outputs | 1u << bit : m_outputs & ~(1u << bit);
+    m_pins.select(bit, value);
+    m_pins.enable();
+    m_pins.settle();
+    m_pins.disable();
+  }
+
+  // Reads every row and publishes the frame, undebounced. Not while the scan
+  // timer runs
+  uint32_t scan()
+  {
+    uint32_t frame = 0;
+    for (int row = 0; row < MATRIX_ROWS; row++)
+    {
+      m_pins.select(row, (m_outputs >> row) & 1);
+      m_pins.enable();
+      m_pins.settle();
+      frame |= (uint32_t)(m_pins.columns() & 0x0F) << (MATRIX_COLUMNS * row);
+    }
+    m_scanFrame = frame;
+    __atomic_store_n(&m_frame, frame, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_scans, 1, __ATOMIC_RELAXED);
+    return frame;
+  }
+
+  // Drives the first row of the schedule, ready for the first tick
+  void start()
+  {
+    m_slot = 0;
+    m_pins.select(matrixSchedule[0], (m_outputs >> matrixSchedule[0]) & 1);
+    m_pins.enable();
+  }
+
+  // One scan step, from the timer interrupt: reads the row start() or the
+  // last tick drove and drives the next. Returns the key events it queued
+  int tick()
+  {
+    const uint8_t row = matrixSchedule[m_slot];
+    const uint8_t columns = m_pins.columns() & 0x0F;
+    m_slot = (m_slot + 1) % MATRIX_SCHEDULE_LENGTH;
+    const uint8_t next = matrixSchedule[m_slot];
+    m_pins.select(next, (m_outputs >> next) & 1);
+    m_pins.enable();
+
+    const uint32_t tick = m_ticks + 1;
+    const int shift = MATRIX_COLUMNS * row;
+    m_scanFrame = (m_scanFrame & ~(0x0Fu << shift)) | (uint32_t)columns << shift;
+    __atomic_store_n(&m_frame, m_scanFrame, __ATOMIC_RELAXED);
+    if (m_slot == 0)
+    {
+      __atomic_add_fetch(&m_scans, 1, __ATOMIC_RELAXED);
+    }
+    int events = row < MATRIX_KEY_ROWS ? debounce(row, columns, tick) : 0;
+    __atomic_store_n(&m_ticks, tick, __ATOMIC_RELAXED);
+    return events;
+  }
+
+  // The latest level of every row, from any task
+  uint32_t frame() const { return __atomic_load_n(&m_frame, __ATOMIC_RELAXED); }
+
+  // Frames scanned since start, whole passes of the schedule for the timer
+  uint32_t scans() const { return __atomic_load_n(&m_scans, __ATOMIC_RELAXED); }
+
+  // Debounced keys held, C in bit 0, from any task
+  uint16_t keys() const { return __atomic_load_n(&m_keys, __ATOMIC_RELAXED); }
+
+  // The next key change, oldest first. Only one task reads events
+  bool nextEvent(KeyEvent *event) { return m_events.pop(event); }
+
+  // Scan ticks since start, the clock events are stamped with
+  uint32_t ticks() const { return __atomic_load_n(&m_ticks, __ATOMIC_RELAXED); }
+
+  // Events dropped because the queue was full. The reader should take keys()
+  // as the held keys whenever this changes
+  uint32_t overflows() const { return __atomic_load_n(&m_overflows, __ATOMIC_RELAXED); }
+
+private:
+  int debounce(uint8_t row, uint8_t columns, uint32_t tick)
+  {
+    uint16_t keys = m_keys;
+    int events = 0;
+    for (int column = 0; column < MATRIX_COLUMNS; column++)
+    {
+      const uint8_t key = MATRIX_COLUMNS * row + column;
+      uint8_t &count = m_integrators[key];
+      const bool held = (keys >> key) & 1;
+      if ((columns >> column) & 1)
+      {
+        if (count == 0 || --count > 0 || !held)
+        {
+          continue;
+        }
+        keys &= ~(1u << key);
+      }
+      else
+      {
+        if (count == DEBOUNCE_SAMPLES || ++count < DEBOUNCE_SAMPLES || held)
+        {
+          continue;
+        }
+        keys |= 1u << key;
+      }
+      if (!m_events.push({tick, key, !held}))
+      {
+        __atomic_add_fetch(&m_overflows, 1, __ATOMIC_RELAXED);
+      }
+      events++;
+    }
+    __atomic_store_n(&m_keys, keys, __ATOMIC_RELAXED);
+    return events;
+  }
+
+  Pins &m_pins;
+  // Outputs are left high, as the display and handshake need them, until set
+  uint8_t m_outputs = 0x7F;
+  uint32_t m_frame = MATRIX_OPEN;
+  uint32_t m_scans = 0;
+
+  // Scan interrupt state
+  uint32_t m_scanFrame = MATRIX_OPEN;
+  uint8_t m_slot = 0;
+  uint8_t m_integrators[MATRIX_COLUMNS * MATRIX_KEY_ROWS] = {};
+  uint16_t m_keys = 0;
+  uint32_t m_ticks = 0;
+  uint32_t m_overflows = 0;
+  EventQueue<KeyEvent, KEY_EVENT_QUEUE_LENGTH> m_events;
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <Arduino.h>
+#include <HardwareTimer.h>
+
+#include "Key_matrix.hpp"
+
+// The matrix pins at register level. Each pin's port and mask are looked up
+// once in begin(), where digitalWrite and digitalRead look them up on every
+// call; after that a pin is set or cleared with one BSRR write, which needs no
+// read-modify-write and so cannot race an interrupt, and read with one IDR load.
+
+// Time the column lines take to follow a newly driven row
+constexpr uint32_t MATRIX_SETTLE_US = 3;
+
+struct GpioPin
+{
+  GPIO_TypeDef *port = nullptr;
+  uint32_t mask = 0;
+
+  void begin(int pin, uint32_t mode)
+  {
+    pinMode(pin, mode);
+    port = digitalPinToPort(pin);
+    mask = digitalPinToBitMask(pin);
+  }
+
+  // BSRR sets the pins in its low half and resets those in its high half
+  void write(bool high) const
+  {
+    port->BSRR = high ? mask : mask << 16;
+  }
+
+  bool read() const
+  {
+    return (port->IDR & mask) != 0;
+  }
+};
+
+class MatrixPins
+{
+public:
+  MatrixPins(const int (&address)[3], int enable, int out, const int (&columns)[MATRIX_COLUMNS])
+      : m_addressPins{address[0], address[1], address[2]}, m_enablePin(enable), m_outPin(out),
+        m_columnPins{columns[0], columns[1], columns[2], columns[3]}
+  {
+  }
+
+  // Sets the pin directions. Call from setup, before the first scan
+  void begin()
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      m_address[i].begin(m_addressPins[i], OUTPUT);
+    }
+    m_enable.begin(m_enablePin, OUTPUT);
+    m_out.begin(m_outPin, OUTPUT);
+    for (int i = 0; i < MATRIX_COLUMNS; i++)
+    {
+      m_columns[i].begin(m_columnPins[i], INPUT);
+    }
+  }
+
+  void select(uint8_t row, bool out)
+  {
+    m_enable.write(false);
+    m_address[0].write(row & 0x01);
+    m_address[1].write(row & 0x02);
+    m_address[2].write(row & 0x04);
+    m_out.write(out);
+  }
+
+  void enable() { m_enable.write(true); }
+  void disable() { m_enable.write(false); }
+  void settle() const { delayMicroseconds(MATRIX_SETTLE_US); }
+
+  uint8_t columns() const
+  {
+    return m_columns[0].read() | m_columns[1].read() << 1 | m_columns[2].read() << 2 | m_columns[3].read() << 3;
+  }
+
+private:
+  int m_addressPins[3];
+  int m_enablePin;
+  int m_outPin;
+  int m_columnPins[MATRIX_COLUMNS];
+  GpioPin m_address[3];
+  GpioPin m_enable;
+  GpioPin m_out;
+  GpioPin m_columns[MATRIX_COLUMNS];
+};
+
+// Calls isr at MATRIX_TICK_HZ. The interrupt sits below the audio DMA's and,
+// like it, at or below configMAX_SYSCALL_INTERRUPT_PRIORITY to use the FromISR API
+inline HardwareTimer *startMatrixTimer(TIM_TypeDef *instance, void (*isr)())
+{
+  HardwareTimer *timer = new HardwareTimer(instance);
+  timer->setOverflow(MATRIX_TICK_HZ, HERTZ_FORMAT);
+  timer->setInterruptPriority(7, 0);
+  timer->attachInterrupt(isr);
+  timer->resume();
+  return timer;
+}
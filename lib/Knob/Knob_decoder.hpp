@@ -0,0 +1,145 @@
+#pragma once
+#include <stdint.h>
+
+#include "Key_matrix.hpp"
+
+// Quadrature decoding for all four knobs at once, from the matrix frame the
+// scan interrupt keeps. Matrix rows 3 and 4 hold the knobs' A and B pairs,
+// knob 3 in the two low bits of row 3 up to knob 0 in the two high bits of
+// row 4, so one byte of the frame is a snapshot of every knob.
+//
+// Each knob's last and new pair index knobTransitions, which gives the steps
+// taken and the way the knob moved. A knob counts one step per half cycle, on
+// 00 -> 01 and 11 -> 10 turning up and their reverses turning down, as the
+// detents fall; the other two changes of one bit only show the direction. A
+// change of both bits means a state was missed between two reads, which is
+// always one step, taken in the direction the knob last moved.
+//
+// Steps are also accelerated by how quickly they follow each other in the
+// same direction, and published as KnobEvents through a lock free queue for
+// readControlsTask.
+
+constexpr int KNOB_COUNT = 4;
+constexpr int KNOB_FIRST_ROW = 3;
+
+// Marks a transition that skipped a state
+constexpr int8_t KNOB_MISSED = 2;
+
+struct KnobTransition
+{
+  int8_t steps;
+  int8_t direction;
+};
+
+// By last pair << 2 | new pair
+constexpr KnobTransition knobTransitions[16] = {
+    {0, 0}, {1, 1}, {0, -1}, {KNOB_MISSED, 0},   // from 00
+    {-1, -1}, {0, 0}, {KNOB_MISSED, 0}, {0, 1},  // from 01
+    {0, 1}, {KNOB_MISSED, 0}, {0, 0}, {-1, -1},  // from 10
+    {KNOB_MISSED, 0}, {0, -1}, {1, 1}, {0, 0}};  // from 11
+
+// Step multipliers, for steps within each interval of the last one in the
+// same direction, in scan ticks (40, 20 and 10 ms)
+constexpr uint32_t knobAccelerationTicks[] = {80, 40, 20};
+constexpr int8_t knobAcceleration[] = {2, 4, 8};
+constexpr int KNOB_ACCELERATION_LEVELS = sizeof(knobAcceleration) / sizeof(knobAcceleration[0]);
+static_assert(sizeof(knobAccelerationTicks) / sizeof(knobAccelerationTicks[0]) == KNOB_ACCELERATION_LEVELS,
+              "knobAccelerationTicks and knobAcceleration differ in length");
+
+constexpr int KNOB_EVENT_QUEUE_LENGTH = 16;
+
+struct KnobEvent
+{
+  // Scan tick the step was seen at
+  uint32_t tick;
+  uint8_t knob;
+  // Steps as turned, and as accelerated
+  int8_t steps;
+  int8_t delta;
+};
+
+// Every knob's A and B pair, knob k in bits 2(3 - k) and up
+inline uint8_t knobSnapshot(uint32_t frame)
+{
+  return (frame >> (MATRIX_COLUMNS * KNOB_FIRST_ROW)) & 0xFF;
+}
+
+inline uint8_t knobPair(uint8_t snapshot, int knob)
+{
+  return (snapshot >> (2 * (KNOB_COUNT - 1 - knob))) & 0x03;
+}
+
+class KnobDecoder
+{
+public:
+  // Decodes a snapshot read at tick, from the scan interrupt. Returns the
+  // events it queued, none unless a pair has changed. The first snapshot
+  // only sets where the knobs start
+  int update(uint8_t snapshot, uint32_t tick)
+  {
+    if (snapshot == m_snapshot || !m_started)
+    {
+      m_snapshot = snapshot;
+      m_started = true;
+      return 0;
+    }
+    int events = 0;
+    for (int knob = 0; knob < KNOB_COUNT; knob++)
+    {
+      const uint8_t last = knobPair(m_snapshot, knob);
+      const uint8_t pair = knobPair(snapshot, knob);
+      const KnobTransition transition = knobTransitions[last << 2 | pair];
+      int8_t steps = transition.steps;
+      if (steps == KNOB_MISSED)
+      {
+        steps = m_direction[knob];
+      }
+      else if (transition.direction != 0)
+      {
+        m_direction[knob] = transition.direction;
+      }
+      if (steps == 0)
+      {
+        continue;
+      }
+      int8_t delta = steps;
+      if (steps == m_lastSteps[knob])
+      {
+        const uint32_t interval = tick - m_lastTick[knob];
+        for (int i = KNOB_ACCELERATION_LEVELS - 1; i >= 0; i--)
+        {
+          if (interval <= knobAccelerationTicks[i])
+          {
+            delta = steps * knobAcceleration[i];
+            break;
+          }
+        }
+      }
+      m_lastSteps[knob] = steps;
+      m_lastTick[knob] = tick;
+      if (!m_events.push({tick, (uint8_t)knob, steps, delta}))
+      {
+        __atomic_add_fetch(&m_overflows, 1, __ATOMIC_RELAXED);
+      }
+      events++;
+    }
+    m_snapshot = snapshot;
+    return events;
+  }
+
+  // The next knob step, oldest first. Only one task reads events
+  bool nextEvent(KnobEvent *event) { return m_events.pop(event); }
+
+  // Steps dropped because the queue was full
+  uint32_t overflows() const { return __atomic_load_n(&m_overflows, __ATOMIC_RELAXED); }
+
+private:
+  bool m_started = false;
+  uint8_t m_snapshot = 0;
+  // Way each knob last moved, and its last step and when
+  int8_t m_direction[KNOB_COUNT] = {};
+  int8_t m_lastSteps[KNOB_COUNT] = {};
+  uint32_t m_lastTick[KNOB_COUNT] = {};
+  uint32_t m_overflows = 0;
+  EventQueue<KnobEvent, KNOB_EVENT_QUEUE_LENGTH> m_events;
+};
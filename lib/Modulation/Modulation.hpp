@@ -0,0 +1,268 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Wavetable.hpp"
+
+// Pitch modulation applied in the audio path. The control task sets the
+// joystick bend, arpeggio pattern, vibrato and tempo; the render task asks for
+// a multiplier ramp for each stretch of samples and applies it to every voice's
+// phase increment. Voices keep their base step sizes and do not need
+// rebuilding when the pitch moves.
+//
+// Arpeggio steps and the vibrato LFO run off a tempo clock that counts audio
+// samples, so their timing does not depend on when the control task runs.
+// nextSegment() ends a segment exactly on the next arpeggio step, so the
+// renderer can switch pitch on the right sample.
+
+// Multipliers are Q16: MOD_UNITY leaves the pitch unchanged
+constexpr uint32_t MOD_UNITY = 1 << 16;
+
+inline uint32_t toQ16(float value)
+{
+  return value <= 0 ? 0 : (uint32_t)(value * MOD_UNITY + 0.5f);
+}
+
+inline uint32_t mulQ16(uint32_t a, uint32_t b)
+{
+  return (uint32_t)(((uint64_t)a * b) >> 16);
+}
+
+// Phase increment scaled by a multiplier, limited to Nyquist
+inline uint32_t modulateStep(uint32_t stepSize, uint32_t multiplier)
+{
+  uint64_t step = ((uint64_t)stepSize * multiplier) >> 16;
+  return step < 0x80000000u ? (uint32_t)step : 0x7FFFFFFFu;
+}
+
+// Tempo range of the clock
+constexpr int TEMPO_MIN = 40;
+constexpr int TEMPO_MAX = 240;
+constexpr int TEMPO_DEFAULT = 120;
+
+enum ArpDirection : uint8_t
+{
+  ARP_UP,
+  ARP_DOWN,
+  ARP_UP_DOWN,
+  ARP_RANDOM
+};
+
+struct ArpPattern
+{
+  const char *name;
+  ArpDirection direction;
+  uint8_t octaves;
+};
+
+// Selectable arpeggio patterns. Each walks the chord tones below over its
+// octaves, starting from the played note
+constexpr ArpPattern arpPatterns[] = {
+    {"Up", ARP_UP, 1},
+    {"Down", ARP_DOWN, 1},
+    {"Up/Dn", ARP_UP_DOWN, 1},
+    {"Random", ARP_RANDOM, 1},
+    {"Up 2", ARP_UP, 2},
+    {"Up/Dn 2", ARP_UP_DOWN, 2},
+    {"Rand 2", ARP_RANDOM, 2},
+    {"Up 3", ARP_UP, 3},
+    {"Up 4", ARP_UP, 4},
+    {"Up/Dn 4", ARP_UP_DOWN, 4},
+};
+constexpr int ARP_PATTERN_COUNT = sizeof(arpPatterns) / sizeof(arpPatterns[0]);
+constexpr int ARP_OFF = -1;
+
+// Root, major third and fifth, the steps the original arpeggiators played
+constexpr uint8_t arpChordTones[] = {0, 4, 7};
+constexpr int ARP_TONES = sizeof(arpChordTones) / sizeof(arpChordTones[0]);
+constexpr int ARP_MAX_OCTAVES = 4;
+
+struct SemitoneTable
+{
+  // Q16 pitch multiplier for 0 - 47 semitones up
+  uint32_t multiplier[12 * ARP_MAX_OCTAVES];
+};
+
+constexpr SemitoneTable makeSemitoneTable()
+{
+  SemitoneTable table = {};
+  for (int semitone = 0; semitone < 12 * ARP_MAX_OCTAVES; semitone++)
+  {
+    // 2^(semitone / 12)
+    table.multiplier[semitone] = (uint32_t)(MOD_UNITY / constexprExp(-0.6931471805599453 * semitone / 12) + 0.5);
+  }
+  return table;
+}
+
+constexpr SemitoneTable semitoneTable = makeSemitoneTable();
+
+class PitchModulator
+{
+public:
+  explicit PitchModulator(uint32_t sampleRate) : m_sampleRate(sampleRate)
+  {
+    updateRates();
+  }
+
+  // Control task side. Values are read by the audio task at segment boundaries
+  void setBend(float bend)
+  {
+    __atomic_store_n(&m_bend, toQ16(bend), __ATOMIC_RELAXED);
+  }
+
+  void setTempo(int bpm)
+  {
+    m_bpm = bpm < TEMPO_MIN ? TEMPO_MIN : (bpm > TEMPO_MAX ? TEMPO_MAX : bpm);
+    updateRates();
+  }
+
+  // Plays a pattern from arpPatterns at stepsPerBeat steps per beat, or
+  // ARP_OFF. The pattern restarts from its first step when it is turned back on
+  void setArpeggio(int pattern, int stepsPerBeat)
+  {
+    m_stepsPerBeat = stepsPerBeat < 1 ? 1 : stepsPerBeat;
+    updateRates();
+    __atomic_store_n(&m_pattern, (int8_t)(pattern >= 0 && pattern < ARP_PATTERN_COUNT ? pattern : ARP_OFF),
+                     __ATOMIC_RELAXED);
+  }
+
+  // Raises the pitch by up to depth (0.05 = 5%), cyclesPerBeat times a beat.
+  // 0 depth to disable
+  void setVibrato(float cyclesPerBeat, float depth)
+  {
+    m_vibratoCycles = cyclesPerBeat;
+    updateRates();
+    __atomic_store_n(&m_vibratoDepth, toQ16(depth), __ATOMIC_RELAXED);
+  }
+
+  // Audio task side. Returns how many of the next n samples to render with the
+  // multiplier ramping from start to end: all of them, or fewer when an
+  // arpeggio step falls inside them
+  size_t nextSegment(size_t n, uint32_t *start, uint32_t *end)
+  {
+    int8_t pattern = __atomic_load_n(&m_pattern, __ATOMIC_RELAXED);
+    uint32_t stepLength = __atomic_load_n(&m_stepLength, __ATOMIC_RELAXED);
+    if (pattern != m_activePattern)
+    {
+      m_activePattern = pattern;
+      m_arpPosition = 0;
+      m_untilStep = stepLength;
+      m_arpMultiplier = pattern == ARP_OFF ? MOD_UNITY : semitoneTable.multiplier[arpSemitone(pattern, 0)];
+      m_current = mulQ16(m_base, m_arpMultiplier);
+    }
+
+    // Cut the segment at the next step, rounding the fractional sample up
+    bool stepping = false;
+    if (pattern != ARP_OFF)
+    {
+      size_t untilStep = (m_untilStep + 0xFFFF) >> 16;
+      if (untilStep <= n)
+      {
+        n = untilStep == 0 ? 1 : untilStep;
+        stepping = true;
+      }
+    }
+
+    m_base = mulQ16(__atomic_load_n(&m_bend, __ATOMIC_RELAXED), vibrato(n));
+    *start = m_current;
+    *end = mulQ16(m_base, m_arpMultiplier);
+    m_current = *end;
+
+    if (stepping)
+    {
+      // The new note starts on the first sample of the next segment
+      m_untilStep += stepLength - ((uint32_t)n << 16);
+      m_arpPosition++;
+      m_arpMultiplier = semitoneTable.multiplier[arpSemitone(pattern, m_arpPosition)];
+      m_current = mulQ16(m_base, m_arpMultiplier);
+      m_stepCount++;
+    }
+    else if (pattern != ARP_OFF)
+    {
+      m_untilStep -= (uint32_t)n << 16;
+    }
+    return n;
+  }
+
+  // Arpeggio steps taken so far, for checking timing on the host
+  uint32_t stepCount() const { return m_stepCount; }
+
+private:
+  // Steps and LFO increment for the current tempo, in samples
+  void updateRates()
+  {
+    float samplesPerBeat = 60.0f * m_sampleRate / m_bpm;
+    __atomic_store_n(&m_stepLength, (uint32_t)(samplesPerBeat / m_stepsPerBeat * 65536.0f), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_vibratoStep, (uint32_t)(m_vibratoCycles / samplesPerBeat * 4294967296.0f), __ATOMIC_RELAXED);
+  }
+
+  // Advances the LFO by n samples and returns its multiplier
+  uint32_t vibrato(size_t n)
+  {
+    uint32_t depth = __atomic_load_n(&m_vibratoDepth, __ATOMIC_RELAXED);
+    if (depth == 0)
+    {
+      m_vibratoPhase = 0;
+      return MOD_UNITY;
+    }
+    m_vibratoPhase += __atomic_load_n(&m_vibratoStep, __ATOMIC_RELAXED) * (uint32_t)n;
+    // Raised cosine so the LFO only bends upwards, from 0 to depth
+    int32_t lfo = (32767 - wavetableLookup(sineTable.samples, m_vibratoPhase + 0x40000000u)) >> 1;
+    return MOD_UNITY + (uint32_t)(((uint64_t)depth * lfo) >> 15);
+  }
+
+  // Semitones above the played note at a position in a pattern
+  uint8_t arpSemitone(int pattern, uint32_t position)
+  {
+    const ArpPattern &p = arpPatterns[pattern];
+    const uint32_t length = ARP_TONES * p.octaves;
+    uint32_t index = 0;
+    switch (p.direction)
+    {
+    case ARP_UP:
+      index = position % length;
+      break;
+    case ARP_DOWN:
+      index = length - 1 - position % length;
+      break;
+    case ARP_UP_DOWN:
+    {
+      // Turns round without repeating the top and bottom notes
+      uint32_t period = length > 1 ? 2 * (length - 1) : 1;
+      index = position % period;
+      index = index < length ? index : period - index;
+      break;
+    }
+    case ARP_RANDOM:
+      m_random = m_random * 1664525u + 1013904223u;
+      index = (m_random >> 16) % length;
+      break;
+    }
+    return 12 * (index / ARP_TONES) + arpChordTones[index % ARP_TONES];
+  }
+
+  uint32_t m_sampleRate;
+
+  // Control task copies of the settings the rates are derived from
+  int m_bpm = TEMPO_DEFAULT;
+  int m_stepsPerBeat = 2;
+  float m_vibratoCycles = 0;
+
+  uint32_t m_bend = MOD_UNITY;
+  int8_t m_pattern = ARP_OFF;
+  uint32_t m_stepLength = 0;
+  uint32_t m_vibratoStep = 0;
+  uint32_t m_vibratoDepth = 0;
+
+  // Audio task state
+  uint32_t m_vibratoPhase = 0;
+  // Bend times vibrato, and that times the arpeggio step, at the end of the last segment
+  uint32_t m_base = MOD_UNITY;
+  uint32_t m_current = MOD_UNITY;
+  int8_t m_activePattern = ARP_OFF;
+  uint32_t m_arpPosition = 0;
+  uint32_t m_untilStep = 0;
+  uint32_t m_arpMultiplier = MOD_UNITY;
+  uint32_t m_random = 1;
+  uint32_t m_stepCount = 0;
+};
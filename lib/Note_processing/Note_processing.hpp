@@ -0,0 +1,348 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+
+#include "Voice_allocator.hpp"
+
+// Turns key states into held notes: each key is expanded by a voicing table
+// for the octave and chord effects into one deduplicated set of notes before
+// voices are allocated. Hardware independent so the host renderer runs the
+// same code as the board.
+
+extern VoiceAllocator voiceAllocator;
+extern volatile int effect;
+extern volatile int subEffect;
+extern volatile int octaveMode;
+extern const char *notes[12];
+extern const char *keys[12];
+
+// Calculate step sizes and frequencies during compilation
+constexpr uint32_t samplingFreq = 22050;                  // Hz
+constexpr double twelfthRootOfTwo = pow(2.0, 1.0 / 12.0); // 12th root of 2
+
+// Returns frequency for given note
+constexpr uint32_t calculateFreq(float semiTone)
+{
+  return static_cast<uint32_t>(440.00f * std::pow(2.00f, static_cast<float>(semiTone) / 12.0f));
+}
+// Returns step size from note
+constexpr uint32_t calculateStepSize(float frequency)
+{
+  return static_cast<uint32_t>((pow(2, 32) * frequency) / samplingFreq);
+}
+// 2 - 8 Octaves of step sizes - super long :(
+constexpr uint32_t stepSizes[] = {
+    calculateStepSize(calculateFreq(-33)), // C2
+    calculateStepSize(calculateFreq(-32)), // C#2
+    calculateStepSize(calculateFreq(-31)), // D2
+    calculateStepSize(calculateFreq(-30)), // D#2
+    calculateStepSize(calculateFreq(-29)), // E2
+    calculateStepSize(calculateFreq(-28)), // F2
+    calculateStepSize(calculateFreq(-27)), // F#2
+    calculateStepSize(calculateFreq(-26)), // G2
+    calculateStepSize(calculateFreq(-25)), // G#2
+    calculateStepSize(calculateFreq(-24)), // A2
+    calculateStepSize(calculateFreq(-23)), // A#2
+    calculateStepSize(calculateFreq(-22)), // B2
+    calculateStepSize(calculateFreq(-21)), // C3
+    calculateStepSize(calculateFreq(-20)), // C#3
+    calculateStepSize(calculateFreq(-19)), // D3
+    calculateStepSize(calculateFreq(-18)), // D#3
+    calculateStepSize(calculateFreq(-17)), // E3
+    calculateStepSize(calculateFreq(-16)), // F3
+    calculateStepSize(calculateFreq(-15)), // F#3
+    calculateStepSize(calculateFreq(-14)), // G3
+    calculateStepSize(calculateFreq(-13)), // G#3
+    calculateStepSize(calculateFreq(-12)), // A3
+    calculateStepSize(calculateFreq(-11)), // A#3
+    calculateStepSize(calculateFreq(-10)), // B3
+    calculateStepSize(calculateFreq(-9)),  // C4
+    calculateStepSize(calculateFreq(-8)),  // C#4
+    calculateStepSize(calculateFreq(-7)),  // D4
+    calculateStepSize(calculateFreq(-6)),  // D#4
+    calculateStepSize(calculateFreq(-5)),  // E4
+    calculateStepSize(calculateFreq(-4)),  // F4
+    calculateStepSize(calculateFreq(-3)),  // F#4
+    calculateStepSize(calculateFreq(-2)),  // G4
+    calculateStepSize(calculateFreq(-1)),  // G#4
+    calculateStepSize(calculateFreq(0)),   // A4
+    calculateStepSize(calculateFreq(1)),   // A#4
+    calculateStepSize(calculateFreq(2)),   // B4
+    calculateStepSize(calculateFreq(3)),   // C5
+    calculateStepSize(calculateFreq(4)),   // C#5
+    calculateStepSize(calculateFreq(5)),   // D5
+    calculateStepSize(calculateFreq(6)),   // D#5
+    calculateStepSize(calculateFreq(7)),   // E5
+    calculateStepSize(calculateFreq(8)),   // F5
+    calculateStepSize(calculateFreq(9)),   // F#5
+    calculateStepSize(calculateFreq(10)),  // G5
+    calculateStepSize(calculateFreq(11)),  // G#5
+    calculateStepSize(calculateFreq(12)),  // A5
+    calculateStepSize(calculateFreq(13)),  // A#5
+    calculateStepSize(calculateFreq(14)),  // B5
+    calculateStepSize(calculateFreq(15)),  // C6
+    calculateStepSize(calculateFreq(16)),  // C#6
+    calculateStepSize(calculateFreq(17)),  // D6
+    calculateStepSize(calculateFreq(18)),  // D#6
+    calculateStepSize(calculateFreq(19)),  // E6
+    calculateStepSize(calculateFreq(20)),  // F6
+    calculateStepSize(calculateFreq(21)),  // F#6
+    calculateStepSize(calculateFreq(22)),  // G6
+    calculateStepSize(calculateFreq(23)),  // G#6
+    calculateStepSize(calculateFreq(24)),  // A6
+    calculateStepSize(calculateFreq(25)),  // A#6
+    calculateStepSize(calculateFreq(26)),  // B6
+    calculateStepSize(calculateFreq(27)),  // C7
+    calculateStepSize(calculateFreq(28)),  // C#7
+    calculateStepSize(calculateFreq(29)),  // D7
+    calculateStepSize(calculateFreq(30)),  // D#7
+    calculateStepSize(calculateFreq(31)),  // E7
+    calculateStepSize(calculateFreq(32)),  // F7
+    calculateStepSize(calculateFreq(33)),  // F#7
+    calculateStepSize(calculateFreq(34)),  // G7
+    calculateStepSize(calculateFreq(35)),  // G#7
+    calculateStepSize(calculateFreq(36)),  // A7
+    calculateStepSize(calculateFreq(37)),  // A#7
+    calculateStepSize(calculateFreq(38)),  // B7
+    calculateStepSize(calculateFreq(39)),  // C8
+    calculateStepSize(calculateFreq(40)),  // C#8
+    calculateStepSize(calculateFreq(41)),  // D8
+    calculateStepSize(calculateFreq(42)),  // D#8
+    calculateStepSize(calculateFreq(43)),  // E8
+    calculateStepSize(calculateFreq(44)),  // F8
+    calculateStepSize(calculateFreq(45)),  // F#8
+    calculateStepSize(calculateFreq(46)),  // G8
+    calculateStepSize(calculateFreq(47)),  // G#8
+    calculateStepSize(calculateFreq(48)),  // A8
+    calculateStepSize(calculateFreq(49)),  // A#8
+    calculateStepSize(calculateFreq(50))   // B8
+};
+
+// Width of the stereo spread across the keyboard, PAN_RIGHT for hard left to hard right
+constexpr int PAN_SPREAD = 64;
+
+// Places notes across the stereo field by pitch, low notes to the left as on a piano
+constexpr uint8_t notePan(int note)
+{
+  return PAN_CENTRE - PAN_SPREAD / 2 + note * PAN_SPREAD / (NOTE_COUNT - 1);
+}
+
+// Notes sounded for each held key: semitone offsets from the key, which is 0
+constexpr int VOICING_MAX_NOTES = 5;
+
+struct Voicing
+{
+  const char *name;
+  uint8_t count;
+  int8_t offsets[VOICING_MAX_NOTES];
+};
+
+// Chord effect shapes, selected by the sub-effect knob. Inversions keep the
+// played key as the root and move the notes below the top up an octave.
+// Custom shapes can be added to the end of the table
+constexpr Voicing chordVoicings[] = {
+    {"Major", 3, {0, 4, 7}},
+    {"Minor", 3, {0, 3, 7}},
+    {"Diminished", 3, {0, 3, 6}},
+    {"Augmented", 3, {0, 4, 8}},
+    {"Seventh", 4, {0, 4, 7, 11}},
+    {"Dom 7", 4, {0, 4, 7, 10}},
+    {"Min 7", 4, {0, 3, 7, 10}},
+    {"Sus 2", 3, {0, 2, 7}},
+    {"Sus 4", 3, {0, 5, 7}},
+    {"Add 9", 4, {0, 4, 7, 14}},
+    {"Maj 9", 5, {0, 4, 7, 11, 14}},
+    {"Min 9", 5, {0, 3, 7, 10, 14}},
+    {"Maj inv 1", 3, {4, 7, 12}},
+    {"Maj inv 2", 3, {7, 12, 16}},
+    {"Min inv 1", 3, {3, 7, 12}},
+    {"Power", 3, {0, 7, 12}},
+    {"Quartal", 3, {0, 5, 10}},
+};
+constexpr int CHORD_VOICING_COUNT = sizeof(chordVoicings) / sizeof(chordVoicings[0]);
+
+// Octave effect modes, selected by the octave effect knob
+constexpr Voicing octaveVoicings[] = {
+    {"Dual", 3, {-12, 0, 12}},
+    {"Pos", 2, {0, 12}},
+    {"Neg", 2, {-12, 0}},
+};
+constexpr int OCTAVE_VOICING_COUNT = sizeof(octaveVoicings) / sizeof(octaveVoicings[0]);
+
+constexpr Voicing singleVoicing = {"", 1, {0}};
+
+// Voicing for the current effect settings
+inline const Voicing &currentVoicing()
+{
+  int mode;
+  switch (effect)
+  {
+  case 2:
+    mode = octaveMode;
+    return octaveVoicings[mode >= 0 && mode < OCTAVE_VOICING_COUNT ? mode : 0];
+  case 5:
+    mode = subEffect;
+    return chordVoicings[mode >= 0 && mode < CHORD_VOICING_COUNT ? mode : 0];
+  default:
+    return singleVoicing;
+  }
+}
+
+// Set of notes (indexes into stepSizes) to hold in a scan. Notes from every
+// key and source are collected here first, so a note that two keys, an effect
+// and a CAN keyboard all ask for still takes a single voice
+struct NoteSet
+{
+  uint32_t bits[(NOTE_COUNT + 31) / 32] = {};
+
+  void clear()
+  {
+    memset(bits, 0, sizeof(bits));
+  }
+
+  // Notes outside C2 - B8, such as an octave below C2, are dropped
+  void add(int note)
+  {
+    if (note >= 0 && note < NOTE_COUNT)
+    {
+      bits[note >> 5] |= 1u << (note & 31);
+    }
+  }
+
+  bool contains(int note) const
+  {
+    return note >= 0 && note < NOTE_COUNT && (bits[note >> 5] >> (note & 31)) & 1;
+  }
+};
+
+// Adds the notes of the keys in a key state to the set, each expanded by the voicing
+void processKeyPress(NoteSet *held, const Voicing &voicing, uint16_t keyState, int octave, bool master)
+{
+  for (int i = 0; i < 12; i++)
+  {
+    if (keyState & (1 << i))
+    {
+      int root = 12 * (octave - 2) + i;
+      for (int v = 0; v < voicing.count; v++)
+      {
+        held->add(root + voicing.offsets[v]);
+      }
+      keys[i] = notes[i];
+    }
+    else
+    {
+      if (master)
+      {
+        keys[i] = 0;
+      }
+    }
+  }
+}
+
+// Adds other notes, such as a song's, to the set, each expanded by the voicing
+void processNotes(NoteSet *held, const Voicing &voicing, const NoteSet &extra)
+{
+  for (int note = 0; note < NOTE_COUNT; note++)
+  {
+    if (extra.contains(note))
+    {
+      for (int v = 0; v < voicing.count; v++)
+      {
+        held->add(note + voicing.offsets[v]);
+      }
+    }
+  }
+}
+
+// Everything the held notes are worked out from in one scan: the key states
+// and octaves of the local keyboard and the CAN keyboards, the voicing and the
+// song's notes. Nothing sounds when local is false, as on a keyboard sending
+// its keys to another
+struct KeyInputs
+{
+  bool local = true;
+  const Voicing *voicing = &singleVoicing;
+  uint16_t keys[NOTE_SOURCE_COUNT] = {};
+  int8_t octaves[NOTE_SOURCE_COUNT] = {};
+  NoteSet song;
+
+  bool operator==(const KeyInputs &other) const
+  {
+    return local == other.local && voicing == other.voicing &&
+           memcmp(keys, other.keys, sizeof(keys)) == 0 && memcmp(octaves, other.octaves, sizeof(octaves)) == 0 &&
+           memcmp(song.bits, other.song.bits, sizeof(song.bits)) == 0;
+  }
+};
+
+// Turns each scan's inputs into note on and off events for the voice
+// allocator. The held notes are only worked out again when an input has
+// changed, and then only the notes that differ from the last set are sent, so
+// held notes keep their voices untouched. Voices keep the unbent step size;
+// pitch modulation is applied in the audio path. Sources are already merged,
+// so every note is held under the local source's IDs
+class NoteTracker
+{
+public:
+  explicit NoteTracker(VoiceAllocator &allocator) : m_allocator(allocator) {}
+
+  // Returns the number of note events sent
+  int update(const KeyInputs &inputs)
+  {
+    if (m_started && inputs == m_inputs)
+    {
+      return 0;
+    }
+    m_started = true;
+    m_inputs = inputs;
+
+    NoteSet held;
+    if (inputs.local)
+    {
+      const Voicing &voicing = *inputs.voicing;
+      processKeyPress(&held, voicing, inputs.keys[NOTE_SOURCE_LOCAL], inputs.octaves[NOTE_SOURCE_LOCAL], true);
+      for (int source = NOTE_SOURCE_CAN0; source < NOTE_SOURCE_COUNT; source++)
+      {
+        processKeyPress(&held, voicing, inputs.keys[source], inputs.octaves[source], false);
+      }
+      processNotes(&held, voicing, inputs.song);
+    }
+
+    // Offs first, so the voices they release are the first stolen for the ons
+    int events = 0;
+    for (int word = 0; word < WORDS; word++)
+    {
+      uint32_t off = m_held.bits[word] & ~held.bits[word];
+      events += __builtin_popcount(off);
+      while (off != 0)
+      {
+        int note = 32 * word + __builtin_ctz(off);
+        off &= off - 1;
+        m_allocator.noteOff(makeNoteId(NOTE_SOURCE_LOCAL, note));
+      }
+    }
+    for (int word = 0; word < WORDS; word++)
+    {
+      uint32_t on = held.bits[word] & ~m_held.bits[word];
+      events += __builtin_popcount(on);
+      while (on != 0)
+      {
+        int note = 32 * word + __builtin_ctz(on);
+        on &= on - 1;
+        m_allocator.noteOn(makeNoteId(NOTE_SOURCE_LOCAL, note), stepSizes[note], notePan(note));
+      }
+      m_held.bits[word] = held.bits[word];
+    }
+    return events;
+  }
+
+  const NoteSet &held() const { return m_held; }
+
+private:
+  static constexpr int WORDS = sizeof(NoteSet::bits) / sizeof(NoteSet::bits[0]);
+
+  VoiceAllocator &m_allocator;
+  KeyInputs m_inputs;
+  bool m_started = false;
+  NoteSet m_held;
+};
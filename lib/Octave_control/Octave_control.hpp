@@ -2,8 +2,15 @@
 #include <U8g2lib.h>
 #include <STM32FreeRTOS.h>
 #include <math.h>
-  
-extern float initialY = analogRead(A1);
+
+#include "Joystick.hpp"
+
+// Pushing the stick past 60% of its travel steps the octave once, and it
+// steps again only after coming back inside 40%
+constexpr int32_t OCTAVE_PUSH = JOYSTICK_SCALE * 6 / 10;
+constexpr int32_t OCTAVE_RETURN = JOYSTICK_SCALE * 4 / 10;
+
+extern Joystick joystick;
 extern volatile bool OctToggle ;
 extern volatile int octaveSelect;
 extern const int MAX_OCT ;
@@ -11,22 +18,21 @@ extern const int MIN_OCT ;
 
 void octaveControl()
 {
-  // Read joystick (octaves)
-  float joyX = analogRead(A1);
-  float joyXscale = (joyX / 1023) * 100;
+  // Joystick x, the high end steps down an octave
+  const int32_t joyX = joystick.position().x;
 
-  if (joyXscale > 80 && OctToggle == false)
+  if (joyX > OCTAVE_PUSH && OctToggle == false)
   {
     __atomic_store_n(&octaveSelect, max(__atomic_load_n(&octaveSelect, __ATOMIC_RELAXED) - 1, MIN_OCT), __ATOMIC_RELAXED);
     OctToggle = true;
   }
-  else if (joyXscale < 15 && OctToggle == false)
+  else if (joyX < -OCTAVE_PUSH && OctToggle == false)
   {
     __atomic_store_n(&octaveSelect, min(__atomic_load_n(&octaveSelect, __ATOMIC_RELAXED) + 1, MAX_OCT), __ATOMIC_RELAXED);
     OctToggle = true;
   }
-  else if (joyXscale >= 15 && joyXscale <= 80)
+  else if (joyX >= -OCTAVE_RETURN && joyX <= OCTAVE_RETURN)
   {
     OctToggle = false;
   }
-}
\ No newline at end of file
+}
@@ -3,119 +3,59 @@
 #include <STM32FreeRTOS.h>
 #include <math.h>
 
-extern float initialY ;
-extern volatile float pitchBend;
-extern float calZero;
+#include "Modulation.hpp"
+#include "Joystick.hpp"
+
+// Bend at either end of the stick's travel, as a fraction of the pitch
+constexpr float PITCH_BEND_RANGE = 0.25f;
+
+extern Joystick joystick;
+extern PitchModulator pitchModulator;
 extern volatile int effect ;
 extern volatile int arp1Effect ;
 extern volatile int arp2Effect ;
 extern volatile int vibratoEffect;
 extern volatile int pressedKeys;
 extern  volatile uint32_t cur_message[2];
-extern volatile float vibrato ;
-extern volatile bool vibToggle ;
-extern volatile float arpegio ;
-extern volatile bool arpToggle ;
+extern volatile int tempo;
 extern volatile float vibratoMulti[3] ;
-extern volatile float arpeggio1Multi[3][3] ;
-extern volatile float arpeggio2Multi[3][4] ;
+extern const float vibratoCycles[3] ;
 
 void pitchControl()
 {
-  // Read joystick (stepsize)
-  float joyY = analogRead(A0);
-  float joyYscale = (joyY / 1023);
-  pitchBend = 1.00f;
+  // Joystick y, the low end bends up. None through the deadzone, then
+  // growing smoothly from its edge
+  const float pitchBend = 1.0f - PITCH_BEND_RANGE * joystick.position().y / JOYSTICK_SCALE;
+  pitchModulator.setBend(pitchBend);
+
+  // Vibrato and arpeggio run off the tempo clock in the audio path
+  pitchModulator.setTempo(tempo);
 
-  if (joyYscale < calZero - 0.05)
+  if (effect == 1)
   {
-    pitchBend = 1 + (calZero - joyYscale) * 0.5;
+    pitchModulator.setVibrato(vibratoCycles[vibratoEffect], vibratoMulti[vibratoEffect]);
   }
-  else if (joyYscale > calZero + 0.05)
+  else
   {
-    pitchBend = 1 - (joyYscale - calZero) * 0.5;
+    pitchModulator.setVibrato(0, 0);
   }
 
-  // Vibrato
-  if (effect == 1 && (pressedKeys != 0 || cur_message[0] != 0 || cur_message[1] != 0))
+  // Arpeggiator 1 plays eighth notes, arpeggiator 2 sixteenths. Releasing
+  // every key stops it, so the next chord starts the pattern from the top
+  if (pressedKeys == 0 && cur_message[0] == 0 && cur_message[1] == 0)
   {
-    if (vibrato < vibratoMulti[vibratoEffect] && vibToggle == false)
-    {
-      vibrato += 0.01;
-      pitchBend = 1 + vibrato;
-      if (vibrato >= vibratoMulti[vibratoEffect])
-      {
-        vibToggle = true;
-      }
-    }
-    if (vibToggle == true)
-    {
-      vibrato -= 0.01;
-      pitchBend = 1 + vibrato;
-      if (vibrato <= 0)
-      {
-        vibToggle = false;
-      }
-    }
+    pitchModulator.setArpeggio(ARP_OFF, 1);
   }
-
-  // Arpegiator 1
-  if (effect == 3)
+  else if (effect == 3)
   {
-    if (arpegio <= arpeggio1Multi[arp1Effect][2])
-    {
-      arpegio += 0.05;
-      if (arpegio > arpeggio1Multi[arp1Effect][1])
-      {
-        pitchBend = 1.5;
-      }
-      else if (arpegio > arpeggio1Multi[arp1Effect][0])
-      {
-        pitchBend = 1.25;
-      }
-      else
-      {
-        pitchBend = 1;
-      }
-      if (arpegio >= arpeggio1Multi[arp1Effect][2])
-      {
-        arpegio = 0;
-      }
-    }
+    pitchModulator.setArpeggio(arp1Effect, 2);
   }
-
-  // Arpegiator 2
   else if (effect == 4)
   {
-    if (arpegio <= arpeggio2Multi[arp2Effect][3])
-    {
-      arpegio += 0.05;
-      if (arpegio > arpeggio2Multi[arp2Effect][2])
-      {
-        pitchBend = 1.5;
-      }
-      else if (arpegio > arpeggio2Multi[arp2Effect][1])
-      {
-        pitchBend = 1.25;
-      }
-      else if (arpegio > arpeggio2Multi[arp2Effect][0])
-      {
-        pitchBend = 1.5;
-      }
-      else
-      {
-        pitchBend = 1;
-      }
-
-      if (arpegio >= arpeggio2Multi[arp2Effect][3])
-      {
-        arpegio = 0;
-      }
-    }
+    pitchModulator.setArpeggio(arp2Effect, 4);
   }
-
-  if (pressedKeys == 0 && cur_message[0] == 0 && cur_message[1] == 0)
+  else
   {
-    arpegio = 0;
+    pitchModulator.setArpeggio(ARP_OFF, 1);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+// Samples in flash, selectable on the waveform knob after the wavetables. These
+// two are synthesised at compile time; recorded ones go in the same way, as a
+// const array with a Sample describing it, listed in samplerBank. The host
+// renderer can replace entries with WAV files (see src/host/Sample_file.hpp).
+
+constexpr double SAMPLE_BANK_RATE = 22050;
+
+// Flash allowed for the sample data, checked at compile time
+constexpr size_t SAMPLE_FLASH_BUDGET = 32 * 1024;
+
+// Plucked string at A3: harmonics at 1/k, the higher ones dying away faster.
+// 8-bit one-shot, faded out over its last 10 ms
+constexpr double PLUCK_ROOT_HZ = 220.0;
+constexpr uint32_t PLUCK_LENGTH = 11025;
+constexpr uint32_t PLUCK_FADE = 220;
+constexpr int PLUCK_HARMONICS = 12;
+
+struct PluckData
+{
+  int8_t samples[PLUCK_LENGTH];
+};
+
+struct PluckSynth
+{
+  double amplitude[PLUCK_HARMONICS + 1] = {};
+  double decay[PLUCK_HARMONICS + 1] = {};
+  uint32_t frame = 0;
+
+  constexpr PluckSynth()
+  {
+    for (int k = 1; k <= PLUCK_HARMONICS; k++)
+    {
+      amplitude[k] = 1.0 / k;
+      // Time constant of 1 / (2 + 3k) seconds
+      decay[k] = constexprExp(-(2.0 + 3.0 * k) / SAMPLE_BANK_RATE);
+    }
+  }
+
+  constexpr double next()
+  {
+    double cycles = PLUCK_ROOT_HZ * frame / SAMPLE_BANK_RATE;
+    double x = 2 * WAVETABLE_PI * (cycles - (uint32_t)cycles);
+    // sin(k x) by rotating through the harmonics, as additive() does
+    const double c1 = constexprCos(x);
+    const double s1 = constexprSin(x);
+    double c = c1;
+    double s = s1;
+    double value = 0;
+    for (int k = 1; k <= PLUCK_HARMONICS; k++)
+    {
+      value += amplitude[k] * s;
+      amplitude[k] *= decay[k];
+      double rotated = c * c1 - s * s1;
+      s = s * c1 + c * s1;
+      c = rotated;
+    }
+    uint32_t left = PLUCK_LENGTH - 1 - frame;
+    frame++;
+    return left < PLUCK_FADE ? value * left / PLUCK_FADE : value;
+  }
+};
+
+constexpr PluckData makePluckData()
+{
+  double peak = 0;
+  PluckSynth first;
+  for (uint32_t i = 0; i < PLUCK_LENGTH; i++)
+  {
+    double value = first.next();
+    value = value < 0 ? -value : value;
+    peak = value > peak ? value : peak;
+  }
+
+  PluckData data = {};
+  PluckSynth second;
+  for (uint32_t i = 0; i < PLUCK_LENGTH; i++)
+  {
+    double value = second.next() / peak * 127;
+    data.samples[i] = (int8_t)(value < 0 ? value - 0.5 : value + 0.5);
+  }
+  return data;
+}
+
+// Sung "ah" at A3 with a 5 Hz tremolo. 16-bit, a 50 ms fade in and then a
+// 200 ms loop holding exactly 44 cycles of the note and one of the tremolo, so
+// it repeats seamlessly
+constexpr double VOX_ROOT_HZ = 220.0;
+constexpr uint32_t VOX_LOOP_START = 1103;
+constexpr uint32_t VOX_LOOP_END = VOX_LOOP_START + 4410 - 1;
+constexpr uint32_t VOX_LENGTH = VOX_LOOP_END + 1;
+constexpr double VOX_TREMOLO_HZ = 5.0;
+constexpr double VOX_TREMOLO_DEPTH = 0.15;
+// Harmonic levels, fundamental first, shaped by the vowel's formants near 700 and 1200 Hz
+constexpr double voxAmplitudes[] = {0.5, 0.6, 1.0, 0.8, 0.6, 0.5, 0.25, 0.15, 0.1, 0.1, 0.12, 0.08};
+constexpr Harmonics voxHarmonics = harmonicsFromAmplitudes(voxAmplitudes);
+
+struct VoxData
+{
+  int16_t samples[VOX_LENGTH];
+};
+
+constexpr double voxValue(uint32_t frame)
+{
+  double cycles = VOX_ROOT_HZ * frame / SAMPLE_BANK_RATE;
+  double x = 2 * WAVETABLE_PI * (cycles - (uint32_t)cycles);
+  double value = additive(voxHarmonics, x, sizeof(voxAmplitudes) / sizeof(voxAmplitudes[0]));
+  double tremolo = VOX_TREMOLO_HZ * frame / SAMPLE_BANK_RATE;
+  value *= 1 - VOX_TREMOLO_DEPTH * (1 + constexprSin(2 * WAVETABLE_PI * (tremolo - (uint32_t)tremolo))) / 2;
+  return frame < VOX_LOOP_START ? value * frame / VOX_LOOP_START : value;
+}
+
+constexpr VoxData makeVoxData()
+{
+  // The loop reaches the peak, the fade in is quieter
+  double peak = 0;
+  for (uint32_t i = VOX_LOOP_START; i <= VOX_LOOP_END; i++)
+  {
+    double value = voxValue(i);
+    value = value < 0 ? -value : value;
+    peak = value > peak ? value : peak;
+  }
+
+  VoxData data = {};
+  for (uint32_t i = 0; i < VOX_LENGTH; i++)
+  {
+    data.samples[i] = toQ15(voxValue(i) / peak);
+  }
+  return data;
+}
+
+constexpr PluckData pluckData = makePluckData();
+constexpr VoxData voxData = makeVoxData();
+
+constexpr Sample pluckSample = {"Pluck", pluckData.samples, SAMPLE_S8, PLUCK_LENGTH, 0, 0,
+                                samplePitchScale(SAMPLE_BANK_RATE, PLUCK_ROOT_HZ)};
+constexpr Sample voxSample = {"Vox", voxData.samples, SAMPLE_S16, VOX_LENGTH, VOX_LOOP_START, VOX_LOOP_END,
+                              samplePitchScale(SAMPLE_BANK_RATE, VOX_ROOT_HZ)};
+
+// Not const so the host renderer can swap in samples from files
+const Sample *samplerBank[] = {&pluckSample, &voxSample};
+
+static_assert(sizeof(pluckData) + sizeof(voxData) <= SAMPLE_FLASH_BUDGET, "Sample bank exceeds SAMPLE_FLASH_BUDGET");
+static_assert(PLUCK_LENGTH <= SAMPLE_MAX_LENGTH && VOX_LENGTH <= SAMPLE_MAX_LENGTH, "Sample too long for Q16 positions");
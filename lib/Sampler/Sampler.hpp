@@ -0,0 +1,137 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Wavetable.hpp"
+
+// PCM sample playback. Samples are read in place from their const arrays, in
+// flash on the board or a memory mapped file on the host, so nothing is copied
+// into RAM. Each voice keeps a Q16 position in its sample, stepped by the
+// voice's phase increment scaled by the sample's pitch, so bend, vibrato and
+// arpeggio move samples exactly as they move the oscillators.
+//
+// Samples follow the wavetables on the waveform knob.
+
+enum SampleFormat : uint8_t
+{
+  SAMPLE_S8 = 0, // Signed 8-bit, as stored in flash
+  SAMPLE_U8,     // Unsigned 8-bit, as in WAV files
+  SAMPLE_S16
+};
+
+constexpr int SAMPLE_POSITION_BITS = 16;
+
+// Fastest a voice may step through its sample, in frames per output sample (4
+// octaves above the recorded pitch). Keeps a finished one-shot's position from
+// wrapping round past the end
+constexpr uint32_t SAMPLE_MAX_STEP = 16u << SAMPLE_POSITION_BITS;
+
+// Longest sample the Q16 positions can address with that headroom, 2.9 s at 22050 Hz
+constexpr uint32_t SAMPLE_MAX_LENGTH = (1u << (32 - SAMPLE_POSITION_BITS)) - 1 - (SAMPLE_MAX_STEP >> SAMPLE_POSITION_BITS);
+
+struct Sample
+{
+  const char *name;
+  const void *data;
+  SampleFormat format;
+  // Frames of data
+  uint32_t length;
+  // Frames loopStart to loopEnd, both included, repeat for as long as the
+  // voice lasts, or the sample plays once through if loopEnd is 0. The frame
+  // at loopEnd is interpolated towards the one at loopStart, as in a WAV smpl
+  // chunk, and must lie within length
+  uint32_t loopStart;
+  uint32_t loopEnd;
+  // Frames per unit of phase increment, from samplePitchScale
+  uint32_t pitchScale;
+};
+
+// Scale that turns a voice's 32-bit phase increment into a Q16 step through a
+// sample recorded at rootHz. The phase increment already carries the output
+// rate, so only the sample's own rate appears
+constexpr uint32_t samplePitchScale(double sampleRate, double rootHz)
+{
+  return (uint32_t)(sampleRate / rootHz * (1 << SAMPLE_POSITION_BITS) + 0.5);
+}
+
+// Q16 step through a sample for a phase increment
+inline uint32_t samplePositionStep(uint32_t increment, uint32_t pitchScale)
+{
+  uint32_t step = (uint32_t)(((uint64_t)increment * pitchScale) >> 32);
+  return step < SAMPLE_MAX_STEP ? step : SAMPLE_MAX_STEP;
+}
+
+// The parts of a sample the per sample loop needs, as Q16 positions
+struct SampleReader
+{
+  const void *data;
+  // Position at which the voice loops back or, for a one-shot, stops
+  uint32_t end;
+  // Distance back to the loop start, 0 for a one-shot
+  uint32_t loopLength;
+  // Frame at end, and the frame the one before it is interpolated towards:
+  // the loop start, or the last frame of a one-shot
+  uint32_t endFrame;
+  uint32_t joinFrame;
+};
+
+inline SampleReader sampleReader(const Sample &sample)
+{
+  bool looped = sample.loopEnd > sample.loopStart;
+  uint32_t endFrame = looped ? sample.loopEnd + 1 : sample.length - 1;
+  return {sample.data, endFrame << SAMPLE_POSITION_BITS,
+          looped ? (endFrame - sample.loopStart) << SAMPLE_POSITION_BITS : 0, endFrame,
+          looped ? sample.loopStart : endFrame};
+}
+
+// One frame as Q15
+template <SampleFormat Format>
+inline int32_t sampleFrame(const void *data, uint32_t index)
+{
+  if (Format == SAMPLE_S16)
+  {
+    return static_cast<const int16_t *>(data)[index];
+  }
+  else if (Format == SAMPLE_S8)
+  {
+    return static_cast<const int8_t *>(data)[index] * 256;
+  }
+  else
+  {
+    return (static_cast<const uint8_t *>(data)[index] - 128) * 256;
+  }
+}
+
+// Linearly interpolated Q15 value at a voice's position, first moving the
+// position back into the loop once it has passed the end. A one-shot stays at
+// its end and is silent from there until the voice is freed
+template <SampleFormat Format>
+inline int32_t sampleLookup(const SampleReader &reader, uint32_t &position)
+{
+  if (position >= reader.end)
+  {
+    if (reader.loopLength == 0)
+    {
+      position = reader.end;
+      return 0;
+    }
+    do
+    {
+      position -= reader.loopLength;
+    } while (position >= reader.end);
+  }
+  uint32_t index = position >> SAMPLE_POSITION_BITS;
+  uint32_t next = index + 1 == reader.endFrame ? reader.joinFrame : index + 1;
+  int32_t frac = (position >> (SAMPLE_POSITION_BITS - 15)) & 0x7FFF;
+  int32_t a = sampleFrame<Format>(reader.data, index);
+  int32_t b = sampleFrame<Format>(reader.data, next);
+  return a + (((b - a) * frac) >> 15);
+}
+
+#include "Sample_bank.hpp"
+
+constexpr int SAMPLE_COUNT = sizeof(samplerBank) / sizeof(samplerBank[0]);
+
+// Waveform knob positions of the samples, after the wavetables
+constexpr int WAVE_SAMPLE = WAVE_COUNT;
+constexpr int SOUND_COUNT = WAVE_COUNT + SAMPLE_COUNT;
@@ -0,0 +1,105 @@
+#pragma once
+
+// Songs for the player, taken in turn by pressing knob 1. Each is a const table
+// of events in flash in the format described in Song_format.hpp; new songs go
+// in songs[].
+
+// Broken chords over C, Em/B, Am and F in eighth notes, each note handing
+// straight over to the next, round and round
+constexpr SongEvent brokenChords[] = {
+    tempoChange(150),
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 11)), noteOff(6, songNote(3, 11)), // B3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 11)), noteOff(6, songNote(3, 11)), // B3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 11)), noteOff(6, songNote(3, 11)), // B3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 7)), noteOff(6, songNote(4, 7)), // G4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 9)), noteOff(6, songNote(3, 9)), // A3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 9)), noteOff(6, songNote(3, 9)), // A3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(3, 9)), noteOff(6, songNote(3, 9)), // A3
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 4)), noteOff(6, songNote(4, 4)), // E4
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    noteOn(0, songNote(4, 0)), noteOff(6, songNote(4, 0)), // C4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    noteOn(0, songNote(4, 9)), noteOff(6, songNote(4, 9)), // A4
+    noteOn(0, songNote(4, 5)), noteOff(6, songNote(4, 5)), // F4
+    songLoop(0),
+};
+
+// Ode to Joy in crotchets, with a tick of silence before each note so repeated
+// notes sound again
+constexpr SongEvent odeToJoy[] = {
+    tempoChange(120),
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 5)), noteOff(11, songNote(4, 5)), // F4
+    noteOn(1, songNote(4, 7)), noteOff(11, songNote(4, 7)), // G4
+    noteOn(1, songNote(4, 7)), noteOff(11, songNote(4, 7)), // G4
+    noteOn(1, songNote(4, 5)), noteOff(11, songNote(4, 5)), // F4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 2)), noteOff(11, songNote(4, 2)), // D4
+    noteOn(1, songNote(4, 0)), noteOff(11, songNote(4, 0)), // C4
+    noteOn(1, songNote(4, 0)), noteOff(11, songNote(4, 0)), // C4
+    noteOn(1, songNote(4, 2)), noteOff(11, songNote(4, 2)), // D4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 4)), noteOff(17, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 2)), noteOff(5, songNote(4, 2)), // D4
+    noteOn(1, songNote(4, 2)), noteOff(23, songNote(4, 2)), // D4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 5)), noteOff(11, songNote(4, 5)), // F4
+    noteOn(1, songNote(4, 7)), noteOff(11, songNote(4, 7)), // G4
+    noteOn(1, songNote(4, 7)), noteOff(11, songNote(4, 7)), // G4
+    noteOn(1, songNote(4, 5)), noteOff(11, songNote(4, 5)), // F4
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 2)), noteOff(11, songNote(4, 2)), // D4
+    noteOn(1, songNote(4, 0)), noteOff(11, songNote(4, 0)), // C4
+    noteOn(1, songNote(4, 0)), noteOff(11, songNote(4, 0)), // C4
+    noteOn(1, songNote(4, 2)), noteOff(11, songNote(4, 2)), // D4
+    // Slowing into the last bar
+    tempoChange(108),
+    noteOn(1, songNote(4, 4)), noteOff(11, songNote(4, 4)), // E4
+    noteOn(1, songNote(4, 2)), noteOff(17, songNote(4, 2)), // D4
+    tempoChange(92),
+    noteOn(1, songNote(4, 0)), noteOff(5, songNote(4, 0)), // C4
+    noteOn(1, songNote(4, 0)), noteOff(23, songNote(4, 0)), // C4
+    songEnd(12),
+};
+
+const Song songs[] = {
+    {"Chords", brokenChords, sizeof(brokenChords) / sizeof(brokenChords[0])},
+    {"Ode to Joy", odeToJoy, sizeof(odeToJoy) / sizeof(odeToJoy[0])},
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+#include "Voice_allocator.hpp"
+
+// Each event is two bytes: a delay in ticks since the previous event, then a
+// command. A note is an index into stepSizes (C2 - B8), which carries its octave.
+// Songs are written by hand with the helpers below, or compiled from MIDI files
+// by src/host/midi_compile.cpp.
+
+constexpr int SONG_TICKS_PER_BEAT = 12;
+
+enum SongCommand : uint8_t
+{
+  // 0x00 - 0x53 start a note, 0x80 - 0xD3 stop it
+  SONG_NOTE_OFF = 0x80,
+  // Releases every note
+  SONG_ALL_OFF = 0xE0,
+  // Changes tempo; the first byte is the new tempo in BPM instead of a delay,
+  // so it applies together with the event before it
+  SONG_TEMPO = 0xF0,
+  // Does nothing, for rests longer than one delay
+  SONG_WAIT = 0xF1,
+  // Starts again from the first event
+  SONG_LOOP = 0xFE,
+  // Stops, releasing every note
+  SONG_END = 0xFF
+};
+
+struct SongEvent
+{
+  uint8_t delta;
+  uint8_t command;
+};
+
+struct Song
+{
+  const char *name;
+  const SongEvent *events;
+  uint16_t count;
+};
+
+// Note index for a semitone (0 = C) in an octave, as the keyboard numbers them
+constexpr uint8_t songNote(int octave, int semitone)
+{
+  return 12 * (octave - 2) + semitone;
+}
+
+constexpr SongEvent noteOn(uint8_t delta, uint8_t note) { return {delta, note}; }
+constexpr SongEvent noteOff(uint8_t delta, uint8_t note) { return {delta, (uint8_t)(SONG_NOTE_OFF | note)}; }
+constexpr SongEvent tempoChange(uint8_t bpm) { return {bpm, SONG_TEMPO}; }
+constexpr SongEvent songWait(uint8_t delta) { return {delta, SONG_WAIT}; }
+constexpr SongEvent songLoop(uint8_t delta) { return {delta, SONG_LOOP}; }
+constexpr SongEvent songEnd(uint8_t delta) { return {delta, SONG_END}; }
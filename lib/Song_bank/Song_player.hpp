@@ -0,0 +1,242 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Modulation.hpp"
+#include "Note_processing.hpp"
+#include "Song_format.hpp"
+
+// Plays songs stored as const event tables in flash. The audio task advances
+// the player by every block it renders, so songs are timed by the same sample
+// clock as the arpeggiator and do not drift however the tasks are scheduled.
+// The notes a song holds are picked up by the key scan and sounded like keys
+// pressed on the keyboard, through the current chord or octave effect.
+
+#include "Song_bank.hpp"
+
+constexpr int SONG_COUNT = sizeof(songs) / sizeof(songs[0]);
+constexpr int SONG_STOPPED = -1;
+
+class SongPlayer
+{
+public:
+  explicit SongPlayer(uint32_t sampleRate) : m_sampleRate(sampleRate) {}
+
+  // Control task side. Starts a song from the top, or restarts it
+  void play(int song)
+  {
+    __atomic_store_n(&m_request, (int8_t)(song >= 0 && song < SONG_COUNT ? song : SONG_STOPPED), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_requestCount, 1, __ATOMIC_RELEASE);
+  }
+
+  // Stops at the next block, releasing the song's notes
+  void stop()
+  {
+    play(SONG_STOPPED);
+  }
+
+  // The song playing, or SONG_STOPPED once it has ended or been stopped
+  int playing() const
+  {
+    return __atomic_load_n(&m_playing, __ATOMIC_RELAXED);
+  }
+
+  // Key scan task side. The notes the song is holding
+  void heldNotes(NoteSet *held) const
+  {
+    uint32_t sequence;
+    do
+    {
+      sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE);
+      for (size_t w = 0; w < WORDS; w++)
+      {
+        held->bits[w] = __atomic_load_n(&m_published[w], __ATOMIC_RELAXED);
+      }
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      // The audio task wrote part way through the copy, so take it again
+    } while ((sequence & 1) != 0 || sequence != __atomic_load_n(&m_sequence, __ATOMIC_RELAXED));
+  }
+
+  // Audio task side. Moves the song on by n samples, firing the events that
+  // fall within them. Returns true if the held notes changed, so the key scan
+  // can be woken to pick them up
+  bool advance(size_t n)
+  {
+    bool published = false;
+    uint32_t requests = __atomic_load_n(&m_requestCount, __ATOMIC_ACQUIRE);
+    if (requests != m_handledRequests)
+    {
+      m_handledRequests = requests;
+      start(__atomic_load_n(&m_request, __ATOMIC_RELAXED));
+      published = true;
+    }
+    if (m_song == nullptr)
+    {
+      return published;
+    }
+
+    // An event lands on the first whole sample at or after its time
+    const uint64_t blockEnd = m_clock + n;
+    bool changed = false;
+    while (m_song != nullptr && ((m_nextEvent + 0xFFFF) >> 16) < blockEnd)
+    {
+      m_lastEventSample = (uint32_t)((m_nextEvent + 0xFFFF) >> 16);
+      changed |= fire(m_song->events[m_index]);
+      m_eventCount++;
+      if (m_song != nullptr)
+      {
+        scheduleNext();
+      }
+    }
+    m_clock = blockEnd;
+    // Running off the end stops the song as well
+    if (changed || m_song == nullptr)
+    {
+      publish();
+      published = true;
+    }
+    return published;
+  }
+
+  // Events fired so far and the sample of the song the last one landed on, for
+  // checking timing on the host
+  uint32_t eventCount() const { return m_eventCount; }
+  uint32_t lastEventSample() const { return m_lastEventSample; }
+
+private:
+  static constexpr size_t WORDS = sizeof(NoteSet::bits) / sizeof(NoteSet::bits[0]);
+
+  void start(int song)
+  {
+    memset(m_notes, 0, sizeof(m_notes));
+    publish();
+    m_song = song == SONG_STOPPED ? nullptr : &songs[song];
+    __atomic_store_n(&m_playing, (int8_t)song, __ATOMIC_RELAXED);
+    setTempo(TEMPO_DEFAULT);
+    m_clock = 0;
+    m_nextEvent = 0;
+    m_loopStart = 0;
+    m_index = 0;
+    if (m_song != nullptr)
+    {
+      scheduleFirst();
+    }
+  }
+
+  void setTempo(int bpm)
+  {
+    bpm = bpm < TEMPO_MIN ? TEMPO_MIN : (bpm > TEMPO_MAX ? TEMPO_MAX : bpm);
+    m_tickLength = ((uint64_t)60 * m_sampleRate << 16) / ((uint32_t)bpm * SONG_TICKS_PER_BEAT);
+  }
+
+  // Tempo events fire with the event before them, so they take effect at once
+  // and the delay that follows is timed at the new tempo
+  void scheduleFirst()
+  {
+    while (m_index < m_song->count && m_song->events[m_index].command == SONG_TEMPO)
+    {
+      setTempo(m_song->events[m_index].delta);
+      m_index++;
+    }
+    if (m_index >= m_song->count)
+    {
+      stopSong();
+      return;
+    }
+    m_nextEvent += m_song->events[m_index].delta * m_tickLength;
+  }
+
+  void scheduleNext()
+  {
+    m_index++;
+    if (m_index >= m_song->count)
+    {
+      stopSong();
+      return;
+    }
+    scheduleFirst();
+  }
+
+  void stopSong()
+  {
+    memset(m_notes, 0, sizeof(m_notes));
+    m_song = nullptr;
+    __atomic_store_n(&m_playing, (int8_t)SONG_STOPPED, __ATOMIC_RELAXED);
+  }
+
+  // Applies an event, returning true if the held notes changed
+  bool fire(const SongEvent &event)
+  {
+    uint8_t command = event.command;
+    if (command < NOTE_COUNT)
+    {
+      m_notes[command >> 5] |= 1u << (command & 31);
+      return true;
+    }
+    if (command >= SONG_NOTE_OFF && command < SONG_NOTE_OFF + NOTE_COUNT)
+    {
+      uint8_t note = command - SONG_NOTE_OFF;
+      m_notes[note >> 5] &= ~(1u << (note & 31));
+      return true;
+    }
+    switch (command)
+    {
+    case SONG_ALL_OFF:
+      memset(m_notes, 0, sizeof(m_notes));
+      return true;
+    case SONG_LOOP:
+      // A loop with nothing to wait for would never finish
+      if (m_nextEvent == m_loopStart)
+      {
+        stopSong();
+        return true;
+      }
+      m_loopStart = m_nextEvent;
+      m_index = (uint16_t)-1;
+      return false;
+    case SONG_END:
+      stopSong();
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Copies the held notes out for the key scan. The sequence count is odd while
+  // they are being written
+  void publish()
+  {
+    uint32_t sequence = m_sequence + 1;
+    __atomic_store_n(&m_sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t w = 0; w < WORDS; w++)
+    {
+      __atomic_store_n(&m_published[w], m_notes[w], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&m_sequence, sequence + 1, __ATOMIC_RELEASE);
+  }
+
+  uint32_t m_sampleRate;
+
+  int8_t m_request = SONG_STOPPED;
+  uint32_t m_requestCount = 0;
+  int8_t m_playing = SONG_STOPPED;
+  uint32_t m_sequence = 0;
+  uint32_t m_published[WORDS] = {};
+
+  // Audio task state
+  uint32_t m_handledRequests = 0;
+  const Song *m_song = nullptr;
+  uint16_t m_index = 0;
+  // Q16 samples per tick at the current tempo
+  uint64_t m_tickLength = 0;
+  // Samples since the song started, and the Q16 times of the next event and of
+  // the last pass through the loop
+  uint64_t m_clock = 0;
+  uint64_t m_nextEvent = 0;
+  uint64_t m_loopStart = 0;
+  uint32_t m_notes[WORDS] = {};
+  uint32_t m_eventCount = 0;
+  uint32_t m_lastEventSample = 0;
+};
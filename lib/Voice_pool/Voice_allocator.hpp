@@ -0,0 +1,286 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Voice_pool.hpp"
+#include "Envelope.hpp"
+
+// Maps note IDs to stable voice slots so a held note keeps its slot (and the
+// renderer keeps its phase) for as long as it sounds. Runs in the key scan
+// task on note events: each scan calls beginScan(), noteOn() and noteOff() for
+// the notes that started and stopped since the last scan (see NoteTracker),
+// then endScan() to allocate slots for the new notes and write the frame, only
+// if anything changed. Held notes are not touched between their on and off,
+// so a scan with no events and no releases in progress does next to nothing.
+// A released slot stays in use until its envelope has finished.
+
+// Where a note comes from. The CAN sources match the index into cur_message
+enum NoteSource : uint8_t
+{
+  NOTE_SOURCE_LOCAL = 0,
+  NOTE_SOURCE_CAN0 = 1,
+  NOTE_SOURCE_CAN1 = 2,
+  NOTE_SOURCE_COUNT = 3
+};
+
+// Notes are indexes into stepSizes (C2 - B8)
+constexpr uint8_t NOTE_COUNT = 84;
+
+typedef uint8_t NoteId;
+constexpr size_t NOTE_ID_COUNT = NOTE_SOURCE_COUNT * NOTE_COUNT;
+
+inline NoteId makeNoteId(uint8_t source, uint8_t note)
+{
+  return source * NOTE_COUNT + note;
+}
+
+class VoiceAllocator
+{
+public:
+  VoiceAllocator()
+  {
+    memset(m_slotOfNote, NO_SLOT, sizeof(m_slotOfNote));
+  }
+
+  // Caps the number of voices sounding at once (1 - MAX_VOICES)
+  void setPolyphony(uint8_t polyphony)
+  {
+    m_polyphony = polyphony == 0 ? 1 : (polyphony > MAX_VOICES ? MAX_VOICES : polyphony);
+  }
+
+  uint8_t polyphony() const { return m_polyphony; }
+  uint8_t activeCount() const { return m_activeCount; }
+
+  // Slot currently assigned to a note, or NO_SLOT
+  uint8_t slotOf(NoteId id) const { return m_slotOfNote[id]; }
+
+  void beginScan()
+  {
+    m_pendingCount = 0;
+  }
+
+  // A note has started. It gets a voice at endScan(). Notes that already have
+  // one, or are already waiting for one, are ignored
+  void noteOn(NoteId id, uint32_t stepSize, uint8_t pan = PAN_CENTRE)
+  {
+    if (m_slotOfNote[id] != NO_SLOT || testBit(m_pendingBits, id) || m_pendingCount == MAX_VOICES)
+    {
+      return;
+    }
+    setBit(m_pendingBits, id);
+    m_pendingNote[m_pendingCount] = id;
+    m_pendingStep[m_pendingCount] = stepSize;
+    m_pendingPan[m_pendingCount] = pan;
+    m_pendingCount++;
+  }
+
+  // A note has stopped: its voice plays its release. A note that lost its
+  // voice to a steal has nothing left to release, and one still waiting for
+  // a voice never gets it
+  void noteOff(NoteId id)
+  {
+    uint8_t slot = m_slotOfNote[id];
+    if (slot != NO_SLOT)
+    {
+      release(slot);
+      m_changed = true;
+    }
+    else if (testBit(m_pendingBits, id))
+    {
+      clearBit(m_pendingBits, id);
+      for (uint8_t i = 0; i < m_pendingCount; i++)
+      {
+        if (m_pendingNote[i] == id)
+        {
+          m_pendingCount--;
+          memmove(&m_pendingNote[i], &m_pendingNote[i + 1], m_pendingCount - i);
+          memmove(&m_pendingStep[i], &m_pendingStep[i + 1], (m_pendingCount - i) * sizeof(m_pendingStep[0]));
+          memmove(&m_pendingPan[i], &m_pendingPan[i + 1], m_pendingCount - i);
+          break;
+        }
+      }
+    }
+  }
+
+  // Frees slots whose release has finished, applies a lowered polyphony cap,
+  // allocates slots for new notes (stealing a voice when the cap is reached)
+  // and, if the voices have changed since the last frame, writes them and
+  // returns true so the caller publishes it
+  bool endScan(VoiceFrame *frame, const VoiceEnvelopes &envelopes)
+  {
+    if (m_releasingCount > 0)
+    {
+      for (uint8_t slot = 0; slot < MAX_VOICES; slot++)
+      {
+        if (m_releasing[slot] && envelopes.finished(slot, m_generation[slot]))
+        {
+          freeVoice(slot);
+        }
+      }
+    }
+
+    // The cap may have been lowered since the last scan
+    while (m_activeCount > m_polyphony)
+    {
+      steal(victimSlot(m_clock + 1));
+    }
+
+    const uint32_t scanStart = m_clock;
+    for (uint8_t i = 0; i < m_pendingCount; i++)
+    {
+      NoteId id = m_pendingNote[i];
+      clearBit(m_pendingBits, id);
+
+      uint8_t slot = NO_SLOT;
+      if (m_activeCount < m_polyphony)
+      {
+        slot = freeSlot();
+      }
+      else
+      {
+        // Only steal voices from earlier scans, otherwise new notes would
+        // keep stealing from each other
+        slot = victimSlot(scanStart);
+        if (slot != NO_SLOT)
+        {
+          steal(slot);
+        }
+      }
+
+      // Nothing to steal: the note stays silent until pressed again
+      if (slot == NO_SLOT)
+      {
+        continue;
+      }
+
+      m_active[slot] = true;
+      m_note[slot] = id;
+      m_stepSize[slot] = m_pendingStep[i];
+      m_pan[slot] = m_pendingPan[i];
+      m_start[slot] = ++m_clock;
+      m_generation[slot]++;
+      m_slotOfNote[id] = slot;
+      m_activeCount++;
+      m_changed = true;
+    }
+
+    if (!m_changed)
+    {
+      return false;
+    }
+    m_changed = false;
+    frame->count = 0;
+    for (uint8_t slot = 0; slot < MAX_VOICES; slot++)
+    {
+      if (m_active[slot])
+      {
+        frame->slot[frame->count] = slot;
+        frame->stepSize[frame->count] = m_stepSize[slot];
+        frame->generation[frame->count] = m_generation[slot];
+        frame->held[frame->count] = !m_releasing[slot];
+        frame->pan[frame->count] = m_pan[slot];
+        frame->count++;
+      }
+    }
+    return true;
+  }
+
+  static constexpr uint8_t NO_SLOT = 0xFF;
+
+private:
+  // The note's key is up: the voice plays its release and the note can be
+  // pressed again into another slot
+  void release(uint8_t slot)
+  {
+    m_slotOfNote[m_note[slot]] = NO_SLOT;
+    m_releasing[slot] = true;
+    m_releasingCount++;
+  }
+
+  void freeVoice(uint8_t slot)
+  {
+    if (m_releasing[slot])
+    {
+      m_releasing[slot] = false;
+      m_releasingCount--;
+    }
+    m_active[slot] = false;
+    m_activeCount--;
+    m_changed = true;
+  }
+
+  // Takes a voice for a new note. A held note that loses its voice stays
+  // silent until pressed again, as its key sends no new note on before then
+  void steal(uint8_t slot)
+  {
+    if (!m_releasing[slot])
+    {
+      m_slotOfNote[m_note[slot]] = NO_SLOT;
+    }
+    freeVoice(slot);
+  }
+
+  uint8_t freeSlot() const
+  {
+    for (uint8_t slot = 0; slot < MAX_VOICES; slot++)
+    {
+      if (!m_active[slot])
+      {
+        return slot;
+      }
+    }
+    return NO_SLOT;
+  }
+
+  // Voice to steal: the oldest one in its release, otherwise the held voice
+  // with the earliest start before the given time
+  uint8_t victimSlot(uint32_t before) const
+  {
+    uint8_t oldest = NO_SLOT;
+    for (uint8_t slot = 0; slot < MAX_VOICES; slot++)
+    {
+      if (!m_active[slot] || (!m_releasing[slot] && m_start[slot] > before))
+      {
+        continue;
+      }
+      if (oldest == NO_SLOT || (m_releasing[slot] && !m_releasing[oldest]) ||
+          (m_releasing[slot] == m_releasing[oldest] && m_start[slot] < m_start[oldest]))
+      {
+        oldest = slot;
+      }
+    }
+    return oldest;
+  }
+
+  static bool testBit(const uint32_t *bits, NoteId id) { return bits[id >> 5] & (1u << (id & 31)); }
+  static void setBit(uint32_t *bits, NoteId id) { bits[id >> 5] |= (1u << (id & 31)); }
+  static void clearBit(uint32_t *bits, NoteId id) { bits[id >> 5] &= ~(1u << (id & 31)); }
+
+  static constexpr size_t NOTE_WORDS = (NOTE_ID_COUNT + 31) / 32;
+
+  // Per slot state
+  NoteId m_note[MAX_VOICES] = {};
+  uint32_t m_stepSize[MAX_VOICES] = {};
+  uint8_t m_pan[MAX_VOICES] = {};
+  uint32_t m_start[MAX_VOICES] = {};
+  uint8_t m_generation[MAX_VOICES] = {};
+  bool m_active[MAX_VOICES] = {};
+  bool m_releasing[MAX_VOICES] = {};
+
+  uint8_t m_slotOfNote[NOTE_ID_COUNT];
+
+  // Notes without a slot held during the current scan
+  NoteId m_pendingNote[MAX_VOICES];
+  uint32_t m_pendingStep[MAX_VOICES];
+  uint8_t m_pendingPan[MAX_VOICES];
+  uint32_t m_pendingBits[NOTE_WORDS] = {};
+  uint8_t m_pendingCount = 0;
+
+  uint8_t m_activeCount = 0;
+  uint8_t m_releasingCount = 0;
+  // The voices differ from the last frame written
+  bool m_changed = false;
+  uint8_t m_polyphony = MAX_VOICES;
+  uint32_t m_clock = 0;
+};
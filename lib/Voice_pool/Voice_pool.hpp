@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed capacity voice storage shared between the key scan task (writer) and
+// the audio render task (reader). No heap is used: frames are statically sized
+// and handed over through a lock-free triple buffer.
+
+constexpr size_t MAX_VOICES = 84;
+
+// Stereo position of a voice
+constexpr uint8_t PAN_LEFT = 0;
+constexpr uint8_t PAN_CENTRE = 64;
+constexpr uint8_t PAN_RIGHT = 128;
+
+// One published set of voices, stored as arrays so the renderer walks
+// contiguous memory. slot is the stable voice slot that owns the renderer's
+// phase; generation changes whenever the slot is given to a new note. held is
+// false once the note's key is released and the voice is in its release.
+struct VoiceFrame
+{
+  uint8_t slot[MAX_VOICES];
+  uint32_t stepSize[MAX_VOICES];
+  uint8_t generation[MAX_VOICES];
+  bool held[MAX_VOICES];
+  uint8_t pan[MAX_VOICES];
+  uint8_t count = 0;
+};
+
+class VoicePool
+{
+public:
+  // Returns an empty frame owned by the writer
+  VoiceFrame *beginFrame()
+  {
+    VoiceFrame *frame = &m_frames[m_writeIdx];
+    frame->count = 0;
+    return frame;
+  }
+
+  // Makes the frame returned by beginFrame() the latest one, taking back whichever
+  // frame the reader is not using
+  void publish()
+  {
+    m_writeIdx = __atomic_exchange_n(&m_latest, m_writeIdx | FRESH, __ATOMIC_ACQ_REL) & INDEX_MASK;
+  }
+
+  // Returns the most recently published frame. Only the audio task calls this,
+  // and the frame stays valid until its next call
+  const VoiceFrame &acquire()
+  {
+    if (__atomic_load_n(&m_latest, __ATOMIC_ACQUIRE) & FRESH)
+    {
+      m_readIdx = __atomic_exchange_n(&m_latest, m_readIdx, __ATOMIC_ACQ_REL) & INDEX_MASK;
+    }
+    return m_frames[m_readIdx];
+  }
+
+private:
+  static constexpr uint8_t FRESH = 0x04;
+  static constexpr uint8_t INDEX_MASK = 0x03;
+
+  VoiceFrame m_frames[3];
+  uint8_t m_writeIdx = 0;
+  uint8_t m_latest = 1;
+  uint8_t m_readIdx = 2;
+};
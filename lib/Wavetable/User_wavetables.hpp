@@ -0,0 +1,17 @@
+#pragma once
+
+// User-defined waveforms, selectable on the waveform knob after Sine.
+// Each one is a list of sine harmonic amplitudes (fundamental first, up to
+// MAX_HARMONICS) that is band-limited into mip tables at compile time. To add a
+// wave, define its tables here and list them in userWavetables/userWaveNames.
+
+// Hammond style 8' 4' 2 2/3' 2' drawbars
+constexpr double organAmplitudes[] = {1.0, 0.8, 0.6, 0.5};
+constexpr MipWavetable organTables = makeMipWavetable(harmonicsFromAmplitudes(organAmplitudes), 1.0);
+
+// Hollow, odd harmonics only, falling off slower than a square
+constexpr double reedAmplitudes[] = {1.0, 0.0, 0.7, 0.0, 0.5, 0.0, 0.35, 0.0, 0.25, 0.0, 0.15};
+constexpr MipWavetable reedTables = makeMipWavetable(harmonicsFromAmplitudes(reedAmplitudes), 1.0);
+
+const MipWavetable *const userWavetables[] = {&organTables, &reedTables};
+const char *const userWaveNames[] = {"Organ", "Reed"};
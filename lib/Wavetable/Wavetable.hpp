@@ -0,0 +1,268 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Integer wavetable oscillator. Tables hold one cycle of 2^BITS Q15 samples
+// plus a guard sample (a copy of the first) so interpolation never needs to
+// wrap. The top BITS of a 32-bit phase select the entry and the bits below
+// interpolate towards the next one.
+//
+// Every table is generated by constexpr functions during compilation and is
+// const, so the whole bank lives in flash and nothing is computed at boot.
+
+constexpr int WAVETABLE_BITS = 10;
+constexpr size_t WAVETABLE_SIZE = 1 << WAVETABLE_BITS;
+
+// Band-limited waves, one mip level per octave of step size. Level L is used
+// for step sizes below 2^(24 + L) (86 Hz * 2^L at 22050 Hz) and holds only the
+// harmonics that stay below Nyquist up to that frequency.
+constexpr int MIP_TABLE_BITS = 9;
+constexpr size_t MIP_TABLE_SIZE = 1 << MIP_TABLE_BITS;
+constexpr int MIP_LEVELS = 8;
+constexpr int MIP_BASE_BITS = 24;
+constexpr int MAX_HARMONICS = 1 << (MIP_LEVELS - 1);
+
+// Flash allowed for the whole bank, checked at compile time
+constexpr size_t WAVETABLE_FLASH_BUDGET = 48 * 1024;
+
+// Waveform knob positions
+enum Waveform
+{
+  WAVE_SAW = 0,
+  WAVE_SQUARE = 1,
+  WAVE_TRIANGLE = 2,
+  WAVE_SINE = 3,
+  WAVE_USER = 4
+};
+
+struct SineWavetable
+{
+  int16_t samples[WAVETABLE_SIZE + 1];
+};
+
+struct MipWavetable
+{
+  int16_t levels[MIP_LEVELS][MIP_TABLE_SIZE + 1];
+};
+
+// Sine and cosine amplitudes of harmonics 1 - MAX_HARMONICS (index 0 unused)
+struct Harmonics
+{
+  double sine[MAX_HARMONICS + 1] = {};
+  double cosine[MAX_HARMONICS + 1] = {};
+};
+
+constexpr double WAVETABLE_PI = 3.14159265358979323846;
+
+// Taylor series sine, accurate to ~1e-15 after reducing x to [-pi, pi]
+constexpr double constexprSin(double x)
+{
+  while (x > WAVETABLE_PI)
+  {
+    x -= 2 * WAVETABLE_PI;
+  }
+  while (x < -WAVETABLE_PI)
+  {
+    x += 2 * WAVETABLE_PI;
+  }
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 20; n++)
+  {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double constexprCos(double x)
+{
+  return constexprSin(x + WAVETABLE_PI / 2);
+}
+
+// exp(x) for x <= 0, by halving x until the Taylor series converges quickly
+// and squaring the result back up
+constexpr double constexprExp(double x)
+{
+  int halvings = 0;
+  while (x < -0.5)
+  {
+    x /= 2;
+    halvings++;
+  }
+  double term = 1;
+  double sum = 1;
+  for (int n = 1; n < 20; n++)
+  {
+    term *= x / n;
+    sum += term;
+  }
+  for (int i = 0; i < halvings; i++)
+  {
+    sum *= sum;
+  }
+  return sum;
+}
+
+constexpr int16_t toQ15(double value)
+{
+  double scaled = value * 32767;
+  scaled = scaled > 32767 ? 32767 : (scaled < -32767 ? -32767 : scaled);
+  return (int16_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// Sum of the first harmonics partials at x. sin(k x) and cos(k x) come from
+// rotating by x each step so only one sin/cos is needed per point
+constexpr double additive(const Harmonics &h, double x, int harmonics)
+{
+  const double c1 = constexprCos(x);
+  const double s1 = constexprSin(x);
+  double c = c1;
+  double s = s1;
+  double value = 0;
+  for (int k = 1; k <= harmonics; k++)
+  {
+    value += h.sine[k] * s + h.cosine[k] * c;
+    double next = c * c1 - s * s1;
+    s = s * c1 + c * s1;
+    c = next;
+  }
+  return value;
+}
+
+constexpr SineWavetable makeSineWavetable()
+{
+  SineWavetable table = {};
+  for (size_t i = 0; i <= WAVETABLE_SIZE; i++)
+  {
+    table.samples[i] = toQ15(constexprSin(2 * WAVETABLE_PI * (i % WAVETABLE_SIZE) / WAVETABLE_SIZE));
+  }
+  return table;
+}
+
+// Each level keeps the harmonics below Nyquist for its top frequency. All levels
+// are scaled by the peak of the fullest one so the loudness does not change
+// between octaves; gain then sets the level relative to full scale
+constexpr MipWavetable makeMipWavetable(const Harmonics &h, double gain)
+{
+  double peak = 0;
+  for (size_t i = 0; i < MIP_TABLE_SIZE; i++)
+  {
+    double value = additive(h, 2 * WAVETABLE_PI * i / MIP_TABLE_SIZE, MAX_HARMONICS);
+    value = value < 0 ? -value : value;
+    peak = value > peak ? value : peak;
+  }
+
+  MipWavetable table = {};
+  for (int level = 0; level < MIP_LEVELS; level++)
+  {
+    int harmonics = MAX_HARMONICS >> level;
+    for (size_t i = 0; i <= MIP_TABLE_SIZE; i++)
+    {
+      double x = 2 * WAVETABLE_PI * (i % MIP_TABLE_SIZE) / MIP_TABLE_SIZE;
+      table.levels[level][i] = toQ15(gain * additive(h, x, harmonics) / peak);
+    }
+  }
+  return table;
+}
+
+// Rising ramp: -sum(sin(k x) / k)
+constexpr Harmonics sawHarmonics()
+{
+  Harmonics h;
+  for (int k = 1; k <= MAX_HARMONICS; k++)
+  {
+    h.sine[k] = -1.0 / k;
+  }
+  return h;
+}
+
+// High for the first half cycle: sum(sin(k x) / k), odd k
+constexpr Harmonics squareHarmonics()
+{
+  Harmonics h;
+  for (int k = 1; k <= MAX_HARMONICS; k += 2)
+  {
+    h.sine[k] = 1.0 / k;
+  }
+  return h;
+}
+
+// Lowest at the start of the cycle: -sum(cos(k x) / k^2), odd k
+constexpr Harmonics triangleHarmonics()
+{
+  Harmonics h;
+  for (int k = 1; k <= MAX_HARMONICS; k += 2)
+  {
+    h.cosine[k] = -1.0 / ((double)k * k);
+  }
+  return h;
+}
+
+// Sine partials with the given amplitudes, fundamental first
+template <size_t N>
+constexpr Harmonics harmonicsFromAmplitudes(const double (&amplitudes)[N])
+{
+  static_assert(N <= MAX_HARMONICS, "Too many harmonics for the mip tables");
+  Harmonics h;
+  for (size_t k = 1; k <= N; k++)
+  {
+    h.sine[k] = amplitudes[k - 1];
+  }
+  return h;
+}
+
+constexpr SineWavetable sineTable = makeSineWavetable();
+constexpr MipWavetable sawTables = makeMipWavetable(sawHarmonics(), 1.0);
+// Square and triangle at the levels the original oscillators used relative to the saw
+constexpr MipWavetable squareTables = makeMipWavetable(squareHarmonics(), 0.5);
+constexpr MipWavetable triangleTables = makeMipWavetable(triangleHarmonics(), 0.5);
+
+#include "User_wavetables.hpp"
+
+constexpr size_t USER_WAVE_COUNT = sizeof(userWavetables) / sizeof(userWavetables[0]);
+constexpr size_t WAVE_COUNT = WAVE_USER + USER_WAVE_COUNT;
+
+static_assert(sizeof(userWaveNames) / sizeof(userWaveNames[0]) == USER_WAVE_COUNT, "Every user wavetable needs a name");
+static_assert(sizeof(sineTable) + (3 + USER_WAVE_COUNT) * sizeof(MipWavetable) <= WAVETABLE_FLASH_BUDGET,
+              "Wavetable bank exceeds WAVETABLE_FLASH_BUDGET");
+
+// Mip tables for a band-limited waveform (anything but WAVE_SINE)
+inline const MipWavetable &mipWavetable(int waveform)
+{
+  switch (waveform)
+  {
+  case WAVE_SAW:
+    return sawTables;
+  case WAVE_SQUARE:
+    return squareTables;
+  case WAVE_TRIANGLE:
+    return triangleTables;
+  default:
+    return *userWavetables[waveform - WAVE_USER];
+  }
+}
+
+// Mip level for a voice's step size
+inline int mipLevel(uint32_t stepSize)
+{
+  if (stepSize < (1u << MIP_BASE_BITS))
+  {
+    return 0;
+  }
+  int level = (31 - __builtin_clz(stepSize)) - (MIP_BASE_BITS - 1);
+  return level < MIP_LEVELS ? level : MIP_LEVELS - 1;
+}
+
+// Linearly interpolated Q15 sample at phase
+template <int BITS = WAVETABLE_BITS>
+inline int32_t wavetableLookup(const int16_t *table, uint32_t phase)
+{
+  constexpr int FRAC_BITS = 32 - BITS;
+  uint32_t index = phase >> FRAC_BITS;
+  // Top 15 fractional bits, so (b - a) * frac fits in 32 bits
+  int32_t frac = (phase >> (FRAC_BITS - 15)) & 0x7FFF;
+  int32_t a = table[index];
+  int32_t b = table[index + 1];
+  return a + (((b - a) * frac) >> 15);
+}
@@ -0,0 +1,67 @@
+#pragma once
+// Host only: the switch matrix behind its pins, for driving KeyMatrix without
+// the board. Switches are opened and closed directly, and the row select and
+// output latches behave as the board's do, so the columns only show a row
+// while it is driven. Pin accesses are counted as the board would make them.
+#include <stdint.h>
+
+#include "Key_matrix.hpp"
+
+class MockMatrixPins
+{
+public:
+  // Switch levels as a frame, 0 while closed
+  uint32_t switches = MATRIX_OPEN;
+  // Output latches, bit per row address
+  uint8_t outputs = 0;
+  uint32_t writes = 0;
+  uint32_t reads = 0;
+  uint32_t settles = 0;
+
+  void press(int row, int column, bool closed)
+  {
+    uint32_t bit = 1u << (MATRIX_COLUMNS * row + column);
+    switches = closed ? switches & ~bit : switches | bit;
+  }
+
+  // Closes exactly the keys in a 12-bit mask, C in bit 0
+  void holdKeys(uint16_t keyStates)
+  {
+    switches = (switches & ~0x0FFFu) | (~keyStates & 0x0FFFu);
+  }
+
+  void select(uint8_t row, bool out)
+  {
+    m_enabled = false;
+    m_row = row;
+    m_out = out;
+    writes += 5;
+  }
+
+  void enable()
+  {
+    m_enabled = true;
+    outputs = m_out ? outputs | 1u << m_row : outputs & ~(1u << m_row);
+    writes++;
+  }
+
+  void disable()
+  {
+    m_enabled = false;
+    writes++;
+  }
+
+  void settle() { settles++; }
+
+  // Pulled up when no row is driven
+  uint8_t columns()
+  {
+    reads += MATRIX_COLUMNS;
+    return m_enabled && m_row < MATRIX_ROWS ? matrixRow(switches, m_row) : 0x0F;
+  }
+
+private:
+  bool m_enabled = false;
+  uint8_t m_row = 0;
+  bool m_out = false;
+};
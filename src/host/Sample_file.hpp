@@ -0,0 +1,141 @@
+#pragma once
+// Host only: samples from WAV files, memory mapped and played in place so a
+// sample set can be tried out without reflashing. The mapping stays open for
+// the life of the program, as the flash it stands in for would.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Sampler.hpp"
+
+inline uint32_t readLE(const uint8_t *bytes, int count)
+{
+  uint32_t value = 0;
+  for (int i = count - 1; i >= 0; i--)
+  {
+    value = value << 8 | bytes[i];
+  }
+  return value;
+}
+
+// Maps a mono 8 or 16-bit PCM WAV file and points sample at its data. The
+// first loop and the root note come from the file's smpl chunk if it has one;
+// rootHz, if not 0, overrides the root. Returns false after printing why not
+bool mapSampleFile(const char *path, double rootHz, Sample *sample)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0)
+  {
+    fprintf(stderr, "%s: could not open\n", path);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return false;
+  }
+  size_t size = info.st_size;
+  void *mapping = size >= 12 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    fprintf(stderr, "%s: could not map\n", path);
+    return false;
+  }
+  const uint8_t *file = static_cast<const uint8_t *>(mapping);
+  if (memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+  {
+    fprintf(stderr, "%s: not a WAV file\n", path);
+    munmap(mapping, size);
+    return false;
+  }
+
+  const uint8_t *format = nullptr;
+  const uint8_t *data = nullptr;
+  const uint8_t *loop = nullptr;
+  uint32_t dataBytes = 0;
+  uint32_t rate = 0;
+  int unityNote = -1;
+  // Chunks start on even offsets, so 16-bit data is aligned in the mapping
+  size_t offset = 12;
+  while (offset + 8 <= size)
+  {
+    const uint8_t *chunk = file + offset;
+    uint32_t length = readLE(chunk + 4, 4);
+    if (length > size - offset - 8)
+    {
+      length = size - offset - 8;
+    }
+    if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16)
+    {
+      format = chunk + 8;
+      rate = readLE(format + 4, 4);
+    }
+    else if (memcmp(chunk, "data", 4) == 0)
+    {
+      data = chunk + 8;
+      dataBytes = length;
+    }
+    else if (memcmp(chunk, "smpl", 4) == 0 && length >= 36)
+    {
+      unityNote = readLE(chunk + 8 + 12, 4);
+      if (readLE(chunk + 8 + 28, 4) > 0 && length >= 60)
+      {
+        loop = chunk + 8 + 36;
+      }
+    }
+    offset += 8 + length + (length & 1);
+  }
+
+  int bits = format != nullptr ? readLE(format + 14, 2) : 0;
+  if (format == nullptr || data == nullptr || readLE(format, 2) != 1 || readLE(format + 2, 2) != 1 ||
+      (bits != 8 && bits != 16) || rate == 0)
+  {
+    fprintf(stderr, "%s: only mono 8 or 16-bit PCM is supported\n", path);
+    munmap(mapping, size);
+    return false;
+  }
+
+  uint32_t length = dataBytes / (bits / 8);
+  if (length > SAMPLE_MAX_LENGTH)
+  {
+    fprintf(stderr, "%s: longer than %u frames, cut short\n", path, SAMPLE_MAX_LENGTH);
+    length = SAMPLE_MAX_LENGTH;
+  }
+  if (length < 2)
+  {
+    fprintf(stderr, "%s: no audio\n", path);
+    munmap(mapping, size);
+    return false;
+  }
+
+  if (rootHz <= 0)
+  {
+    rootHz = unityNote >= 0 ? 440.0 * pow(2.0, (unityNote - 69) / 12.0) : 440.0;
+  }
+  sample->name = path;
+  sample->data = data;
+  sample->format = bits == 8 ? SAMPLE_U8 : SAMPLE_S16;
+  sample->length = length;
+  sample->loopStart = 0;
+  sample->loopEnd = 0;
+  sample->pitchScale = samplePitchScale(rate, rootHz);
+  if (loop != nullptr)
+  {
+    // smpl loop ends are inclusive, as loopEnd is
+    uint32_t start = readLE(loop + 8, 4);
+    uint32_t end = readLE(loop + 12, 4);
+    end = end < length ? end : length - 1;
+    if (start < end)
+    {
+      sample->loopStart = start;
+      sample->loopEnd = end;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,1937 @@
+// Host-native benchmark for the audio engine.
+// Build and run with: pio run -e native && .pio/build/native/program [sample.wav]
+// A mono WAV file given on the command line joins the sampler benchmark.
+// Every section checks what it measures and exits non-zero if any check fails.
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <complex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+#include "Audio_engine.hpp"
+#include "Voice_allocator.hpp"
+#include "Note_processing.hpp"
+#include "Mock_matrix.hpp"
+#include "Knob_decoder.hpp"
+#include "Joystick.hpp"
+#include "Sample_file.hpp"
+
+constexpr size_t BENCH_SAMPLES = 22050 * 20;
+// Every bench voice sustains at full level after a 3 ms attack
+VoiceEnvelopes benchEnvelopes(22050);
+// Off unless a benchmark turns it on
+DelayEffects delayEffects(22050);
+// Started again by the benchmark that uses it
+RenderBudget renderBudget(22050, AUDIO_BLOCK_SIZE);
+// Keeps the optimiser from discarding rendered blocks
+volatile uint32_t benchSink = 0;
+// Checks that failed, for the exit status
+int benchFailures = 0;
+// State Note_processing reads, normally owned by main.cpp
+VoiceAllocator voiceAllocator;
+volatile int effect{0}, subEffect{0}, octaveMode{0};
+const char *notes[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+const char *keys[12] = {};
+
+// Counts a check that did not hold, saying which
+void benchCheck(bool passed, const char *what)
+{
+  if (!passed)
+  {
+    printf("FAILED: %s\n", what);
+    benchFailures++;
+  }
+}
+
+// Step sizes for a spread of notes, C2 upwards
+uint32_t benchStepSize(int voice)
+{
+  static uint32_t table[NOTE_COUNT] = {};
+  if (table[0] == 0)
+  {
+    for (int note = 0; note < NOTE_COUNT; note++)
+    {
+      table[note] = (uint32_t)((pow(2, 32) * 65.41 * pow(2.0, note / 12.0)) / 22050);
+    }
+  }
+  return table[voice % NOTE_COUNT];
+}
+
+// Fills a frame with voices in consecutive slots, as new notes so their
+// envelopes start again
+void fillFrame(VoiceFrame *frame, int voices)
+{
+  static uint8_t generation = 0;
+  generation++;
+  frame->count = 0;
+  for (int v = 0; v < voices; v++)
+  {
+    frame->slot[v] = v;
+    frame->stepSize[v] = benchStepSize(v);
+    frame->generation[v] = generation;
+    frame->held[v] = true;
+    frame->count++;
+  }
+}
+
+void benchRenderBlock()
+{
+  const char *waves[4] = {"Saw", "Square", "Triangle", "Sine"};
+  const int voiceCounts[] = {1, 4, 12, 24, 36};
+  VoiceFrame frame;
+  uint32_t block[AUDIO_BLOCK_SIZE];
+
+  printf("renderBlock (block size %zu)\n", AUDIO_BLOCK_SIZE);
+  printf("%-10s %8s %16s %12s\n", "wave", "voices", "samples/s", "x realtime");
+  for (int wave = 0; wave < 4; wave++)
+  {
+    for (int voices : voiceCounts)
+    {
+      fillFrame(&frame, voices);
+
+      auto start = std::chrono::steady_clock::now();
+      for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+      {
+        renderBlock(block, AUDIO_BLOCK_SIZE, frame, benchEnvelopes, wave, 6);
+        benchSink = block[0];
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      double rate = BENCH_SAMPLES / seconds;
+      printf("%-10s %8d %16.0f %12.1f\n", waves[wave], voices, rate, rate / 22050);
+      benchCheck(rate >= 22050, "renderBlock slower than real time");
+    }
+  }
+}
+
+// The linked list the voice pool replaced, kept here as the comparison baseline
+struct LegacyNode
+{
+  uint32_t data = 0;
+  LegacyNode *next = nullptr;
+};
+
+// Compares the old heap linked list (rebuilt every scan, walked per sample)
+// against the contiguous VoiceFrame layout using the saw kernel
+void benchVoiceLayout()
+{
+  const int voiceCounts[] = {1, 4, 12, 24, 36};
+  const int scans = 20000;
+
+  printf("\nvoice layout: list vs frame\n");
+  printf("%8s %14s %14s %14s %14s\n", "voices", "list build ns", "frame build ns", "list Msmp/s", "frame Msmp/s");
+  for (int voices : voiceCounts)
+  {
+    // Scan task cost: build (and for the list, free) the voice set
+    std::vector<void *> fragments;
+    auto start = std::chrono::steady_clock::now();
+    LegacyNode *head = nullptr;
+    for (int scan = 0; scan < scans; scan++)
+    {
+      while (head != nullptr)
+      {
+        LegacyNode *next = head->next;
+        delete head;
+        head = next;
+      }
+      LegacyNode *tail = nullptr;
+      for (int v = 0; v < voices; v++)
+      {
+        LegacyNode *node = new LegacyNode;
+        node->data = benchStepSize(v);
+        (tail ? tail->next : head) = node;
+        tail = node;
+        // Other tasks allocate in between, so nodes end up scattered
+        if (scan == scans - 1)
+        {
+          fragments.push_back(operator new(48));
+        }
+      }
+    }
+    double listBuild = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+
+    VoicePool pool;
+    start = std::chrono::steady_clock::now();
+    for (int scan = 0; scan < scans; scan++)
+    {
+      fillFrame(pool.beginFrame(), voices);
+      pool.publish();
+    }
+    double frameBuild = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+
+    // Audio cost: walk the voices once per sample
+    start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < BENCH_SAMPLES; s++)
+    {
+      int32_t sample = 0;
+      int i = 0;
+      for (LegacyNode *current = head; current != nullptr; current = current->next)
+      {
+        phaseAccs[i] += current->data;
+        sample += (int32_t)(phaseAccs[i] >> 24) - 128;
+        i += 1;
+      }
+      benchSink = sample / i;
+    }
+    double listRate = BENCH_SAMPLES / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t block[AUDIO_BLOCK_SIZE];
+    const VoiceFrame &frame = pool.acquire();
+    start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+    {
+      renderBlock(block, AUDIO_BLOCK_SIZE, frame, benchEnvelopes, 0, 8);
+      benchSink = block[0];
+    }
+    double frameRate = BENCH_SAMPLES / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%8d %14.1f %14.1f %14.2f %14.2f\n", voices, listBuild, frameBuild, listRate / 1e6, frameRate / 1e6);
+    benchCheck(frameRate >= 22050, "voice frame rendered slower than real time");
+
+    while (head != nullptr)
+    {
+      LegacyNode *next = head->next;
+      delete head;
+      head = next;
+    }
+    for (void *fragment : fragments)
+    {
+      operator delete(fragment);
+    }
+  }
+}
+
+// Holds notes scan to scan + count - 1, from those held the scan before: the
+// lowest goes off and a new one comes on
+void slideNotes(VoiceAllocator *allocator, uint8_t source, int scan, int count)
+{
+  if (scan == 0)
+  {
+    for (int n = 0; n < count; n++)
+    {
+      allocator->noteOn(makeNoteId(source, n % NOTE_COUNT), benchStepSize(n));
+    }
+    return;
+  }
+  int gone = (scan - 1) % NOTE_COUNT;
+  int added = (scan + count - 1) % NOTE_COUNT;
+  allocator->noteOff(makeNoteId(source, gone));
+  allocator->noteOn(makeNoteId(source, added), benchStepSize(added));
+}
+
+// Scan cost of the voice allocator and how often held notes change slot.
+// Nothing renders here, so released voices never finish their release and
+// the allocator works with every slot in use once enough notes have churned
+void benchVoiceAllocator()
+{
+  const int voiceCounts[] = {1, 4, 12, 24, 36};
+  const int scans = 20000;
+  VoiceFrame frame;
+  VoiceEnvelopes envelopes(22050);
+
+  printf("\nvoice allocator (ns per scan)\n");
+  printf("%8s %10s %10s %14s %14s\n", "voices", "steady", "churn", "steal (cap 8)", "slot moves");
+  for (int voices : voiceCounts)
+  {
+    // Same notes held every scan, so only the first scan has any events
+    VoiceAllocator steady;
+    auto start = std::chrono::steady_clock::now();
+    for (int scan = 0; scan < scans; scan++)
+    {
+      steady.beginScan();
+      for (int v = 0; v < (scan == 0 ? voices : 0); v++)
+      {
+        steady.noteOn(makeNoteId(NOTE_SOURCE_LOCAL, v), benchStepSize(v));
+      }
+      steady.endScan(&frame, envelopes);
+    }
+    double steadyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+
+    // One note replaced every scan, counting held notes that lose their slot
+    VoiceAllocator churn;
+    uint8_t lastSlot[NOTE_ID_COUNT];
+    memset(lastSlot, VoiceAllocator::NO_SLOT, sizeof(lastSlot));
+    int slotMoves = 0;
+    start = std::chrono::steady_clock::now();
+    int moving = -1;
+    for (int scan = 0; scan < scans; scan++)
+    {
+      churn.beginScan();
+      for (int v = 0; v < (scan == 0 ? voices - 1 : 0); v++)
+      {
+        churn.noteOn(makeNoteId(NOTE_SOURCE_CAN0, v), benchStepSize(v));
+      }
+      if (moving >= 0)
+      {
+        churn.noteOff(makeNoteId(NOTE_SOURCE_CAN0, moving));
+      }
+      moving = voices - 1 + scan % (NOTE_COUNT - voices + 1);
+      churn.noteOn(makeNoteId(NOTE_SOURCE_CAN0, moving), benchStepSize(moving));
+      churn.endScan(&frame, envelopes);
+      for (int v = 0; v < voices - 1; v++)
+      {
+        NoteId id = makeNoteId(NOTE_SOURCE_CAN0, v);
+        slotMoves += lastSlot[id] != VoiceAllocator::NO_SLOT && lastSlot[id] != churn.slotOf(id);
+        lastSlot[id] = churn.slotOf(id);
+      }
+    }
+    double churnNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+
+    // More notes than the cap, each scan pressing a new one
+    VoiceAllocator steal;
+    steal.setPolyphony(8);
+    start = std::chrono::steady_clock::now();
+    for (int scan = 0; scan < scans; scan++)
+    {
+      steal.beginScan();
+      slideNotes(&steal, NOTE_SOURCE_CAN1, scan, voices);
+      steal.endScan(&frame, envelopes);
+    }
+    double stealNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+
+    printf("%8d %10.1f %10.1f %14.1f %14d\n", voices, steadyNs, churnNs, stealNs, slotMoves);
+    benchCheck(slotMoves == 0, "voice allocator moved a held note");
+  }
+}
+
+// The key scan's note path as scanKeysTask runs it every 20 ms, after the
+// matrix has been read: gathering the inputs, passing the notes that changed
+// to the voices and publishing the frame if the voices changed. Keys are held
+// steadily, or one more key goes down and up again on alternate scans
+void benchScanTask()
+{
+  const int keyCounts[] = {0, 1, 12};
+  const int scans = 200000;
+  VoiceEnvelopes envelopes(22050);
+
+  printf("\nkey scan note path (ns per scan)\n");
+  printf("%6s %10s %10s %10s %12s\n", "keys", "held", "published", "changing", "published");
+  for (int keyCount : keyCounts)
+  {
+    const uint16_t held = (1 << keyCount) - 1;
+    double ns[2];
+    int published[2];
+    for (int changing = 0; changing < 2; changing++)
+    {
+      VoicePool pool;
+      VoiceAllocator allocator;
+      NoteTracker tracker(allocator);
+      const uint16_t toggled = 1 << (keyCount < 12 ? keyCount : 11);
+      published[changing] = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int scan = 0; scan < scans; scan++)
+      {
+        KeyInputs inputs;
+        inputs.voicing = &currentVoicing();
+        inputs.keys[NOTE_SOURCE_LOCAL] = changing && (scan & 1) ? held ^ toggled : held;
+        inputs.octaves[NOTE_SOURCE_LOCAL] = 4;
+        allocator.beginScan();
+        tracker.update(inputs);
+        allocator.setPolyphony(MAX_VOICES);
+        if (allocator.endScan(pool.beginFrame(), envelopes))
+        {
+          pool.publish();
+          published[changing]++;
+        }
+      }
+      ns[changing] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / scans;
+    }
+    printf("%6d %10.1f %10d %10.1f %12d\n", keyCount, ns[0], published[0], ns[1], published[1]);
+    // Steady keys publish once, when they first go down; changing keys every scan
+    benchCheck(published[0] == (keyCount > 0 ? 1 : 0), "scan published a frame with the keys held");
+    benchCheck(published[1] >= scans - 1, "scan missed a frame with the keys changing");
+  }
+}
+
+// One key's contacts through a press and release: closes at contact, then
+// chatters for bounce us, toggling every 50 - 400 us and ending closed; opens
+// again at lift and chatters for bounce us ending open. A noise pattern never
+// closes for good, only flicking closed for 100 - 300 us every 3 - 10 ms
+struct BouncePattern
+{
+  const char *name;
+  uint32_t bounceUs;
+  bool noise;
+};
+
+// Contact level at time t (us) for a scripted press
+struct BounceScript
+{
+  std::vector<uint32_t> edges;
+
+  void build(const BouncePattern &pattern, uint32_t contact, uint32_t lift, uint32_t *seed)
+  {
+    auto next = [seed](uint32_t lo, uint32_t hi) {
+      *seed = *seed * 1664525u + 1013904223u;
+      return lo + (*seed >> 8) % (hi - lo + 1);
+    };
+    edges.clear();
+    if (pattern.noise)
+    {
+      for (uint32_t t = contact; t < lift; t += next(3000, 10000))
+      {
+        edges.push_back(t);
+        edges.push_back(t + next(100, 300));
+      }
+      return;
+    }
+    for (uint32_t start : {contact, lift})
+    {
+      // An odd number of edges, so each burst ends in the new state
+      edges.push_back(start);
+      uint32_t t = start;
+      while (true)
+      {
+        uint32_t open = t + next(50, 400);
+        uint32_t close = open + next(50, 400);
+        if (close > start + pattern.bounceUs)
+        {
+          break;
+        }
+        edges.push_back(open);
+        edges.push_back(close);
+        t = close;
+      }
+    }
+  }
+
+  bool closed(uint32_t t) const
+  {
+    int crossed = 0;
+    while (crossed < (int)edges.size() && edges[crossed] <= t)
+    {
+      crossed++;
+    }
+    return crossed & 1;
+  }
+
+  uint32_t settled(bool pressed) const
+  {
+    if (!pressed)
+    {
+      return edges.back();
+    }
+    for (size_t i = 1; i < edges.size(); i++)
+    {
+      if (edges[i] - edges[i - 1] > 10000)
+      {
+        return edges[i - 1];
+      }
+    }
+    return edges.back();
+  }
+};
+
+// Scripted bounce on the mock matrix, scanned as the board's timer does and
+// as the old 20 ms task did (every row, no debounce). Latency runs from the
+// first contact and from the contacts settling to the press event; spurious
+// counts events beyond one press and one release
+void benchKeyScanner()
+{
+  const BouncePattern patterns[] = {
+      {"clean", 0, false}, {"bounce 1 ms", 1000, false}, {"bounce 3 ms", 3000, false},
+      {"bounce 5 ms", 5000, false}, {"noise", 0, true}};
+  const int trials = 2000;
+  const uint32_t tickUs = 1000000 / MATRIX_TICK_HZ;
+  const uint32_t taskUs = 20000;
+
+  printf("\nkey scanner, %u Hz ticks, %d samples debounce (latency ms: mean / max)\n", MATRIX_TICK_HZ,
+         DEBOUNCE_SAMPLES);
+  printf("%12s %12s %12s %10s %14s %10s\n", "pattern", "contact", "settled", "spurious", "20 ms contact",
+         "spurious");
+  uint32_t seed = 1;
+  for (const BouncePattern &pattern : patterns)
+  {
+    double contactSum = 0, settledSum = 0, taskSum = 0;
+    double contactMax = 0, settledMax = 0, taskMax = 0;
+    int spurious = 0, taskSpurious = 0;
+    BounceScript script;
+    for (int trial = 0; trial < trials; trial++)
+    {
+      MockMatrixPins pins;
+      KeyMatrix<MockMatrixPins> matrix(pins);
+      const int key = trial % 12;
+      seed = seed * 1664525u + 1013904223u;
+      const uint32_t contact = 30000 + (seed >> 8) % taskUs;
+      const uint32_t lift = contact + 80000;
+      script.build(pattern, contact, lift, &seed);
+      const uint32_t end = lift + 40000;
+
+      matrix.start();
+      int events = 0;
+      uint32_t pressedAt = 0;
+      for (uint32_t t = tickUs; t < end; t += tickUs)
+      {
+        pins.press(key / MATRIX_COLUMNS, key % MATRIX_COLUMNS, script.closed(t));
+        matrix.tick();
+        KeyEvent event;
+        while (matrix.nextEvent(&event))
+        {
+          if (event.pressed && pressedAt == 0)
+          {
+            pressedAt = event.tick * tickUs;
+          }
+          events++;
+        }
+      }
+      spurious += events - (pattern.noise ? 0 : 2);
+
+      // The old task: one raw read every 20 ms, from a random phase
+      int changes = 0;
+      uint32_t taskPressedAt = 0;
+      bool was = false;
+      for (uint32_t t = contact - (seed >> 4) % taskUs; t < end; t += taskUs)
+      {
+        bool now = script.closed(t);
+        if (now != was)
+        {
+          changes++;
+          if (now && taskPressedAt == 0)
+          {
+            taskPressedAt = t;
+          }
+        }
+        was = now;
+      }
+      taskSpurious += changes - (pattern.noise ? 0 : 2);
+      if (pattern.noise)
+      {
+        continue;
+      }
+
+      double fromContact = (pressedAt - contact) / 1000.0;
+      double fromSettled = ((double)pressedAt - script.settled(true)) / 1000.0;
+      double taskFromContact = (taskPressedAt - contact) / 1000.0;
+      contactSum += fromContact;
+      settledSum += fromSettled;
+      taskSum += taskFromContact;
+      contactMax = std::max(contactMax, fromContact);
+      settledMax = std::max(settledMax, fromSettled);
+      taskMax = std::max(taskMax, taskFromContact);
+    }
+    if (pattern.noise)
+    {
+      printf("%12s %12s %12s %10d %14s %10d\n", pattern.name, "-", "-", spurious, "-", taskSpurious);
+      benchCheck(spurious == 0, "key scanner played a noise spike");
+      continue;
+    }
+    printf("%12s %5.1f / %4.1f %5.1f / %4.1f %10d %7.1f / %4.1f %10d\n", pattern.name, contactSum / trials,
+           contactMax, settledSum / trials, settledMax, spurious, taskSum / trials, taskMax, taskSpurious);
+    // A settled key is read every 2 ms, so it is seen within the debounce samples
+    benchCheck(spurious == 0, "key scanner played a bounce");
+    benchCheck(settledMax <= DEBOUNCE_SAMPLES * 2.0, "key press took longer than the debounce to settle");
+  }
+
+  // Interrupt side cost, with a key bouncing on every row read
+  MockMatrixPins pins;
+  KeyMatrix<MockMatrixPins> matrix(pins);
+  matrix.start();
+  const int ticks = 4000000;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < ticks; t++)
+  {
+    pins.press(0, 0, (t >> 3) & 1);
+    matrix.tick();
+    KeyEvent event;
+    while (matrix.nextEvent(&event))
+    {
+      benchSink += event.key;
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ticks;
+  printf("tick %.1f ns, %u pin writes and %u reads a tick\n", ns, pins.writes / ticks, pins.reads / ticks);
+}
+
+// Recorded quadrature sequences for one knob, as the pairs read in turn, and
+// the steps they should decode to
+struct KnobRecording
+{
+  const char *name;
+  const char *pairs;
+  int steps;
+};
+
+const KnobRecording knobRecordings[] = {
+    {"up", "013201320", 4},
+    {"down", "023102310", -4},
+    {"up, states missed", "0130120", 4},
+    {"down, states missed", "0210310", -4},
+    {"missed before moving", "03", 0},
+    {"chatter on an edge", "010101", 1},
+    {"turned back", "0132310", 0},
+    {"up, every other state", "0130303", 5},
+};
+
+// Decodes every step from a stream of snapshots, returning the steps and the
+// accelerated sum
+void decodeKnobs(KnobDecoder *decoder, uint8_t snapshot, uint32_t tick, int *steps, int *deltas)
+{
+  decoder->update(snapshot, tick);
+  KnobEvent event;
+  while (decoder->nextEvent(&event))
+  {
+    steps[event.knob] += event.steps;
+    deltas[event.knob] += event.delta;
+  }
+}
+
+// The knob decoder against recorded sequences, each on one knob with the
+// others still and then all four together, and a knob turned steadily through
+// the mock matrix read at the scan rate and once every 20 ms as the old
+// readControlsTask did
+void benchKnobDecoder()
+{
+  printf("\nknob decoder\n");
+  printf("%24s %8s %8s %8s\n", "recording", "expected", "alone", "together");
+  const int count = sizeof(knobRecordings) / sizeof(knobRecordings[0]);
+  int failures = 0;
+  for (int group = 0; group < count; group += KNOB_COUNT)
+  {
+    // Four recordings played at once, one per knob, each from pair 0 and
+    // holding its last pair once it ends
+    KnobDecoder together;
+    int togetherSteps[KNOB_COUNT] = {}, togetherDeltas[KNOB_COUNT] = {};
+    together.update(0, 0);
+    for (size_t i = 0; i < 16; i++)
+    {
+      uint8_t snapshot = 0;
+      for (int knob = 0; knob < KNOB_COUNT && group + knob < count; knob++)
+      {
+        const char *pairs = knobRecordings[group + knob].pairs;
+        const size_t n = strlen(pairs);
+        snapshot |= (pairs[i < n ? i : n - 1] - '0') << (2 * (KNOB_COUNT - 1 - knob));
+      }
+      decodeKnobs(&together, snapshot, 100 * (i + 1), togetherSteps, togetherDeltas);
+    }
+
+    // Then each alone, with the other knobs resting at 11
+    for (int knob = 0; knob < KNOB_COUNT && group + knob < count; knob++)
+    {
+      const KnobRecording &recording = knobRecordings[group + knob];
+      const int shift = 2 * (KNOB_COUNT - 1 - knob);
+      KnobDecoder decoder;
+      int steps[KNOB_COUNT] = {}, deltas[KNOB_COUNT] = {};
+      decoder.update(0xFF & ~(0x03 << shift), 0);
+      for (const char *pair = recording.pairs; *pair; pair++)
+      {
+        const uint8_t snapshot = (0xFF & ~(0x03 << shift)) | (*pair - '0') << shift;
+        decodeKnobs(&decoder, snapshot, 100 * (pair - recording.pairs + 1), steps, deltas);
+      }
+      failures += steps[knob] != recording.steps || togetherSteps[knob] != recording.steps;
+      printf("%24s %8d %8d %8d\n", recording.name, recording.steps, steps[knob], togetherSteps[knob]);
+    }
+  }
+  benchCheck(failures == 0, "knob decoder misread a recording");
+  if (failures == 0)
+  {
+    printf("all decoded as recorded\n");
+  }
+
+  // Knob 2 turned up at a steady rate for a second, two pairs per step
+  const int rates[] = {2, 10, 25, 50, 100};
+  const uint32_t tickUs = 1000000 / MATRIX_TICK_HZ;
+  const uint8_t gray[4] = {0, 1, 3, 2};
+  printf("\n%12s %10s %10s %12s %10s\n", "steps/s", "turned", "scanned", "accelerated", "20 ms");
+  for (int rate : rates)
+  {
+    MockMatrixPins pins;
+    KeyMatrix<MockMatrixPins> matrix(pins);
+    KnobDecoder decoder, old;
+    int steps[KNOB_COUNT] = {}, deltas[KNOB_COUNT] = {};
+    int oldSteps[KNOB_COUNT] = {}, oldDeltas[KNOB_COUNT] = {};
+    matrix.scan();
+    decoder.update(knobSnapshot(matrix.frame()), 0);
+    old.update(knobSnapshot(matrix.frame()), 0);
+    matrix.start();
+    const uint32_t endUs = 1000000;
+    for (uint32_t t = tickUs; t <= endUs + 100000; t += tickUs)
+    {
+      // Quarter cycles turned by t, starting at the 00 detent
+      const uint64_t quarters = (uint64_t)std::min(t, endUs) * rate * 2 / 1000000;
+      const uint8_t pair = gray[quarters & 3];
+      pins.press(KNOB_FIRST_ROW, 2, !(pair & 1));
+      pins.press(KNOB_FIRST_ROW, 3, !(pair & 2));
+      matrix.tick();
+      decodeKnobs(&decoder, knobSnapshot(matrix.frame()), matrix.ticks(), steps, deltas);
+      if (t % 20000 == 0)
+      {
+        decodeKnobs(&old, knobSnapshot(matrix.frame()), matrix.ticks(), oldSteps, oldDeltas);
+      }
+    }
+    printf("%12d %10d %10d %12d %10d\n", rate, rate, steps[2], deltas[2], oldSteps[2]);
+    benchCheck(steps[2] == rate, "knob steps lost at the scan rate");
+  }
+
+  // Cost of one snapshot with every knob moving
+  KnobDecoder decoder;
+  const int updates = 4000000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; i++)
+  {
+    decoder.update(gray[i & 3] * 0x55, i);
+    KnobEvent event;
+    while (decoder.nextEvent(&event))
+    {
+      benchSink += event.delta;
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / updates;
+  printf("%.1f ns a snapshot with all four knobs moving\n", ns);
+}
+
+// A joystick axis as the ADC sees it: the stick's level in 12-bit counts with
+// noise on every conversion and an occasional spike, as the board's supply
+// shows while the display refreshes. The hardware oversampler averages 16
+// conversions into each sample; analogRead took one, at 10 bits
+struct JoystickTrace
+{
+  const char *name;
+  // Level at time t in seconds
+  double (*level)(double t);
+  // When the stick is pushed to the end and let go, if it is
+  double push;
+  double release;
+};
+
+uint32_t joystickNoiseSeed = 1;
+
+int32_t joystickConversion(double level)
+{
+  int32_t noise = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    joystickNoiseSeed = joystickNoiseSeed * 1664525u + 1013904223u;
+    noise += (int32_t)(joystickNoiseSeed >> 24) - 128;
+  }
+  // About 15 counts rms, with one conversion in 200 off by 300
+  int32_t value = (int32_t)level + noise / 17;
+  if ((joystickNoiseSeed >> 8) % 200 == 0)
+  {
+    value += (joystickNoiseSeed & 1) ? 300 : -300;
+  }
+  return value < 0 ? 0 : (value > JOYSTICK_FULL_SCALE ? JOYSTICK_FULL_SCALE : value);
+}
+
+uint16_t joystickSample(double level)
+{
+  int32_t sum = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    sum += joystickConversion(level);
+  }
+  return sum >> 4;
+}
+
+// The stick rests 100 counts off the ADC's midpoint
+constexpr double JOYSTICK_REST = 2148;
+
+const JoystickTrace joystickTraces[] = {
+    {"rest", [](double) { return JOYSTICK_REST; }, -1, -1},
+    // Pushed to the end at 1 s over 50 ms, let go at 2 s to spring back with
+    // a damped overshoot
+    {"push and release",
+     [](double t) {
+       if (t < 1.0)
+       {
+         return JOYSTICK_REST;
+       }
+       if (t < 2.0)
+       {
+         return JOYSTICK_REST + (JOYSTICK_FULL_SCALE - JOYSTICK_REST) * std::min(1.0, (t - 1.0) / 0.05);
+       }
+       return JOYSTICK_REST + (JOYSTICK_FULL_SCALE - JOYSTICK_REST) * exp(-(t - 2.0) / 0.03) * cos((t - 2.0) * 40);
+     },
+     1.0, 2.0},
+    {"held halfway", [](double t) { return t < 1.0 ? JOYSTICK_REST : JOYSTICK_REST / 2; }, -1, -1},
+};
+
+// The joystick's filter and calibration on scripted traces at the ADC's
+// sample rate, next to analogRead once every 20 ms with its centre from a
+// single read as readControlsTask used to do. Jitter counts readings off zero
+// at rest, rise is the time from the push to 90% of full travel, settle the
+// time from letting go to reading zero again, and noise the rms of the
+// position while held, from 100 ms after the stick got there
+void benchJoystick()
+{
+  const double seconds = 3.0;
+  const int samples = (int)(seconds * JOYSTICK_SAMPLE_HZ);
+  printf("\njoystick, %u samples/s per axis (positions of %d at either end)\n", JOYSTICK_SAMPLE_HZ,
+         (int)JOYSTICK_SCALE);
+  printf("%18s %8s %8s %8s %8s %8s %12s %10s\n", "trace", "centre", "jitter", "rise ms", "settle", "noise",
+         "20 ms jitter", "noise");
+  int failures = 0;
+  for (const JoystickTrace &trace : joystickTraces)
+  {
+    Joystick joystick;
+    std::vector<uint16_t> buffer;
+    int jitter = 0, oldJitter = 0;
+    double rise = -1, settle = -1;
+    double noise = 0, oldNoise = 0, mean = 0, oldMean = 0;
+    int held = 0, oldHeld = 0;
+    int maxPosition = 0;
+
+    // The old reads, 10 bits against a centre from one read at start
+    const double oldZero = (joystickConversion(trace.level(0)) >> 2) / 1023.0;
+    for (int i = 0; i < samples; i++)
+    {
+      const double t = (double)i / JOYSTICK_SAMPLE_HZ;
+      const double level = trace.level(t);
+      const uint16_t sample = joystickSample(level);
+      buffer.push_back(sample);
+      buffer.push_back(sample);
+      // Batches as the DMA hands them over
+      if (buffer.size() == JOYSTICK_AXES * 4)
+      {
+        joystick.update(buffer.data(), 4);
+        buffer.clear();
+      }
+      const int position = joystick.position().y;
+      maxPosition = std::max(maxPosition, std::abs(position));
+      const bool resting = std::abs(level - JOYSTICK_REST) < 1;
+      if (resting && joystick.axis(JOYSTICK_Y).calibrated() && position != 0 && t < 1.0)
+      {
+        jitter++;
+      }
+      if (trace.push >= 0 && rise < 0 && t >= trace.push && position >= JOYSTICK_SCALE * 9 / 10)
+      {
+        rise = (t - trace.push) * 1000;
+      }
+      if (trace.release >= 0 && t >= trace.release && position != 0)
+      {
+        settle = (t - trace.release) * 1000;
+      }
+      if (t >= 1.1 && fabs(level - JOYSTICK_REST / 2) < 1)
+      {
+        noise += (double)position * position;
+        mean += position;
+        held++;
+      }
+
+      // analogRead every 20 ms, as a position out of the same scale
+      if (i % (JOYSTICK_SAMPLE_HZ / 50) == 0)
+      {
+        const double read = (joystickConversion(level) >> 2) / 1023.0;
+        const double offset = read - oldZero;
+        const double oldPosition = fabs(offset) > 0.05 ? offset * 2 * JOYSTICK_SCALE : 0;
+        if (resting && t < 1.0 && oldPosition != 0)
+        {
+          oldJitter++;
+        }
+        if (t >= 1.1 && fabs(level - JOYSTICK_REST / 2) < 1)
+        {
+          oldNoise += oldPosition * oldPosition;
+          oldMean += oldPosition;
+          oldHeld++;
+        }
+      }
+    }
+    const int centre = joystick.axis(JOYSTICK_Y).calibration().centre;
+    failures += std::abs(centre - (int)JOYSTICK_REST) > 2 || jitter != 0;
+    auto rms = [](double squares, double sum, int n) {
+      return n > 0 ? sqrt(std::max(0.0, squares / n - (sum / n) * (sum / n))) : 0.0;
+    };
+    char riseText[16] = "-", settleText[16] = "-";
+    if (trace.push >= 0)
+    {
+      snprintf(riseText, sizeof(riseText), "%.1f", rise);
+      snprintf(settleText, sizeof(settleText), "%.1f", settle);
+    }
+    printf("%18s %8d %8d %8s %8s %8.1f %12d %10.1f\n", trace.name, centre, jitter, riseText, settleText,
+           rms(noise, mean, held), oldJitter, rms(oldNoise, oldMean, oldHeld));
+    if (trace.push >= 0)
+    {
+      failures += maxPosition != JOYSTICK_SCALE;
+    }
+    if (held > 0)
+    {
+      benchCheck(rms(noise, mean, held) < rms(oldNoise, oldMean, oldHeld), "joystick noisier than analogRead");
+    }
+  }
+  benchCheck(failures == 0, "joystick off centre, jittering at rest or short of full travel");
+  if (failures == 0)
+  {
+    printf("centred within 2 counts, still at rest, full travel reached\n");
+  }
+
+  // Cost of one scan of both axes through the filters
+  Joystick joystick;
+  uint16_t batch[JOYSTICK_AXES * 4];
+  const int batches = 1000000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < batches; i++)
+  {
+    for (int j = 0; j < JOYSTICK_AXES * 4; j++)
+    {
+      batch[j] = 2000 + ((i * 7 + j * 13) & 255);
+    }
+    joystick.update(batch, 4);
+    benchSink += joystick.position().x;
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+              (batches * 4);
+  printf("%.1f ns a scan of both axes\n", ns);
+}
+
+// Saw render loop with fixed voice gains instead of the envelope ramps, kept as
+// the comparison baseline
+void renderBlockNoEnvelope(uint32_t *out, size_t n, const VoiceFrame &frame, int volume)
+{
+  const int count = frame.count;
+  uint32_t phases[MAX_VOICES];
+  const int16_t *tables[MAX_VOICES];
+  for (int i = 0; i < count; i++)
+  {
+    phases[i] = phaseAccs[frame.slot[i]];
+    tables[i] = sawTables.levels[mipLevel(frame.stepSize[i])];
+  }
+  const uint32_t gain = mixGain(count, volume);
+  for (size_t s = 0; s < n; s++)
+  {
+    int32_t left = 0;
+    int32_t right = 0;
+    for (int i = 0; i < count; i++)
+    {
+      phases[i] += frame.stepSize[i];
+      int32_t value = wavetableLookup<MIP_TABLE_BITS>(tables[i], phases[i]);
+      left += (value * panTable.left[frame.pan[i]]) >> 15;
+      right += (value * panTable.right[frame.pan[i]]) >> 15;
+    }
+    out[s] = stereoFrame(mixChannel(left, gain), mixChannel(right, gain));
+  }
+  for (int i = 0; i < count; i++)
+  {
+    phaseAccs[frame.slot[i]] = phases[i];
+  }
+}
+
+// The 8-bit output conversion the mixer replaced
+inline uint16_t legacyToDAC(int32_t value)
+{
+  value = value < 0 ? 0 : (value > 255 ? 255 : value);
+  return (uint16_t)(value << 4);
+}
+
+// Mixer kernel on its own, over a block of precomputed voice samples: the old
+// divide by voice count and float volume against the gain table, pan and soft clip
+void benchMixer()
+{
+  const int voiceCounts[] = {1, 4, 12, 24, 36};
+  const int blocks = 100000;
+  const int volume = 6;
+
+  static int16_t voiceSamples[MAX_VOICES][AUDIO_BLOCK_SIZE];
+  uint32_t seed = 1;
+  for (size_t v = 0; v < MAX_VOICES; v++)
+  {
+    for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+    {
+      seed = seed * 1664525 + 1013904223;
+      voiceSamples[v][s] = (int16_t)(seed >> 16);
+    }
+  }
+  uint16_t monoBlock[AUDIO_BLOCK_SIZE];
+  uint32_t block[AUDIO_BLOCK_SIZE];
+
+  printf("\nmixer kernel (ns per sample)\n");
+  printf("%8s %14s %14s %14s %16s\n", "voices", "div + float", "table mono", "table stereo", "stereo/voice-smp");
+  for (int voices : voiceCounts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+    {
+      for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+      {
+        int32_t sample = 0;
+        for (int v = 0; v < voices; v++)
+        {
+          sample += voiceSamples[v][s] >> 8;
+        }
+        // Volatile count, as the ISR read it from the shared voice list
+        sample = sample / *(volatile int *)&voices;
+        monoBlock[s] = legacyToDAC(sample * (volume / 8.0f) + 128);
+      }
+      benchSink = monoBlock[b % AUDIO_BLOCK_SIZE];
+    }
+    double legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)blocks * AUDIO_BLOCK_SIZE);
+
+    // Same output stage without the pan, to separate its cost from the stereo work
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+    {
+      const uint32_t gain = mixGain(voices, volume);
+      for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+      {
+        int32_t sample = 0;
+        for (int v = 0; v < voices; v++)
+        {
+          sample += voiceSamples[v][s];
+        }
+        monoBlock[s] = mixChannel(sample, gain);
+      }
+      benchSink = monoBlock[b % AUDIO_BLOCK_SIZE];
+    }
+    double monoNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)blocks * AUDIO_BLOCK_SIZE);
+
+    int32_t leftGains[MAX_VOICES], rightGains[MAX_VOICES];
+    for (int v = 0; v < voices; v++)
+    {
+      leftGains[v] = panTable.left[v * PAN_RIGHT / MAX_VOICES];
+      rightGains[v] = panTable.right[v * PAN_RIGHT / MAX_VOICES];
+    }
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+    {
+      const uint32_t gain = mixGain(voices, volume);
+      for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+      {
+        int32_t left = 0;
+        int32_t right = 0;
+        for (int v = 0; v < voices; v++)
+        {
+          left += (voiceSamples[v][s] * leftGains[v]) >> 15;
+          right += (voiceSamples[v][s] * rightGains[v]) >> 15;
+        }
+        block[s] = stereoFrame(mixChannel(left, gain), mixChannel(right, gain));
+      }
+      benchSink = block[b % AUDIO_BLOCK_SIZE];
+    }
+    double mixerNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)blocks * AUDIO_BLOCK_SIZE);
+
+    printf("%8d %14.2f %14.2f %14.2f %16.2f\n", voices, legacyNs, monoNs, mixerNs, mixerNs / voices);
+    benchCheck(mixerNs < 1e9 / 22050, "stereo mix slower than real time");
+  }
+}
+
+// Cost of the envelope stage per voice-sample: the saw render loop with and
+// without it, and the per block envelope update on its own
+void benchEnvelope()
+{
+  const int voiceCounts[] = {1, 4, 12, 24, 36};
+  VoiceFrame frame;
+  uint32_t block[AUDIO_BLOCK_SIZE];
+
+  printf("\nenvelope (saw, ns per voice-sample)\n");
+  printf("%8s %12s %12s %12s %14s\n", "voices", "no env", "sustain", "attack", "update/voice-blk");
+  for (int voices : voiceCounts)
+  {
+    fillFrame(&frame, voices);
+    const size_t voiceSamples = BENCH_SAMPLES * voices;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+    {
+      renderBlockNoEnvelope(block, AUDIO_BLOCK_SIZE, frame, 6);
+      benchSink = block[0];
+    }
+    double plainNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / voiceSamples;
+
+    // Sustaining voices: the gain ramp is flat but still applied
+    VoiceEnvelopes envelopes(22050);
+    fillFrame(&frame, voices);
+    start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+    {
+      renderBlock(block, AUDIO_BLOCK_SIZE, frame, envelopes, 0, 6);
+      benchSink = block[0];
+    }
+    double sustainNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / voiceSamples;
+
+    // Voices retriggered before their 2 s attack ends, so every block walks the curve
+    VoiceEnvelopes slow(22050);
+    slow.setShape(ENVELOPE_STEPS - 1, 0, ENVELOPE_STEPS - 1, 0);
+    fillFrame(&frame, voices);
+    start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+    {
+      if ((s / AUDIO_BLOCK_SIZE) % 256 == 0)
+      {
+        for (int v = 0; v < voices; v++)
+        {
+          frame.generation[v]++;
+        }
+      }
+      renderBlock(block, AUDIO_BLOCK_SIZE, frame, slow, 0, 6);
+      benchSink = block[0];
+    }
+    double attackNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / voiceSamples;
+
+    const int blocks = 200000;
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+    {
+      if (b % 256 == 0)
+      {
+        for (int v = 0; v < voices; v++)
+        {
+          slow.trigger(v, b / 256);
+        }
+      }
+      for (int v = 0; v < voices; v++)
+      {
+        benchSink = slow.advance(v, true, AUDIO_BLOCK_SIZE);
+      }
+    }
+    double updateNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)blocks * voices);
+
+    printf("%8d %12.2f %12.2f %12.2f %14.2f\n", voices, plainNs, sustainNs, attackNs, updateNs);
+    benchCheck(attackNs * voices < 1e9 / 22050, "envelopes slower than real time");
+  }
+}
+
+// The float sine table the Q15 oscillator replaced, kept as the comparison baseline
+float legacySinTable[1028];
+
+int32_t legacySine(uint32_t phase)
+{
+  int index = 1027 * ((float)phase / (float)UINT32_MAX);
+  return (int32_t)legacySinTable[index];
+}
+
+uint64_t benchCycles()
+{
+#ifdef BENCH_HAS_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// THD+N of an oscillator against an ideal sine, from whole cycles of output
+template <typename Oscillator>
+double sineThdN(Oscillator oscillator, double amplitude)
+{
+  const int length = 1 << 14;
+  const int cycles = 373; // Prime, so every phase is visited
+  const uint32_t step = (uint32_t)(((uint64_t)cycles << 32) / length);
+  double signal = 0, error = 0;
+  uint32_t phase = 0;
+  for (int s = 0; s < length; s++)
+  {
+    double ideal = amplitude * sin(2.0 * M_PI * (double)phase / 4294967296.0);
+    double diff = oscillator(phase) - ideal;
+    signal += ideal * ideal;
+    error += diff * diff;
+    phase += step;
+  }
+  return 10 * log10(error / signal);
+}
+
+// Accuracy and per voice-sample cost of the float table against the Q15 oscillator
+void benchSineOscillator()
+{
+  // This fill used to run in setup()
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 1028; i++)
+  {
+    legacySinTable[i] = 127 * sin((float)i / (float)1028 * 2.0 * M_PI);
+  }
+  double bootUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  size_t bankBytes = sizeof(sineTable) + (WAVE_COUNT - 1) * sizeof(MipWavetable);
+  printf("\nwavetable bank: %zu waves, %zu bytes const (flash, budget %zu), 0 bytes RAM\n", WAVE_COUNT, bankBytes,
+         WAVETABLE_FLASH_BUDGET);
+  printf("replaced runtime sinTable: %zu bytes RAM, %.1f us boot fill on host\n", sizeof(legacySinTable), bootUs);
+  benchCheck(bankBytes <= WAVETABLE_FLASH_BUDGET, "wavetable bank over its flash budget");
+
+  printf("\nsine oscillator\n");
+  printf("%-22s %12s %12s %14s\n", "", "THD+N dB", "ns/voice-smp", "cycles/voice-smp");
+
+  const int voices = 12;
+  const size_t samples = 22050 * 100;
+  uint32_t phases[voices] = {};
+  for (int pass = 0; pass < 2; pass++)
+  {
+    auto passStart = std::chrono::steady_clock::now();
+    uint64_t startCycles = benchCycles();
+    for (size_t s = 0; s < samples; s++)
+    {
+      int32_t sample = 0;
+      for (int v = 0; v < voices; v++)
+      {
+        phases[v] += benchStepSize(24 + v);
+        sample += pass == 0 ? legacySine(phases[v]) : wavetableLookup(sineTable.samples, phases[v]);
+      }
+      benchSink = sample;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - passStart).count() / (samples * voices);
+    double cycles = (double)(benchCycles() - startCycles) / (samples * voices);
+    double thd = pass == 0 ? sineThdN(legacySine, 127) : sineThdN([](uint32_t phase) { return wavetableLookup(sineTable.samples, phase); }, 32767);
+    printf("%-22s %12.1f %12.2f %14.2f\n", pass == 0 ? "float table (1028)" : "Q15 interpolated", thd, ns, cycles);
+    if (pass == 1)
+    {
+      benchCheck(thd <= -80, "Q15 sine distortion above -80 dB");
+    }
+  }
+}
+
+// In-place radix-2 FFT
+void fft(std::vector<std::complex<double>> &x)
+{
+  const size_t n = x.size();
+  for (size_t i = 1, j = 0; i < n; i++)
+  {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j)
+    {
+      std::swap(x[i], x[j]);
+    }
+  }
+  for (size_t len = 2; len <= n; len <<= 1)
+  {
+    std::complex<double> w = std::polar(1.0, -2 * M_PI / len);
+    for (size_t i = 0; i < n; i += len)
+    {
+      std::complex<double> wk = 1;
+      for (size_t k = 0; k < len / 2; k++)
+      {
+        std::complex<double> a = x[i + k], b = x[i + k + len / 2] * wk;
+        x[i + k] = a + b;
+        x[i + k + len / 2] = a - b;
+        wk *= w;
+      }
+    }
+  }
+}
+
+// Share of output energy that is not a harmonic below Nyquist, in dB
+template <typename Oscillator>
+double aliasingDb(Oscillator oscillator, int cycles)
+{
+  const size_t length = 1 << 14;
+  const uint32_t step = (uint32_t)(((uint64_t)cycles << 32) / length);
+  std::vector<std::complex<double>> x(length);
+  uint32_t phase = 0;
+  for (size_t s = 0; s < length; s++)
+  {
+    x[s] = oscillator(phase, step);
+    phase += step;
+  }
+  fft(x);
+  double harmonic = 0, alias = 0;
+  for (size_t bin = 1; bin < length / 2; bin++)
+  {
+    double power = std::norm(x[bin]);
+    (bin % cycles == 0 ? harmonic : alias) += power;
+  }
+  return 10 * log10(alias / (harmonic + alias));
+}
+
+int32_t naiveSaw(uint32_t phase, uint32_t) { return (int32_t)(phase >> 24) - 128; }
+int32_t naiveSquare(uint32_t phase, uint32_t) { return phase < UINT32_MAX / 2 ? 63 : -64; }
+int32_t mipSaw(uint32_t phase, uint32_t step) { return wavetableLookup<MIP_TABLE_BITS>(sawTables.levels[mipLevel(step)], phase); }
+int32_t mipSquare(uint32_t phase, uint32_t step) { return wavetableLookup<MIP_TABLE_BITS>(squareTables.levels[mipLevel(step)], phase); }
+
+// Aliasing and per voice-sample cost of the naive and band-limited oscillators
+void benchBandLimited()
+{
+  // Cycles per 16384 samples: ~220 Hz, ~1.8 kHz, ~3.7 kHz and ~7.3 kHz
+  const int cycles[] = {163, 1361, 2731, 5449};
+  printf("\nband-limited oscillators: aliasing dB at");
+  for (int c : cycles)
+  {
+    printf(" %.0fHz", c * 22050.0 / 16384);
+  }
+  printf(", ns per voice-sample (12 voices)\n");
+
+  struct
+  {
+    const char *name;
+    int32_t (*oscillator)(uint32_t, uint32_t);
+    bool bandLimited;
+  } oscillators[] = {{"naive saw", naiveSaw, false},
+                     {"mip saw", mipSaw, true},
+                     {"naive square", naiveSquare, false},
+                     {"mip square", mipSquare, true}};
+
+  const int voices = 12;
+  const size_t samples = 22050 * 100;
+  for (auto &osc : oscillators)
+  {
+    printf("%-14s", osc.name);
+    for (int c : cycles)
+    {
+      const double aliasing = aliasingDb(osc.oscillator, c);
+      printf(" %8.1f", aliasing);
+      if (osc.bandLimited)
+      {
+        benchCheck(aliasing < -60, "band-limited oscillator aliasing above -60 dB");
+      }
+    }
+
+    uint32_t phases[voices] = {};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < samples; s += AUDIO_BLOCK_SIZE)
+    {
+      for (int v = 0; v < voices; v++)
+      {
+        uint32_t step = benchStepSize(36 + v * 3);
+        int32_t sample = 0;
+        for (size_t b = 0; b < AUDIO_BLOCK_SIZE; b++)
+        {
+          phases[v] += step;
+          sample += osc.oscillator(phases[v], step);
+        }
+        benchSink = sample;
+      }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (samples * voices);
+    printf(" %10.2f\n", ns);
+  }
+}
+
+// Ideal response of the analogue prototype the filter is derived from, at the
+// prewarped frequency, so it is what the bilinear transform should give exactly
+double idealFilterDb(FilterType type, double frequency, int cutoff, int resonance)
+{
+  double x = tan(M_PI * frequency) / filterCutoffTable.gain[cutoff];
+  double k = filterResonanceTable.damping[resonance];
+  double denominator = sqrt((1 - x * x) * (1 - x * x) + k * k * x * x);
+  double numerator = type == FILTER_LOW_PASS ? 1 : (type == FILTER_BAND_PASS ? k * x : x * x);
+  return 20 * log10(numerator / denominator);
+}
+
+// Gain of the filter for a sine at a frequency (fraction of the sample rate),
+// measured after it has settled
+double measuredFilterDb(FilterType type, double frequency, int cutoff, int resonance)
+{
+  StereoFilter filter;
+  filter.set(type, cutoff, resonance);
+  const double amplitude = 16384;
+  const size_t settle = 22050;
+  const size_t measure = 22050;
+  int32_t left[AUDIO_BLOCK_SIZE], right[AUDIO_BLOCK_SIZE];
+  double in = 0, out = 0;
+  for (size_t start = 0; start < settle + measure; start += AUDIO_BLOCK_SIZE)
+  {
+    double inputs[AUDIO_BLOCK_SIZE];
+    for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+    {
+      inputs[s] = amplitude * sin(2 * M_PI * frequency * (start + s));
+      left[s] = right[s] = (int32_t)lrint(inputs[s]);
+    }
+    filter.process(left, right, AUDIO_BLOCK_SIZE);
+    if (start >= settle)
+    {
+      for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+      {
+        in += inputs[s] * inputs[s];
+        out += (double)left[s] * left[s];
+      }
+    }
+  }
+  return 10 * log10(out / in);
+}
+
+// Frequency response of each filter type against the ideal, and the cost per
+// stereo sample of running it on a block
+void benchFilter()
+{
+  const FilterType types[] = {FILTER_LOW_PASS, FILTER_BAND_PASS, FILTER_HIGH_PASS};
+  // Highest cutoff step up to 1 kHz, and octaves around it
+  int cutoff = 0;
+  while (cutoff < FILTER_CUTOFF_STEPS - 1 && filterCutoffHz(cutoff + 1, 22050) <= 1000)
+  {
+    cutoff++;
+  }
+  const double octaves[] = {-3, -1, -0.5, 0, 0.5, 1, 3};
+  const double fc = filterCutoffTable.ratio[cutoff];
+
+  printf("\nstate-variable filter response, cutoff %u Hz: measured dB (error against ideal)\n",
+         filterCutoffHz(cutoff, 22050));
+  printf("%-14s", "");
+  for (double octave : octaves)
+  {
+    printf(" %12.0f", fc * pow(2, octave) * 22050);
+  }
+  printf(" %10s\n", "max error");
+  for (FilterType type : types)
+  {
+    for (int resonance : {0, 4, FILTER_RESONANCE_STEPS - 1})
+    {
+      char label[32];
+      snprintf(label, sizeof(label), "%s res %d", filterTypeNames[type], resonance);
+      printf("%-14s", label);
+      double worst = 0;
+      for (double octave : octaves)
+      {
+        double frequency = fc * pow(2, octave);
+        double measured = measuredFilterDb(type, frequency, cutoff, resonance);
+        double error = measured - idealFilterDb(type, frequency, cutoff, resonance);
+        worst = fabs(error) > fabs(worst) ? error : worst;
+        printf(" %6.1f(%+4.2f)", measured, error);
+      }
+      printf(" %+10.3f\n", worst);
+      benchCheck(fabs(worst) <= 0.05, "filter response more than 0.05 dB off ideal");
+    }
+  }
+
+  // Lowest and highest cutoffs, where fixed point precision and prewarping matter most
+  printf("%-14s", "edge cutoffs");
+  for (int step : {0, FILTER_CUTOFF_STEPS - 1})
+  {
+    double frequency = filterCutoffTable.ratio[step];
+    double error = measuredFilterDb(FILTER_LOW_PASS, frequency, step, 0) -
+                   idealFilterDb(FILTER_LOW_PASS, frequency, step, 0);
+    printf("  low pass at %u Hz %+5.2f dB", filterCutoffHz(step, 22050), error);
+    benchCheck(fabs(error) <= 0.1, "filter more than 0.1 dB off ideal at an edge cutoff");
+  }
+  printf("\n");
+
+  printf("\nfilter cost per stereo sample (blocks of %zu)\n", AUDIO_BLOCK_SIZE);
+  printf("%-10s %12s %14s\n", "", "ns/sample", "cycles/sample");
+  const int blocks = 200000;
+  int32_t left[AUDIO_BLOCK_SIZE], right[AUDIO_BLOCK_SIZE];
+  for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+  {
+    left[s] = right[s] = (int32_t)(s * 997 % 65536) - 32768;
+  }
+  for (int type = FILTER_OFF; type < FILTER_TYPE_COUNT; type++)
+  {
+    StereoFilter filter;
+    filter.set(type, cutoff, 4);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startCycles = benchCycles();
+    for (int b = 0; b < blocks; b++)
+    {
+      filter.process(left, right, AUDIO_BLOCK_SIZE);
+      benchSink = left[0];
+      // Fresh input so the state does not settle to a constant
+      left[b % AUDIO_BLOCK_SIZE] ^= 0x1234;
+    }
+    double samples = (double)blocks * AUDIO_BLOCK_SIZE;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+    double cycles = (double)(benchCycles() - startCycles) / samples;
+    printf("%-10s %12.2f %14.2f\n", filterTypeNames[type], ns, cycles);
+  }
+}
+
+// Echo times found from an impulse against the tempo, and the cost per
+// stereo sample of each effect
+void benchDelay()
+{
+  static DelayEffects delay(22050);
+  printf("\ndelay line: %zu samples of %zu bits, %zu bytes RAM (budget %zu), longest echo %.0f ms\n", DELAY_LENGTH,
+         8 * sizeof(DelaySample), sizeof(delay), DELAY_RAM_BUDGET, 1000.0 * (DELAY_LENGTH - 1) / 22050);
+
+  printf("%-10s %6s %14s %14s %12s\n", "echo", "bpm", "expected smp", "measured smp", "echo level");
+  int32_t left[AUDIO_BLOCK_SIZE], right[AUDIO_BLOCK_SIZE];
+  for (int bpm : {120, 150})
+  {
+    for (int preset = 0; preset < ECHO_PRESET_COUNT; preset++)
+    {
+      // Off first so the line starts empty
+      delay.set(DELAY_OFF, 0, bpm);
+      delay.process(left, right, 0);
+      delay.set(DELAY_ECHO, preset, bpm);
+      double exact = echoPresets[preset].beats * 60.0 * 22050 / bpm;
+      long expected = lround(exact < DELAY_LENGTH - 1 ? exact : DELAY_LENGTH - 1);
+      long found = -1;
+      int32_t level = 0;
+      for (long start = 0; start < (long)DELAY_LENGTH && found < 0; start += AUDIO_BLOCK_SIZE)
+      {
+        for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+        {
+          left[s] = right[s] = start + s == 0 ? 16384 : 0;
+        }
+        delay.process(left, right, AUDIO_BLOCK_SIZE);
+        for (size_t s = 0; s < AUDIO_BLOCK_SIZE && found < 0; s++)
+        {
+          if (start + s > 0 && left[s] != 0)
+          {
+            found = start + s;
+            level = left[s];
+          }
+        }
+      }
+      printf("%-10s %6d %14ld %14ld %11.2f\n", echoPresets[preset].name, bpm, expected, found, level / 16384.0);
+      benchCheck(found == expected, "echo not at the preset's time");
+      benchCheck(exact < DELAY_LENGTH - 1, "echo preset longer than the delay line");
+    }
+  }
+
+  printf("%-10s %12s %14s\n", "", "ns/sample", "cycles/sample");
+  const int blocks = 200000;
+  for (int preset = 0; preset <= CHORUS_PRESET_COUNT; preset++)
+  {
+    int mode = preset == 0 ? DELAY_ECHO : DELAY_CHORUS;
+    int presetIndex = preset == 0 ? 1 : preset - 1;
+    delay.set(mode, presetIndex, 120);
+    for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s++)
+    {
+      left[s] = right[s] = (int32_t)(s * 997 % 65536) - 32768;
+    }
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startCycles = benchCycles();
+    for (int b = 0; b < blocks; b++)
+    {
+      delay.process(left, right, AUDIO_BLOCK_SIZE);
+      benchSink = left[0];
+      // Keeps the input from running away with the added echoes
+      for (size_t s = 0; s < AUDIO_BLOCK_SIZE; s += 16)
+      {
+        left[s] >>= 1;
+        right[s] >>= 1;
+      }
+    }
+    double samples = (double)blocks * AUDIO_BLOCK_SIZE;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+    double cycles = (double)(benchCycles() - startCycles) / samples;
+    printf("%-10s %12.2f %14.2f\n", preset == 0 ? "Echo" : chorusPresets[presetIndex].name, ns, cycles);
+  }
+}
+
+// Packed unison kernel against the scalar one: output difference and speed
+void benchUnison()
+{
+  printf("\nunison kernel, 12 saw voices (ns per voice-sample)\n");
+  printf("%-10s %10s %10s %10s %12s\n", "preset", "scalar", "packed", "speedup", "max diff");
+  const int voices = 12;
+  const size_t samples = 22050 * 20;
+  for (int preset = 0; preset < UNISON_PRESET_COUNT; preset++)
+  {
+    Unison unison;
+    unison.set(preset);
+    int sides = unison.update();
+    int32_t steps[voices][UNISON_MAX_SIDES];
+    uint32_t increments[voices];
+    const int16_t *tables[voices];
+    for (int v = 0; v < voices; v++)
+    {
+      increments[v] = benchStepSize(24 + 3 * v);
+      unison.detuneSteps(increments[v], steps[v]);
+      tables[v] = sawTables.levels[mipLevel(increments[v])];
+    }
+
+    double ns[2];
+    std::vector<int32_t> output[2];
+    for (int packed = 0; packed < 2; packed++)
+    {
+      uint32_t phases[voices] = {};
+      uint32_t sidePhases[voices][UNISON_MAX_SIDES];
+      for (int v = 0; v < voices; v++)
+      {
+        for (int o = 0; o < UNISON_MAX_SIDES; o++)
+        {
+          sidePhases[v][o] = (o + 1) * 0x9E3779B9u;
+        }
+      }
+      output[packed].reserve(samples);
+      auto start = std::chrono::steady_clock::now();
+      for (size_t s = 0; s < samples; s++)
+      {
+        int32_t sum = 0;
+        for (int v = 0; v < voices; v++)
+        {
+          phases[v] += increments[v];
+          sum += packed ? unisonSample<MIP_TABLE_BITS, true>(tables[v], phases[v], increments[v], sidePhases[v],
+                                                              steps[v], sides, unison.centreGain(),
+                                                              unison.sideGains())
+                        : unisonSample<MIP_TABLE_BITS, false>(tables[v], phases[v], increments[v], sidePhases[v],
+                                                               steps[v], sides, unison.centreGain(),
+                                                               unison.sideGains());
+        }
+        output[packed].push_back(sum);
+      }
+      ns[packed] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                   ((double)samples * voices);
+    }
+
+    // The packed read interpolates with a 14-bit fraction instead of 15
+    int32_t maxDiff = 0;
+    for (size_t s = 0; s < samples; s++)
+    {
+      int32_t diff = abs(output[1][s] - output[0][s]);
+      maxDiff = diff > maxDiff ? diff : maxDiff;
+    }
+    printf("%-10s %10.2f %10.2f %9.2fx %12d\n", unisonPresets[preset].name, ns[0], ns[1], ns[0] / ns[1], maxDiff);
+    benchCheck(maxDiff <= 4, "packed unison kernel off the scalar one");
+  }
+#if !defined(__ARM_FEATURE_DSP)
+  printf("(host build: packed kernel uses the portable smlad, not the M4 instructions)\n");
+#endif
+}
+
+// Little-endian field for a WAV file built in memory
+void appendLE(std::vector<uint8_t> *bytes, uint32_t value, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    bytes->push_back((value >> (8 * i)) & 0xFF);
+  }
+}
+
+// A 16-bit sine WAV whose smpl chunk loops exactly four cycles, starting on a
+// peak and followed by silence, mapped as a file would be and played through
+// the join at a step that never lands on a whole frame. The largest change
+// between output samples must stay within the sine's own slope
+void benchSampleLoop()
+{
+  const uint32_t period = 100, loopStart = 1000, loopEnd = loopStart + 4 * period - 1, frames = 1600;
+  const double amplitude = 16000;
+  std::vector<uint8_t> wav;
+  auto chunk = [&wav](const char *id, uint32_t length) {
+    wav.insert(wav.end(), id, id + 4);
+    appendLE(&wav, length, 4);
+  };
+  chunk("RIFF", 4 + 8 + 16 + 8 + 60 + 8 + frames * 2);
+  wav.insert(wav.end(), {'W', 'A', 'V', 'E'});
+  chunk("fmt ", 16);
+  for (uint32_t field : {1, 1})
+  {
+    appendLE(&wav, field, 2);
+  }
+  appendLE(&wav, 22050, 4);
+  appendLE(&wav, 22050 * 2, 4);
+  appendLE(&wav, 2, 2);
+  appendLE(&wav, 16, 2);
+  // One loop, inclusive of its end frame, root note A4
+  chunk("smpl", 60);
+  for (uint32_t field : {0u, 0u, 0u, 69u, 0u, 0u, 0u, 1u, 0u, 0u, 0u, loopStart, loopEnd, 0u, 0u})
+  {
+    appendLE(&wav, field, 4);
+  }
+  chunk("data", frames * 2);
+  for (uint32_t i = 0; i < frames; i++)
+  {
+    double value = i <= loopEnd ? amplitude * cos(2 * M_PI * i / period) : 0;
+    appendLE(&wav, (uint16_t)(int16_t)lrint(value), 2);
+  }
+
+  char path[] = "/tmp/engine_bench_loopXXXXXX";
+  int fd = mkstemp(path);
+  Sample sample;
+  bool mapped = fd >= 0 && write(fd, wav.data(), wav.size()) == (ssize_t)wav.size() &&
+                mapSampleFile(path, 0, &sample);
+  if (fd >= 0)
+  {
+    close(fd);
+    unlink(path);
+  }
+  benchCheck(mapped, "could not map the looped sine WAV");
+  if (!mapped)
+  {
+    return;
+  }
+
+  const SampleReader reader = sampleReader(sample);
+  const uint32_t step = (uint32_t)(0.7 * (1 << SAMPLE_POSITION_BITS));
+  uint32_t position = 0;
+  int32_t last = sampleLookup<SAMPLE_S16>(reader, position);
+  double worst = 0;
+  for (int s = 0; s < 20000; s++)
+  {
+    position += step;
+    const int32_t value = sampleLookup<SAMPLE_S16>(reader, position);
+    worst = std::max(worst, (double)std::abs(value - last));
+    last = value;
+  }
+  const double slope = 2 * M_PI * amplitude * 0.7 / period;
+  printf("\nsampler loop from a smpl chunk: frames %u - %u, largest step %.0f, sine slope %.0f\n",
+         sample.loopStart, sample.loopEnd, worst, slope);
+  benchCheck(sample.loopStart == loopStart && sample.loopEnd == loopEnd, "smpl loop points not taken as written");
+  benchCheck(worst <= slope + 2, "looped sample jumps at the join");
+}
+
+// Sampler voices against oscillator voices through renderBlock, with every
+// voice restarted each 64 blocks (190 ms) so one-shots are mostly playing.
+// Each sample plays from the first bank slot for its run
+void benchSampler(const Sample *file)
+{
+  struct Sound
+  {
+    const char *name;
+    int waveform;
+    const Sample *sample;
+  };
+  std::vector<Sound> sounds = {{"Sine", WAVE_SINE, nullptr}, {"Saw", WAVE_SAW, nullptr}};
+  for (int i = 0; i < SAMPLE_COUNT; i++)
+  {
+    sounds.push_back({samplerBank[i]->name, WAVE_SAMPLE, samplerBank[i]});
+  }
+  if (file != nullptr)
+  {
+    sounds.push_back({"file", WAVE_SAMPLE, file});
+  }
+
+  printf("\nsampler against oscillators (ns per voice-sample)\n");
+  printf("%-10s %6s %10s %10s\n", "sample", "format", "frames", "loop");
+  for (const Sound &sound : sounds)
+  {
+    if (sound.sample != nullptr)
+    {
+      printf("%-10s %6s %10u %10s\n", sound.name, sound.sample->format == SAMPLE_S16 ? "16-bit" : "8-bit",
+             sound.sample->length, sound.sample->loopEnd > 0 ? "yes" : "one-shot");
+    }
+  }
+
+  const int voiceCounts[] = {1, 12, 36};
+  VoiceFrame frame;
+  uint32_t block[AUDIO_BLOCK_SIZE];
+  const Sample *first = samplerBank[0];
+  printf("%-10s", "voices");
+  for (const Sound &sound : sounds)
+  {
+    printf(" %10s", sound.name);
+  }
+  printf("\n");
+  for (int voices : voiceCounts)
+  {
+    printf("%-10d", voices);
+    for (const Sound &sound : sounds)
+    {
+      samplerBank[0] = sound.sample != nullptr ? sound.sample : first;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t s = 0; s < BENCH_SAMPLES; s += AUDIO_BLOCK_SIZE)
+      {
+        if (s % (64 * AUDIO_BLOCK_SIZE) == 0)
+        {
+          fillFrame(&frame, voices);
+        }
+        renderBlock(block, AUDIO_BLOCK_SIZE, frame, benchEnvelopes, sound.waveform, 6);
+        benchSink = block[0];
+      }
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      printf(" %10.2f", ns / ((double)BENCH_SAMPLES * voices));
+      benchCheck(ns / BENCH_SAMPLES < 1e9 / 22050, "sampler slower than real time");
+    }
+    printf("\n");
+  }
+  samplerBank[0] = first;
+}
+
+// Polyphony capped by the render budget. First with real timings against the
+// real deadline, then on a modelled CPU slow enough that only about 20 saw
+// voices fit: each block's time is worked out from the costs measured here,
+// scaled up, with an interrupt's worth landing in one block in 50. Notes are
+// played through the allocator at the scan rate as on the board, 40 held at
+// a time with one changing every scan, and the unison preset halfway through
+// plays three oscillators a voice
+void benchRenderBudget()
+{
+  const int heldNotes = 40;
+  const int blocks = 8000;
+  const int scanBlocks = 7;
+  VoiceFrame frame;
+  uint32_t block[AUDIO_BLOCK_SIZE];
+
+  fillFrame(&frame, heldNotes);
+  renderBudget = RenderBudget(22050, AUDIO_BLOCK_SIZE);
+  double totalNs = 0;
+  for (int b = 0; b < blocks; b++)
+  {
+    uint32_t start = renderClock();
+    renderBlock(block, AUDIO_BLOCK_SIZE, frame, benchEnvelopes, WAVE_SAW, 6);
+    uint32_t ns = renderClock() - start;
+    renderBudget.endBlock(ns);
+    benchSink = block[0];
+    totalNs += ns;
+  }
+  printf("\nrender budget, %d saw voices on this machine: deadline %u ns, mean block %.0f ns, limit %d, "
+         "headroom %d%%\n",
+         heldNotes, renderBudget.deadline(), totalNs / blocks, renderBudget.voiceLimit(), renderBudget.headroom());
+
+  // Modelled CPU, in the same units as the real deadline
+  const uint32_t deadline = renderBudget.deadline();
+  const uint32_t fixedCost = deadline / 20;
+  const uint32_t voiceCost = (deadline * RENDER_BUDGET_PERCENT / 100 - fixedCost) / 20;
+  const uint32_t interruptCost = deadline / 10;
+  printf("modelled CPU, %u per voice, %u fixed, %u per interrupt\n", voiceCost, fixedCost, interruptCost);
+  printf("%-8s %-8s %8s %8s %10s %10s\n", "cap", "wave", "limit", "voices", "worst", "overruns");
+  for (int capped = 0; capped < 2; capped++)
+  {
+    VoiceAllocator allocator;
+    VoiceEnvelopes envelopes(22050);
+    renderBudget = RenderBudget(22050, AUDIO_BLOCK_SIZE);
+    frame.count = 0;
+    for (int half = 0; half < 2; half++)
+    {
+      uint32_t worst = 0;
+      uint32_t overruns = 0;
+      // Unison is modelled as three oscillators a voice
+      int oscillators = half == 0 ? 1 : 3;
+      for (int b = 0; b < blocks / 2; b++)
+      {
+        int scan = (half * blocks / 2 + b) / scanBlocks;
+        if (b % scanBlocks == 0)
+        {
+          allocator.beginScan();
+          slideNotes(&allocator, NOTE_SOURCE_LOCAL, scan, heldNotes);
+          if (capped)
+          {
+            allocator.setPolyphony(renderBudget.voiceLimit());
+          }
+          allocator.endScan(&frame, envelopes);
+        }
+        // Voices fade in and out on the allocator's envelopes as they would,
+        // and with the budget the renderer leaves out what will not fit
+        int voices = 0;
+        const int limit = renderBudget.beginVoices(oscillators, oscillators);
+        for (int i = 0; i < frame.count && (!capped || voices < limit); i++)
+        {
+          uint8_t slot = frame.slot[i];
+          if (voiceGeneration[slot] != frame.generation[i])
+          {
+            voiceGeneration[slot] = frame.generation[i];
+            envelopes.trigger(slot, frame.generation[i]);
+          }
+          if (!envelopes.idle(slot))
+          {
+            envelopes.advance(slot, frame.held[i], AUDIO_BLOCK_SIZE);
+            voices++;
+          }
+        }
+        uint32_t cycles = fixedCost + voices * oscillators * voiceCost + (b % 50 == 49 ? interruptCost : 0);
+        renderBudget.addVoices(voices, voices * oscillators * voiceCost);
+        renderBudget.endBlock(cycles);
+        // The first scans are played before anything has been measured
+        if (half == 1 || b >= 2 * scanBlocks)
+        {
+          worst = cycles > worst ? cycles : worst;
+          overruns += cycles > deadline;
+        }
+      }
+      printf("%-8s %-8s %8d %8d %9.0f%% %10u\n", capped ? "budget" : "none", half == 0 ? "saw" : "unison",
+             allocator.polyphony(), renderBudget.voices(), 100.0 * worst / deadline, overruns);
+      if (capped)
+      {
+        benchCheck(overruns == 0, "render budget let blocks overrun");
+      }
+    }
+  }
+  memset(voiceGeneration, 0, sizeof(voiceGeneration));
+  renderBudget = RenderBudget(22050, AUDIO_BLOCK_SIZE);
+}
+
+// Quality governor. First the cost of a heavy patch at each quality level
+// (24 saw voices in 7 oscillator unison through the filter and echo), then a
+// modelled CPU on which full quality takes 65% of the deadline, given an
+// artificial load that climbs to 55% of the deadline over 100 ms, stays for
+// 2 s and goes again, with an interrupt's worth landing in one block in 50
+void benchGovernor()
+{
+  const char *levelNames[] = {"full", "half unison", "no delay", "minimal"};
+  const int levels = QUALITY_MINIMAL + 1;
+  const int voices = 24;
+  const int blocks = 4000;
+  VoiceFrame frame;
+  uint32_t block[AUDIO_BLOCK_SIZE];
+
+  fillFrame(&frame, voices);
+  voiceUnison.set(3);
+  outputFilter.set(FILTER_LOW_PASS, FILTER_CUTOFF_STEPS / 2, 4);
+  delayEffects.set(DELAY_ECHO, 1, 120);
+  renderBudget = RenderBudget(22050, AUDIO_BLOCK_SIZE);
+  double cost[levels];
+  printf("\nquality levels, %d saw voices in %s unison with filter and echo\n", voices, unisonPresets[3].name);
+  printf("%-12s %12s %10s\n", "level", "ns/block", "of full");
+  // Fastest of several rounds, taking the levels in turn, so a burst of other
+  // work on the machine does not land on one level and reorder them
+  for (int round = 0; round < 5; round++)
+  {
+    for (int level = 0; level < levels; level++)
+    {
+      renderBudget.fixQuality(level);
+      auto start = std::chrono::steady_clock::now();
+      for (int b = 0; b < blocks; b++)
+      {
+        renderBlock(block, AUDIO_BLOCK_SIZE, frame, benchEnvelopes, WAVE_SAW, 6);
+        benchSink = block[0];
+      }
+      const double ns =
+          std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / blocks;
+      cost[level] = round == 0 || ns < cost[level] ? ns : cost[level];
+    }
+  }
+  for (int level = 0; level < levels; level++)
+  {
+    printf("%-12s %12.0f %9.0f%%\n", levelNames[level], cost[level], 100 * cost[level] / cost[0]);
+  }
+  voiceUnison.set(UNISON_OFF);
+  outputFilter.set(FILTER_OFF, FILTER_CUTOFF_STEPS - 1, 0);
+  delayEffects.set(DELAY_OFF, 0, 120);
+  renderBudget = RenderBudget(22050, AUDIO_BLOCK_SIZE);
+
+  const double deadline = renderBudget.deadline();
+  const double scale = 0.65 * deadline / cost[0];
+  printf("governor on a modelled CPU, load of 55%% from 0.5 s to 2.6 s\n");
+  printf("%-10s %10s %10s %10s %10s %10s %10s\n", "governor", "full", "half", "no delay", "minimal", "worst",
+         "overruns");
+  for (int governed = 0; governed < 2; governed++)
+  {
+    RenderBudget budget(22050, AUDIO_BLOCK_SIZE);
+    budget.fixQuality(governed ? QUALITY_GOVERNED : QUALITY_FULL);
+    int blocksAt[levels] = {};
+    double worst = 0;
+    uint32_t overruns = 0;
+    const int loadStart = 172, loadRamp = 34, loadEnd = 900, total = 2400;
+    for (int b = 0; b < total; b++)
+    {
+      double load = 0;
+      if (b >= loadStart && b < loadEnd)
+      {
+        load = 0.55 * (b - loadStart < loadRamp ? (double)(b - loadStart) / loadRamp : 1.0);
+      }
+      else if (b >= loadEnd && b < loadEnd + loadRamp)
+      {
+        load = 0.55 * (1.0 - (double)(b - loadEnd) / loadRamp);
+      }
+      double cycles = cost[budget.quality()] * scale + load * deadline + (b % 50 == 49 ? 0.05 * deadline : 0);
+      blocksAt[budget.quality()]++;
+      budget.endBlock((uint32_t)cycles);
+      worst = cycles > worst ? cycles : worst;
+      overruns += cycles > deadline;
+    }
+    printf("%-10s", governed ? "on" : "off");
+    for (int level = 0; level < levels; level++)
+    {
+      printf(" %9.2fs", blocksAt[level] * (double)AUDIO_BLOCK_SIZE / 22050);
+    }
+    printf(" %9.0f%% %10u  ends %s\n", 100 * worst / deadline, overruns, levelNames[budget.quality()]);
+    if (governed)
+    {
+      benchCheck(overruns == 0, "governor let blocks overrun");
+      benchCheck(budget.quality() == QUALITY_FULL, "governor did not return to full quality");
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Sample file;
+  if (argc > 1 && !mapSampleFile(argv[1], 0, &file))
+  {
+    return 1;
+  }
+
+  benchRenderBlock();
+  benchVoiceLayout();
+  benchVoiceAllocator();
+  benchScanTask();
+  benchKeyScanner();
+  benchKnobDecoder();
+  benchJoystick();
+  benchEnvelope();
+  benchMixer();
+  benchSineOscillator();
+  benchBandLimited();
+  benchFilter();
+  benchDelay();
+  benchUnison();
+  benchSampleLoop();
+  benchSampler(argc > 1 ? &file : nullptr);
+  benchRenderBudget();
+  benchGovernor();
+  if (benchFailures > 0)
+  {
+    printf("\n%d checks FAILED\n", benchFailures);
+    return 1;
+  }
+  return 0;
+}
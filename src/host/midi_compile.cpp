@@ -0,0 +1,709 @@
+// Host-native song compiler: reads Standard MIDI Files and writes them out as
+// event tables for the song player (see Song_format.hpp), ready to include
+// from Song_bank.hpp, reporting the flash each one takes.
+// Build with: pio run -e native_midi
+// Run with:   .pio/build/native_midi/program [options] song.mid... > songs.hpp
+//
+// Options:
+//   --voices <n>       fold each song down to n notes at once. A note that
+//                      would go over takes the place of the lowest one held if
+//                      it is higher, so the tune survives, and is dropped if not
+//   --loop             loop back to the start at the end of the song
+//   --drums            keep MIDI channel 10, which is left out by default
+//   --transpose <n>    shift every note by n semitones first
+//   --binary <dir>     also write each table to <dir>/<name>.bin as raw events
+//   -o <file>          write the tables to a file rather than stdout
+//
+// Timing is quantised to SONG_TICKS_PER_BEAT and tempo changes are kept, so a
+// song plays at its own speed. Notes outside C2 - B8 are moved in by octaves,
+// and a note struck again straight after it ends is cut one tick short so the
+// key scan sees it lift and sounds it again.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Modulation.hpp"
+#include "Song_format.hpp"
+
+// MIDI key of songNote(2, 0), the lowest note the keyboard has
+constexpr int MIDI_KEY_C2 = 36;
+constexpr int MIDI_DRUM_CHANNEL = 9;
+constexpr uint32_t MIDI_DEFAULT_TEMPO = 500000;
+
+struct MidiNote
+{
+  uint32_t start;
+  uint32_t end;
+  int key;
+  int channel;
+};
+
+struct MidiTempo
+{
+  uint32_t tick;
+  uint32_t microsPerBeat;
+};
+
+struct MidiFile
+{
+  uint16_t division;
+  uint32_t length;
+  std::vector<MidiNote> notes;
+  std::vector<MidiTempo> tempos;
+};
+
+struct CompileOptions
+{
+  int voices = 0;
+  bool loop = false;
+  bool drums = false;
+  int transpose = 0;
+  const char *binaryDir = nullptr;
+};
+
+// Reads through a file's bytes, remembering if it ever ran off the end
+class MidiReader
+{
+public:
+  MidiReader(const uint8_t *data, size_t size) : m_data(data), m_size(size) {}
+
+  bool failed() const { return m_failed; }
+  bool done() const { return m_offset >= m_size; }
+  size_t offset() const { return m_offset; }
+
+  uint32_t read(int bytes)
+  {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+      value = value << 8 | byte();
+    }
+    return value;
+  }
+
+  uint8_t byte()
+  {
+    if (m_offset >= m_size)
+    {
+      m_failed = true;
+      return 0;
+    }
+    return m_data[m_offset++];
+  }
+
+  // MIDI variable length quantity, 7 bits a byte, at most 4 bytes
+  uint32_t variable()
+  {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      uint8_t b = byte();
+      value = value << 7 | (b & 0x7F);
+      if ((b & 0x80) == 0)
+      {
+        return value;
+      }
+    }
+    m_failed = true;
+    return value;
+  }
+
+  void skip(size_t bytes)
+  {
+    if (bytes > m_size - m_offset)
+    {
+      m_failed = true;
+      m_offset = m_size;
+      return;
+    }
+    m_offset += bytes;
+  }
+
+  const uint8_t *here() const { return m_data + m_offset; }
+
+private:
+  const uint8_t *m_data;
+  size_t m_size;
+  size_t m_offset = 0;
+  bool m_failed = false;
+};
+
+// Pairs one track's note ons with their note offs, in the order struck
+static bool readTrack(MidiReader &track, MidiFile *midi)
+{
+  std::vector<uint32_t> pending[16][128];
+  uint32_t tick = 0;
+  uint8_t status = 0;
+  while (!track.done() && !track.failed())
+  {
+    tick += track.variable();
+    uint8_t b = track.byte();
+    if (b == 0xFF)
+    {
+      uint8_t type = track.byte();
+      uint32_t length = track.variable();
+      if (type == 0x51 && length == 3)
+      {
+        midi->tempos.push_back({tick, track.read(3)});
+        continue;
+      }
+      track.skip(length);
+      if (type == 0x2F)
+      {
+        break;
+      }
+      continue;
+    }
+    if (b == 0xF0 || b == 0xF7)
+    {
+      track.skip(track.variable());
+      continue;
+    }
+
+    // Running status: a data byte repeats the last channel message
+    uint8_t data1;
+    if (b & 0x80)
+    {
+      status = b;
+      data1 = track.byte();
+    }
+    else if (status != 0)
+    {
+      data1 = b;
+    }
+    else
+    {
+      return false;
+    }
+    uint8_t kind = status & 0xF0;
+    int channel = status & 0x0F;
+    uint8_t data2 = kind == 0xC0 || kind == 0xD0 ? 0 : track.byte();
+    uint8_t key = data1 & 0x7F;
+    if (kind == 0x90 && data2 != 0)
+    {
+      pending[channel][key].push_back(tick);
+    }
+    else if ((kind == 0x80 || kind == 0x90) && !pending[channel][key].empty())
+    {
+      // A note on with no velocity is a note off
+      midi->notes.push_back({pending[channel][key].front(), tick, key, channel});
+      pending[channel][key].erase(pending[channel][key].begin());
+    }
+  }
+  if (track.failed())
+  {
+    return false;
+  }
+
+  // Notes left held end with the track
+  for (int channel = 0; channel < 16; channel++)
+  {
+    for (int key = 0; key < 128; key++)
+    {
+      for (uint32_t start : pending[channel][key])
+      {
+        midi->notes.push_back({start, tick, key, channel});
+      }
+    }
+  }
+  midi->length = std::max(midi->length, tick);
+  return true;
+}
+
+// Reads a format 0 or 1 file timed in beats. Returns false after printing why not
+static bool readMidiFile(const char *path, MidiFile *midi)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr)
+  {
+    fprintf(stderr, "%s: could not open\n", path);
+    return false;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t buffer[4096];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    bytes.insert(bytes.end(), buffer, buffer + got);
+  }
+  fclose(file);
+
+  MidiReader reader(bytes.data(), bytes.size());
+  if (bytes.size() < 14 || memcmp(bytes.data(), "MThd", 4) != 0)
+  {
+    fprintf(stderr, "%s: not a MIDI file\n", path);
+    return false;
+  }
+  reader.skip(4);
+  uint32_t headerLength = reader.read(4);
+  uint16_t format = reader.read(2);
+  uint16_t tracks = reader.read(2);
+  midi->division = reader.read(2);
+  reader.skip(headerLength - 6);
+  if (format > 1 || midi->division == 0 || (midi->division & 0x8000) != 0)
+  {
+    fprintf(stderr, "%s: only format 0 and 1 files timed in beats are supported\n", path);
+    return false;
+  }
+
+  midi->length = 0;
+  for (uint16_t t = 0; t < tracks && !reader.failed(); t++)
+  {
+    const uint8_t *chunk = reader.here();
+    reader.skip(4);
+    uint32_t length = reader.read(4);
+    if (reader.failed() || length > bytes.size() - reader.offset())
+    {
+      fprintf(stderr, "%s: cut short\n", path);
+      return false;
+    }
+    if (memcmp(chunk, "MTrk", 4) == 0)
+    {
+      MidiReader track(reader.here(), length);
+      if (!readTrack(track, midi))
+      {
+        fprintf(stderr, "%s: track %u is corrupt\n", path, t);
+        return false;
+      }
+    }
+    reader.skip(length);
+  }
+  if (reader.failed())
+  {
+    fprintf(stderr, "%s: cut short\n", path);
+    return false;
+  }
+
+  // The tempo stays at 120 BPM until the file says otherwise
+  std::stable_sort(midi->tempos.begin(), midi->tempos.end(),
+                   [](const MidiTempo &a, const MidiTempo &b) { return a.tick < b.tick; });
+  if (midi->tempos.empty() || midi->tempos[0].tick != 0)
+  {
+    midi->tempos.insert(midi->tempos.begin(), {0, MIDI_DEFAULT_TEMPO});
+  }
+  return true;
+}
+
+// A note in song ticks
+struct SongNote
+{
+  uint32_t start;
+  uint32_t end;
+  uint8_t note;
+};
+
+struct CompileReport
+{
+  size_t notes = 0;
+  size_t peakNotes = 0;
+  size_t stolen = 0;
+  size_t dropped = 0;
+  size_t moved = 0;
+  size_t tempos = 0;
+  size_t clampedTempos = 0;
+  uint32_t ticks = 0;
+  double seconds = 0;
+};
+
+static uint32_t songTick(uint64_t midiTick, uint16_t division)
+{
+  return (uint32_t)((midiTick * SONG_TICKS_PER_BEAT + division / 2) / division);
+}
+
+static int tempoBpm(uint32_t microsPerBeat)
+{
+  return (int)(60000000.0 / microsPerBeat + 0.5);
+}
+
+// Most notes sounding at once
+static size_t peakNotes(const std::vector<SongNote> &notes)
+{
+  std::vector<std::pair<uint32_t, int>> edges;
+  for (const SongNote &note : notes)
+  {
+    edges.push_back({note.start, 1});
+    edges.push_back({note.end, -1});
+  }
+  // Ends sort before starts at the same tick
+  std::sort(edges.begin(), edges.end());
+  size_t peak = 0;
+  size_t held = 0;
+  for (const auto &edge : edges)
+  {
+    held += edge.second;
+    peak = std::max(peak, held);
+  }
+  return peak;
+}
+
+// Quantises the notes, moves them into range and folds their polyphony
+static std::vector<SongNote> songNotes(const MidiFile &midi, const CompileOptions &options, CompileReport *report)
+{
+  std::vector<SongNote> notes;
+  for (const MidiNote &midiNote : midi.notes)
+  {
+    if (midiNote.channel == MIDI_DRUM_CHANNEL && !options.drums)
+    {
+      continue;
+    }
+    int note = midiNote.key + options.transpose - MIDI_KEY_C2;
+    if (note < 0 || note >= NOTE_COUNT)
+    {
+      note = note < 0 ? note + 12 * ((11 - note) / 12) : note - 12 * ((note - NOTE_COUNT) / 12 + 1);
+      report->moved++;
+    }
+    uint32_t start = songTick(midiNote.start, midi.division);
+    uint32_t end = songTick(midiNote.end, midi.division);
+    // Notes shorter than a tick still sound
+    notes.push_back({start, end > start ? end : start + 1, (uint8_t)note});
+  }
+  report->peakNotes = peakNotes(notes);
+
+  // Higher notes first within a chord, so they are the ones kept
+  std::stable_sort(notes.begin(), notes.end(), [](const SongNote &a, const SongNote &b) {
+    return a.start != b.start ? a.start < b.start : a.note > b.note;
+  });
+  std::vector<SongNote> kept;
+  std::vector<size_t> held;
+  for (const SongNote &note : notes)
+  {
+    held.erase(std::remove_if(held.begin(), held.end(), [&](size_t i) { return kept[i].end <= note.start; }),
+               held.end());
+
+    // The same note struck again while it sounds, from another track or
+    // channel: merged if together, otherwise the old one ends here
+    auto same = std::find_if(held.begin(), held.end(), [&](size_t i) { return kept[i].note == note.note; });
+    if (same != held.end())
+    {
+      SongNote &old = kept[*same];
+      if (old.start == note.start)
+      {
+        old.end = std::max(old.end, note.end);
+        continue;
+      }
+      old.end = note.start;
+      held.erase(same);
+    }
+
+    if (options.voices > 0 && held.size() >= (size_t)options.voices)
+    {
+      auto lowest = std::min_element(held.begin(), held.end(),
+                                     [&](size_t a, size_t b) { return kept[a].note < kept[b].note; });
+      if (note.note < kept[*lowest].note)
+      {
+        report->dropped++;
+        continue;
+      }
+      kept[*lowest].end = note.start;
+      held.erase(lowest);
+      report->stolen++;
+    }
+    held.push_back(kept.size());
+    kept.push_back(note);
+  }
+
+  // Leave a tick between a note and the same note struck straight after
+  std::stable_sort(kept.begin(), kept.end(), [](const SongNote &a, const SongNote &b) {
+    return a.note != b.note ? a.note < b.note : a.start < b.start;
+  });
+  for (size_t i = 1; i < kept.size(); i++)
+  {
+    SongNote &previous = kept[i - 1];
+    if (previous.note == kept[i].note && previous.end >= kept[i].start && kept[i].start > previous.start + 1)
+    {
+      previous.end = kept[i].start - 1;
+    }
+  }
+  report->notes = kept.size();
+  return kept;
+}
+
+// Appends an event after a delay, with wait events for any delay too long for one byte
+static void appendAfter(std::vector<SongEvent> *events, uint32_t delay, SongEvent event)
+{
+  while (delay > 255)
+  {
+    events->push_back(songWait(255));
+    delay -= 255;
+  }
+  event.delta = delay;
+  events->push_back(event);
+}
+
+static std::vector<SongEvent> compileSong(const MidiFile &midi, const CompileOptions &options, CompileReport *report)
+{
+  std::vector<SongNote> notes = songNotes(midi, options, report);
+
+  struct TimedEvent
+  {
+    uint32_t tick;
+    // Note offs, then note ons, then tempo changes at the same tick, except
+    // that the first tempo leads the song
+    int order;
+    SongEvent event;
+  };
+  std::vector<TimedEvent> timed;
+  uint32_t end = songTick(midi.length, midi.division);
+  for (const SongNote &note : notes)
+  {
+    timed.push_back({note.start, 1, noteOn(0, note.note)});
+    timed.push_back({note.end, 0, noteOff(0, note.note)});
+    end = std::max(end, note.end);
+  }
+  int bpm = 0;
+  for (const MidiTempo &tempo : midi.tempos)
+  {
+    int newBpm = tempoBpm(tempo.microsPerBeat);
+    if (newBpm < TEMPO_MIN || newBpm > TEMPO_MAX)
+    {
+      newBpm = newBpm < TEMPO_MIN ? TEMPO_MIN : TEMPO_MAX;
+      report->clampedTempos++;
+    }
+    uint32_t tick = songTick(tempo.tick, midi.division);
+    if (tick >= end && tick != 0)
+    {
+      break;
+    }
+    if (newBpm != bpm)
+    {
+      timed.push_back({tick, tick == 0 ? -1 : 2, tempoChange(newBpm)});
+      bpm = newBpm;
+      report->tempos++;
+    }
+  }
+  std::stable_sort(timed.begin(), timed.end(), [](const TimedEvent &a, const TimedEvent &b) {
+    return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+  });
+
+  // A tempo change goes in after the events at its tick, which it applies
+  // with, or after a wait up to its tick if there are none
+  std::vector<SongEvent> events;
+  uint32_t last = 0;
+  for (const TimedEvent &event : timed)
+  {
+    if (event.event.command == SONG_TEMPO)
+    {
+      if (event.tick > last)
+      {
+        appendAfter(&events, event.tick - last, songWait(0));
+        last = event.tick;
+      }
+      events.push_back(event.event);
+      continue;
+    }
+    appendAfter(&events, event.tick - last, event.event);
+    last = event.tick;
+  }
+  appendAfter(&events, end - last, options.loop ? songLoop(0) : songEnd(0));
+
+  // Length in seconds, following the tempo changes through the song
+  report->ticks = end;
+  double seconds = 0;
+  uint32_t microsPerBeat = MIDI_DEFAULT_TEMPO;
+  for (const SongEvent &event : events)
+  {
+    if (event.command == SONG_TEMPO)
+    {
+      microsPerBeat = 60000000 / event.delta;
+      continue;
+    }
+    seconds += event.delta * microsPerBeat / 1e6 / SONG_TICKS_PER_BEAT;
+  }
+  report->seconds = seconds;
+  return events;
+}
+
+// "ode_to-joy" becomes odeToJoy
+static std::string identifierFor(const std::string &name)
+{
+  std::string identifier;
+  bool upper = false;
+  for (char c : name)
+  {
+    if (!isalnum((unsigned char)c))
+    {
+      upper = !identifier.empty();
+      continue;
+    }
+    identifier += upper ? toupper(c) : (identifier.empty() ? tolower(c) : c);
+    upper = false;
+  }
+  if (identifier.empty() || isdigit((unsigned char)identifier[0]))
+  {
+    identifier = "song" + identifier;
+  }
+  return identifier;
+}
+
+static const char *noteNames[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+static void writeEvent(FILE *out, const SongEvent &event)
+{
+  uint8_t command = event.command;
+  if (command < NOTE_COUNT || (command >= SONG_NOTE_OFF && command < SONG_NOTE_OFF + NOTE_COUNT))
+  {
+    uint8_t note = command & ~SONG_NOTE_OFF;
+    fprintf(out, "%s(%u, songNote(%d, %d)), // %s%d\n", command < NOTE_COUNT ? "noteOn" : "noteOff", event.delta,
+            note / 12 + 2, note % 12, noteNames[note % 12], note / 12 + 2);
+    return;
+  }
+  switch (command)
+  {
+  case SONG_TEMPO:
+    fprintf(out, "tempoChange(%u),\n", event.delta);
+    break;
+  case SONG_WAIT:
+    fprintf(out, "songWait(%u),\n", event.delta);
+    break;
+  case SONG_LOOP:
+    fprintf(out, "songLoop(%u),\n", event.delta);
+    break;
+  case SONG_END:
+    fprintf(out, "songEnd(%u),\n", event.delta);
+    break;
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: midi_compile [--voices n] [--loop] [--drums] [--transpose n] [--binary dir] [-o out.hpp] "
+                  "song.mid...\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  CompileOptions options;
+  const char *outPath = nullptr;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--voices") == 0 && hasValue)
+    {
+      options.voices = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--loop") == 0)
+    {
+      options.loop = true;
+    }
+    else if (strcmp(argv[i], "--drums") == 0)
+    {
+      options.drums = true;
+    }
+    else if (strcmp(argv[i], "--transpose") == 0 && hasValue)
+    {
+      options.transpose = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--binary") == 0 && hasValue)
+    {
+      options.binaryDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "-o") == 0 && hasValue)
+    {
+      outPath = argv[++i];
+    }
+    else if (argv[i][0] == '-')
+    {
+      usage();
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty())
+  {
+    usage();
+  }
+
+  FILE *out = outPath != nullptr ? fopen(outPath, "w") : stdout;
+  if (out == nullptr)
+  {
+    fprintf(stderr, "%s: could not write\n", outPath);
+    return 1;
+  }
+  fprintf(out, "#pragma once\n\n// Generated by midi_compile. Include from Song_bank.hpp and list the songs in songs[]\n");
+
+  std::vector<std::string> entries;
+  size_t totalBytes = 0;
+  for (const char *path : paths)
+  {
+    MidiFile midi;
+    if (!readMidiFile(path, &midi))
+    {
+      return 1;
+    }
+    CompileReport report;
+    std::vector<SongEvent> events = compileSong(midi, options, &report);
+    if (events.size() > UINT16_MAX)
+    {
+      fprintf(stderr, "%s: %zu events, more than a song can hold\n", path, events.size());
+      return 1;
+    }
+
+    std::string name = path;
+    name = name.substr(name.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    std::string identifier = identifierFor(name);
+    size_t bytes = events.size() * sizeof(SongEvent);
+    totalBytes += bytes;
+
+    fprintf(out, "\n// %s: %zu notes, %zu events, %zu bytes\nconstexpr SongEvent %s[] = {\n", name.c_str(),
+            report.notes, events.size(), bytes, identifier.c_str());
+    for (const SongEvent &event : events)
+    {
+      fprintf(out, "    ");
+      writeEvent(out, event);
+    }
+    fprintf(out, "};\n");
+    entries.push_back("{\"" + name + "\", " + identifier + ", sizeof(" + identifier + ") / sizeof(" + identifier +
+                      "[0])},");
+
+    if (options.binaryDir != nullptr)
+    {
+      std::string binaryPath = std::string(options.binaryDir) + "/" + identifier + ".bin";
+      FILE *binary = fopen(binaryPath.c_str(), "wb");
+      if (binary == nullptr || fwrite(events.data(), sizeof(SongEvent), events.size(), binary) != events.size())
+      {
+        fprintf(stderr, "%s: could not write\n", binaryPath.c_str());
+        return 1;
+      }
+      fclose(binary);
+    }
+
+    fprintf(stderr, "%-24s %6zu bytes  %5zu events  %5zu notes  %d:%04.1f  peak %zu notes", identifier.c_str(), bytes,
+            events.size(), report.notes, (int)report.seconds / 60, report.seconds - 60 * ((int)report.seconds / 60),
+            report.peakNotes);
+    if (report.stolen + report.dropped > 0)
+    {
+      fprintf(stderr, ", %zu cut short and %zu dropped for %d voices", report.stolen, report.dropped, options.voices);
+    }
+    if (report.moved > 0)
+    {
+      fprintf(stderr, ", %zu moved into range", report.moved);
+    }
+    if (report.clampedTempos > 0)
+    {
+      fprintf(stderr, ", %zu tempos clamped to %d - %d BPM", report.clampedTempos, TEMPO_MIN, TEMPO_MAX);
+    }
+    fprintf(stderr, "\n");
+  }
+
+  fprintf(out, "\n// For songs[]:\n");
+  for (const std::string &entry : entries)
+  {
+    fprintf(out, "//     %s\n", entry.c_str());
+  }
+  fprintf(stderr, "%-24s %6zu bytes of flash\n", "total", totalBytes);
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+  return 0;
+}
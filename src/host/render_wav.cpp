@@ -0,0 +1,661 @@
+// Host-native offline renderer: plays a key/knob event script through the
+// synth engine and writes the result to a 16-bit stereo WAV file.
+// Build with: pio run -e native_render
+// Run with:   .pio/build/native_render/program script.txt out.wav
+//
+// Script lines are "<time ms> <command> <args>", blank lines and # comments
+// are ignored:
+//   press <note>              press a local key (C, C#, ... B)
+//   release <note>            release a local key
+//   knob <name> <value>       volume, wave, effect, sub, octave,
+//                             attack, decay, sustain, release
+//   can <0|1> <keys> <octave> state of a CAN keyboard, keys as a 12-bit mask
+//   bend <multiplier>         joystick pitch bend, 1.0 is no bend
+//   vibrato <cycles> <depth>  vibrato LFO in cycles per beat, depth 0 to turn it off
+//   tempo <bpm>               tempo of the arpeggio and vibrato clock
+//   filter <type> <cutoff> <resonance>
+//                             filter on the mix: off, low, band or high, with
+//                             the cutoff (0 - 63) and resonance (0 - 8) knobs
+//   arp <pattern> <steps>     arpeggio pattern (index into arpPatterns, or off)
+//                             at a number of steps per beat
+//   delay <mode> <preset>     echo or chorus on the mix (off, echo, chorus) with
+//                             a preset from echoPresets or chorusPresets
+//   unison <preset>           unison preset from unisonPresets, or off
+//   sample <slot> <file> [hz] replaces samplerBank[slot] with a mono 8 or 16-bit
+//                             WAV file, memory mapped, recorded at hz (from
+//                             the file's smpl chunk, or A4, if not given). The
+//                             sample plays on waveform knob WAVE_SAMPLE + slot
+//   song <index|stop>         plays a song from songs[] through the key scan, or stops it
+//   end                       stop rendering (otherwise 1 s after the last event)
+//
+// A line with an unknown command or the wrong number of arguments, or an
+// event naming an unknown note, knob, filter, delay or sample, stops the
+// render and the program exits with 1.
+//
+// The sample each arpeggio step lands on is recorded and the spacing between
+// steps is checked against the tempo. Song events are checked against the
+// times worked out from the song tables.
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Audio_engine.hpp"
+#include "Note_processing.hpp"
+#include "Song_player.hpp"
+#include "Sample_file.hpp"
+#include "Mock_matrix.hpp"
+
+// State normally owned by main.cpp
+VoicePool voicePool;
+VoiceAllocator voiceAllocator;
+NoteTracker noteTracker(voiceAllocator);
+PitchModulator pitchModulator(samplingFreq);
+VoiceEnvelopes voiceEnvelopes(samplingFreq);
+DelayEffects delayEffects(samplingFreq);
+RenderBudget renderBudget(samplingFreq, AUDIO_BLOCK_SIZE);
+SongPlayer songPlayer(samplingFreq);
+// Keys are pressed on a mock matrix and read back through the board's scanner
+MockMatrixPins matrixPins;
+KeyMatrix<MockMatrixPins> keyMatrix(matrixPins);
+volatile int volume{6}, waveform{0}, effect{0}, subEffect{0}, octaveMode{0};
+volatile int octaveSelect = 4;
+volatile uint32_t cur_message[2] = {0, 0};
+volatile int octaveRX[2] = {0, 0};
+const char *notes[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+const char *keys[12] = {};
+int tempo = TEMPO_DEFAULT;
+int delayMode = DELAY_OFF, delayPreset = 0;
+// Envelope knob positions, as the defaults in main.cpp
+int envelope[4] = {1, 4, 8, 2};
+const char *envelopeKnobs[4] = {"attack", "decay", "sustain", "release"};
+
+// Key scan period of scanKeysTask
+constexpr uint32_t SCAN_PERIOD_MS = 20;
+
+struct ScriptEvent
+{
+  uint32_t timeMs;
+  std::string command;
+  std::string args[3];
+};
+
+// Script commands and the number of arguments each takes
+struct ScriptCommand
+{
+  const char *name;
+  int minArgs;
+  int maxArgs;
+};
+const ScriptCommand scriptCommands[] = {
+    {"press", 1, 1},  {"release", 1, 1}, {"knob", 2, 2},   {"can", 3, 3},    {"bend", 1, 1},
+    {"vibrato", 2, 2}, {"tempo", 1, 1},  {"filter", 3, 3}, {"arp", 2, 2},    {"delay", 2, 2},
+    {"unison", 1, 1}, {"sample", 2, 3},  {"song", 1, 1},   {"end", 0, 0}};
+
+// Result of applying one script event
+enum EventResult
+{
+  EVENT_APPLIED,
+  EVENT_END,
+  EVENT_FAILED
+};
+
+int noteIndex(const std::string &name)
+{
+  for (int i = 0; i < 12; i++)
+  {
+    if (name == notes[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool loadScript(const char *path, std::vector<ScriptEvent> *events)
+{
+  FILE *file = fopen(path, "r");
+  if (file == nullptr)
+  {
+    fprintf(stderr, "could not read script %s\n", path);
+    return false;
+  }
+  char line[256];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file) != nullptr)
+  {
+    lineNumber++;
+    char *comment = strchr(line, '#');
+    if (comment != nullptr)
+    {
+      *comment = '\0';
+    }
+    // One argument more than any command takes, to catch extra ones
+    char command[32], args[4][32];
+    unsigned long timeMs;
+    int fields = sscanf(line, "%lu %31s %31s %31s %31s %31s", &timeMs, command, args[0], args[1], args[2], args[3]);
+    if (fields <= 0)
+    {
+      continue;
+    }
+    if (fields < 2)
+    {
+      fprintf(stderr, "%s:%d: expected '<time ms> <command>'\n", path, lineNumber);
+      fclose(file);
+      return false;
+    }
+    const ScriptCommand *found = nullptr;
+    for (const ScriptCommand &known : scriptCommands)
+    {
+      if (strcmp(command, known.name) == 0)
+      {
+        found = &known;
+      }
+    }
+    int argCount = fields - 2;
+    if (found == nullptr)
+    {
+      fprintf(stderr, "%s:%d: unknown command '%s'\n", path, lineNumber, command);
+      fclose(file);
+      return false;
+    }
+    if (argCount < found->minArgs || argCount > found->maxArgs)
+    {
+      if (found->minArgs == found->maxArgs)
+      {
+        fprintf(stderr, "%s:%d: %s takes %d argument%s, got %d\n", path, lineNumber, command, found->minArgs,
+                found->minArgs == 1 ? "" : "s", argCount);
+      }
+      else
+      {
+        fprintf(stderr, "%s:%d: %s takes %d to %d arguments, got %d\n", path, lineNumber, command, found->minArgs,
+                found->maxArgs, argCount);
+      }
+      fclose(file);
+      return false;
+    }
+    ScriptEvent event{(uint32_t)timeMs, command, {}};
+    for (int i = 0; i < fields - 2; i++)
+    {
+      event.args[i] = args[i];
+    }
+    events->push_back(event);
+  }
+  fclose(file);
+  return true;
+}
+
+// Applies one event, reporting whether the script has ended or the event
+// could not be applied
+EventResult applyEvent(const ScriptEvent &event)
+{
+  if (event.command == "press" || event.command == "release")
+  {
+    int key = noteIndex(event.args[0]);
+    if (key < 0)
+    {
+      fprintf(stderr, "%u ms: unknown note '%s'\n", event.timeMs, event.args[0].c_str());
+      return EVENT_FAILED;
+    }
+    else
+    {
+      matrixPins.press(key / MATRIX_COLUMNS, key % MATRIX_COLUMNS, event.command == "press");
+    }
+  }
+  else if (event.command == "knob")
+  {
+    int value = atoi(event.args[1].c_str());
+    const std::string &name = event.args[0];
+    if (name == "volume")
+    {
+      volume = value;
+    }
+    else if (name == "wave")
+    {
+      waveform = value < SOUND_COUNT ? value : SOUND_COUNT - 1;
+    }
+    else if (name == "effect")
+    {
+      effect = value;
+    }
+    else if (name == "sub")
+    {
+      subEffect = octaveMode = value;
+    }
+    else if (name == "octave")
+    {
+      octaveSelect = value;
+    }
+    else
+    {
+      int i = 0;
+      while (i < 4 && name != envelopeKnobs[i])
+      {
+        i++;
+      }
+      if (i == 4)
+      {
+        fprintf(stderr, "%u ms: unknown knob '%s'\n", event.timeMs, name.c_str());
+        return EVENT_FAILED;
+      }
+      else
+      {
+        envelope[i] = value;
+        voiceEnvelopes.setShape(envelope[0], envelope[1], envelope[2], envelope[3]);
+      }
+    }
+  }
+  else if (event.command == "can")
+  {
+    int board = atoi(event.args[0].c_str()) & 1;
+    cur_message[board] = strtoul(event.args[1].c_str(), nullptr, 0) & 0xFFF;
+    octaveRX[board] = atoi(event.args[2].c_str());
+  }
+  else if (event.command == "bend")
+  {
+    pitchModulator.setBend(atof(event.args[0].c_str()));
+  }
+  else if (event.command == "vibrato")
+  {
+    pitchModulator.setVibrato(atof(event.args[0].c_str()), atof(event.args[1].c_str()));
+  }
+  else if (event.command == "tempo")
+  {
+    tempo = atoi(event.args[0].c_str());
+    pitchModulator.setTempo(tempo);
+    delayEffects.set(delayMode, delayPreset, tempo);
+  }
+  else if (event.command == "arp")
+  {
+    int pattern = event.args[0] == "off" ? ARP_OFF : atoi(event.args[0].c_str());
+    pitchModulator.setArpeggio(pattern, atoi(event.args[1].c_str()));
+  }
+  else if (event.command == "filter")
+  {
+    int type = 0;
+    while (type < FILTER_TYPE_COUNT && strcasecmp(event.args[0].c_str(), filterTypeNames[type]) != 0)
+    {
+      type++;
+    }
+    if (type == FILTER_TYPE_COUNT)
+    {
+      fprintf(stderr, "%u ms: unknown filter '%s'\n", event.timeMs, event.args[0].c_str());
+      return EVENT_FAILED;
+    }
+    else
+    {
+      outputFilter.set(type, atoi(event.args[1].c_str()), atoi(event.args[2].c_str()));
+    }
+  }
+  else if (event.command == "delay")
+  {
+    const std::string &mode = event.args[0];
+    if (mode != "off" && mode != "echo" && mode != "chorus")
+    {
+      fprintf(stderr, "%u ms: unknown delay '%s'\n", event.timeMs, mode.c_str());
+      return EVENT_FAILED;
+    }
+    else
+    {
+      delayMode = mode == "echo" ? DELAY_ECHO : (mode == "chorus" ? DELAY_CHORUS : DELAY_OFF);
+      delayPreset = atoi(event.args[1].c_str());
+      delayEffects.set(delayMode, delayPreset, tempo);
+    }
+  }
+  else if (event.command == "unison")
+  {
+    voiceUnison.set(event.args[0] == "off" ? UNISON_OFF : atoi(event.args[0].c_str()));
+  }
+  else if (event.command == "sample")
+  {
+    static Sample loaded[SAMPLE_COUNT];
+    int slot = atoi(event.args[0].c_str());
+    if (slot < 0 || slot >= SAMPLE_COUNT)
+    {
+      fprintf(stderr, "%u ms: no sample slot %d\n", event.timeMs, slot);
+      return EVENT_FAILED;
+    }
+    if (!mapSampleFile(strdup(event.args[1].c_str()), atof(event.args[2].c_str()), &loaded[slot]))
+    {
+      return EVENT_FAILED;
+    }
+    samplerBank[slot] = &loaded[slot];
+    printf("sample %d: %s, %u frames%s\n", slot, loaded[slot].name, loaded[slot].length,
+           loaded[slot].loopEnd > 0 ? ", looped" : "");
+  }
+  else if (event.command == "song")
+  {
+    if (event.args[0] == "stop")
+    {
+      songPlayer.stop();
+    }
+    else
+    {
+      songPlayer.play(atoi(event.args[0].c_str()));
+    }
+  }
+  else if (event.command == "end")
+  {
+    return EVENT_END;
+  }
+  else
+  {
+    fprintf(stderr, "%u ms: unknown command '%s'\n", event.timeMs, event.command.c_str());
+    return EVENT_FAILED;
+  }
+  return EVENT_APPLIED;
+}
+
+// Same note collection as scanKeysTask in master mode
+void scanKeys(uint16_t pressedKeys)
+{
+  KeyInputs inputs;
+  inputs.voicing = &currentVoicing();
+  voiceAllocator.beginScan();
+  inputs.keys[NOTE_SOURCE_LOCAL] = pressedKeys;
+  inputs.octaves[NOTE_SOURCE_LOCAL] = octaveSelect;
+  for (int j = 0; j < 2; j++)
+  {
+    inputs.keys[NOTE_SOURCE_CAN0 + j] = cur_message[j];
+    inputs.octaves[NOTE_SOURCE_CAN0 + j] = octaveRX[j];
+  }
+  songPlayer.heldNotes(&inputs.song);
+  noteTracker.update(inputs);
+  voiceAllocator.setPolyphony(renderBudget.voiceLimit());
+  if (voiceAllocator.endScan(voicePool.beginFrame(), voiceEnvelopes))
+  {
+    voicePool.publish();
+  }
+}
+
+void writeLE(FILE *file, uint32_t value, int bytes)
+{
+  for (int i = 0; i < bytes; i++)
+  {
+    fputc((value >> (8 * i)) & 0xFF, file);
+  }
+}
+
+void writeWavHeader(FILE *file, uint32_t frames)
+{
+  fwrite("RIFF", 1, 4, file);
+  writeLE(file, 36 + frames * 4, 4);
+  fwrite("WAVEfmt ", 1, 8, file);
+  writeLE(file, 16, 4);
+  writeLE(file, 1, 2); // PCM
+  writeLE(file, 2, 2); // Stereo
+  writeLE(file, samplingFreq, 4);
+  writeLE(file, samplingFreq * 4, 4);
+  writeLE(file, 4, 2);
+  writeLE(file, 16, 2);
+  fwrite("data", 1, 4, file);
+  writeLE(file, frames * 4, 4);
+}
+
+// 12-bit unsigned DAC code to 16-bit signed PCM
+uint16_t toPCM(uint16_t code)
+{
+  return (uint16_t)((int16_t)(code - DAC_MIDSCALE) * 16);
+}
+
+// Sample an arpeggio step started on, and the tempo and pattern settings in
+// force at the time
+struct StepMark
+{
+  uint64_t sample;
+  int section;
+};
+
+// Spacing of consecutive steps within each stretch of constant settings. Steps
+// land on whole samples, so every interval is within one sample of the exact
+// step length
+void reportSteps(const std::vector<StepMark> &steps)
+{
+  size_t first = 0;
+  while (first < steps.size())
+  {
+    size_t last = first;
+    uint64_t shortest = UINT64_MAX;
+    uint64_t longest = 0;
+    while (last + 1 < steps.size() && steps[last + 1].section == steps[first].section)
+    {
+      uint64_t interval = steps[last + 1].sample - steps[last].sample;
+      shortest = interval < shortest ? interval : shortest;
+      longest = interval > longest ? interval : longest;
+      last++;
+    }
+    if (last > first)
+    {
+      double mean = (double)(steps[last].sample - steps[first].sample) / (last - first);
+      printf("arpeggio: %zu steps from %.3f s, %llu - %llu samples apart (mean %.2f)\n", last - first + 1,
+             (double)steps[first].sample / samplingFreq, (unsigned long long)shortest, (unsigned long long)longest,
+             mean);
+    }
+    first = last + 1;
+  }
+}
+
+// Sample of the song a fired event landed on, and which event of which play it was
+struct SongMark
+{
+  int song;
+  uint32_t play;
+  uint32_t event;
+  uint32_t sample;
+};
+
+// Times each event of a song should land on, worked out in floating point from
+// its table: the first whole sample at or after the exact time
+std::vector<uint32_t> idealSongTimes(const Song &song, size_t events)
+{
+  std::vector<uint32_t> times;
+  double time = 0;
+  double bpm = TEMPO_DEFAULT;
+  double lastLoop = -1;
+  size_t i = 0;
+  while (times.size() < events && i < song.count)
+  {
+    const SongEvent &event = song.events[i++];
+    if (event.command == SONG_TEMPO)
+    {
+      bpm = event.delta;
+      continue;
+    }
+    time += event.delta * 60.0 * samplingFreq / (bpm * SONG_TICKS_PER_BEAT);
+    times.push_back((uint32_t)ceil(time - 1e-6));
+    if (event.command == SONG_LOOP && time > lastLoop)
+    {
+      lastLoop = time;
+      i = 0;
+    }
+  }
+  return times;
+}
+
+// Largest difference between where each song event landed and where it should have
+void reportSongs(const std::vector<SongMark> &marks)
+{
+  size_t first = 0;
+  while (first < marks.size())
+  {
+    size_t last = first;
+    while (last + 1 < marks.size() && marks[last + 1].play == marks[first].play)
+    {
+      last++;
+    }
+    const Song &song = songs[marks[first].song];
+    std::vector<uint32_t> ideal = idealSongTimes(song, marks[last].event + 1);
+    int64_t worst = 0;
+    for (size_t m = first; m <= last; m++)
+    {
+      int64_t error = llabs((int64_t)marks[m].sample - (int64_t)ideal[marks[m].event]);
+      worst = error > worst ? error : worst;
+    }
+    printf("song %s: %zu events checked, %.2f s, off by at most %lld samples\n", song.name, last - first + 1,
+           (double)marks[last].sample / samplingFreq, (long long)worst);
+    first = last + 1;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s <script> <out.wav>\n", argv[0]);
+    return 1;
+  }
+
+  voiceEnvelopes.setShape(envelope[0], envelope[1], envelope[2], envelope[3]);
+  // Rendering offline there is no deadline, so a stall on the host must not
+  // drop the quality of the file (engine_bench exercises the governor)
+  renderBudget.fixQuality(QUALITY_FULL);
+  std::vector<ScriptEvent> events;
+  if (!loadScript(argv[1], &events))
+  {
+    return 1;
+  }
+
+  // Render blocks straight into memory so the timing covers only the engine
+  std::vector<uint32_t> dac;
+  size_t nextEvent = 0;
+  uint64_t nextScan = 0;
+  bool running = true;
+  int peakVoices = 0;
+  std::vector<StepMark> steps;
+  int section = 0;
+  std::vector<SongMark> songMarks;
+  uint32_t songPlays = 0;
+  uint32_t songEventsBefore = 0;
+  // Sample the song started on, and where its last change landed until the
+  // voices pick it up
+  uint64_t songStart = 0;
+  bool songChanged = false;
+  uint64_t songChangeAt = 0;
+  uint64_t songLatency = 0;
+  const uint64_t lastEventMs = events.empty() ? 0 : events.back().timeMs;
+
+  auto start = std::chrono::steady_clock::now();
+  while (running)
+  {
+    uint64_t sample = dac.size();
+    uint64_t nowMs = sample * 1000 / samplingFreq;
+    while (nextEvent < events.size() && events[nextEvent].timeMs <= nowMs)
+    {
+      const ScriptEvent &event = events[nextEvent++];
+      if (event.command == "tempo" || event.command == "arp")
+      {
+        section++;
+      }
+      EventResult result = applyEvent(event);
+      if (result == EVENT_FAILED)
+      {
+        return 1;
+      }
+      running = result == EVENT_APPLIED && running;
+      if (event.command == "song")
+      {
+        songPlays++;
+        songEventsBefore = songPlayer.eventCount();
+        songStart = sample;
+      }
+    }
+    if (nextEvent == events.size() && nowMs >= lastEventMs + 1000)
+    {
+      running = false;
+    }
+
+    // Voices are only updated at the scan rate, as on the board, or as soon
+    // as the song's notes change
+    if (sample >= nextScan || songChanged)
+    {
+      scanKeys(matrixKeys(keyMatrix.scan()));
+      peakVoices = voiceAllocator.activeCount() > peakVoices ? voiceAllocator.activeCount() : peakVoices;
+      if (sample >= nextScan)
+      {
+        nextScan += samplingFreq * SCAN_PERIOD_MS / 1000;
+      }
+      if (songChanged)
+      {
+        songLatency = sample - songChangeAt > songLatency ? sample - songChangeAt : songLatency;
+        songChanged = false;
+      }
+    }
+
+    // Segment by segment as renderModulatedBlock does, noting where each step starts
+    dac.resize(sample + AUDIO_BLOCK_SIZE);
+    const uint32_t blockStart = renderClock();
+    const VoiceFrame &frame = voicePool.acquire();
+    size_t done = 0;
+    while (done < AUDIO_BLOCK_SIZE)
+    {
+      uint32_t pitchStart, pitchEnd;
+      uint32_t stepCount = pitchModulator.stepCount();
+      size_t length = pitchModulator.nextSegment(AUDIO_BLOCK_SIZE - done, &pitchStart, &pitchEnd);
+      renderBlock(&dac[sample + done], length, frame, voiceEnvelopes, waveform, volume, pitchStart, pitchEnd);
+      done += length;
+      if (pitchModulator.stepCount() != stepCount)
+      {
+        steps.push_back({sample + done, section});
+      }
+    }
+
+    // As audioRenderTask, which wakes the scan when the song's notes change
+    uint32_t songEvents = songPlayer.eventCount();
+    const bool songPublished = songPlayer.advance(AUDIO_BLOCK_SIZE);
+    renderBudget.endBlock(renderClock() - blockStart);
+    if (songPlayer.eventCount() != songEvents)
+    {
+      if (songPlayer.playing() != SONG_STOPPED)
+      {
+        songMarks.push_back({songPlayer.playing(), songPlays, songPlayer.eventCount() - songEventsBefore - 1,
+                             songPlayer.lastEventSample()});
+      }
+      if (songPublished)
+      {
+        songChanged = true;
+        songChangeAt = songStart + songPlayer.lastEventSample();
+      }
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  FILE *file = fopen(argv[2], "wb");
+  if (file == nullptr)
+  {
+    fprintf(stderr, "could not write %s\n", argv[2]);
+    return 1;
+  }
+  writeWavHeader(file, dac.size());
+  for (uint32_t frame : dac)
+  {
+    // Left then right, as the DAC's dual register holds them the other way round
+    writeLE(file, toPCM(frame >> 16), 2);
+    writeLE(file, toPCM(frame & 0xFFFF), 2);
+  }
+  fclose(file);
+
+  double audioSeconds = (double)dac.size() / samplingFreq;
+  printf("rendered %.2f s of audio in %.4f s (%.1fx realtime)\n", audioSeconds, seconds, audioSeconds / seconds);
+  printf("peak voices %d, voice limit %d, headroom %d%%, %u blocks over the deadline\n", peakVoices,
+         renderBudget.voiceLimit(), renderBudget.headroom(), renderBudget.overruns());
+  const uint32_t scans = keyMatrix.scans();
+  printf("%u matrix scans, %u pin writes, %u reads and %u settling waits a frame\n", scans,
+         matrixPins.writes / scans, matrixPins.reads / scans, matrixPins.settles / scans);
+  reportSteps(steps);
+  reportSongs(songMarks);
+  if (!songMarks.empty())
+  {
+    // A change lands inside the block it fires in, so it sounds from the next
+    printf("song notes sound at most %llu samples after their events\n", (unsigned long long)songLatency);
+    if (songLatency > AUDIO_BLOCK_SIZE)
+    {
+      printf("FAILED: song notes took longer than a block to reach the voices\n");
+      return 1;
+    }
+  }
+  return 0;
+}
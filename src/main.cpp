@@ -6,8 +6,13 @@
 #include <vector>
 #include <ES_CAN.h>
 
+#include "Audio_output.hpp"
+#include "Joystick_adc.hpp"
+#include "Voice_allocator.hpp"
+#include "Note_processing.hpp"
 #include "Knob.hpp"
-#include "Song_bank1.hpp"
+#include "Matrix_pins.hpp"
+#include "Song_player.hpp"
 #include "Octave_control.hpp"
 #include "Pitch_control.hpp"
 
@@ -15,139 +20,19 @@
 // Macro to enable/disable testing
 #define ENABLE_TESTING 0
 
-// Calculate step sizes and frequencies during compilation
-constexpr uint32_t samplingFreq = 22050;                  // Hz
-constexpr double twelfthRootOfTwo = pow(2.0, 1.0 / 12.0); // 12th root of 2
-
-// Returns frequency for given note
-constexpr uint32_t calculateFreq(float semiTone)
-{
-  return static_cast<uint32_t>(440.00f * std::pow(2.00f, static_cast<float>(semiTone) / 12.0f));
-}
-// Returns step size from note
-constexpr uint32_t calculateStepSize(float frequency)
-{
-  return static_cast<uint32_t>((pow(2, 32) * frequency) / samplingFreq);
-}
-// 2 - 8 Octaves of step sizes - super long :(
-constexpr uint32_t stepSizes[] = {
-    calculateStepSize(calculateFreq(-33)), // C2
-    calculateStepSize(calculateFreq(-32)), // C#2
-    calculateStepSize(calculateFreq(-31)), // D2
-    calculateStepSize(calculateFreq(-30)), // D#2
-    calculateStepSize(calculateFreq(-29)), // E2
-    calculateStepSize(calculateFreq(-28)), // F2
-    calculateStepSize(calculateFreq(-27)), // F#2
-    calculateStepSize(calculateFreq(-26)), // G2
-    calculateStepSize(calculateFreq(-25)), // G#2
-    calculateStepSize(calculateFreq(-24)), // A2
-    calculateStepSize(calculateFreq(-23)), // A#2
-    calculateStepSize(calculateFreq(-22)), // B2
-    calculateStepSize(calculateFreq(-21)), // C3
-    calculateStepSize(calculateFreq(-20)), // C#3
-    calculateStepSize(calculateFreq(-19)), // D3
-    calculateStepSize(calculateFreq(-18)), // D#3
-    calculateStepSize(calculateFreq(-17)), // E3
-    calculateStepSize(calculateFreq(-16)), // F3
-    calculateStepSize(calculateFreq(-15)), // F#3
-    calculateStepSize(calculateFreq(-14)), // G3
-    calculateStepSize(calculateFreq(-13)), // G#3
-    calculateStepSize(calculateFreq(-12)), // A3
-    calculateStepSize(calculateFreq(-11)), // A#3
-    calculateStepSize(calculateFreq(-10)), // B3
-    calculateStepSize(calculateFreq(-9)),  // C4
-    calculateStepSize(calculateFreq(-8)),  // C#4
-    calculateStepSize(calculateFreq(-7)),  // D4
-    calculateStepSize(calculateFreq(-6)),  // D#4
-    calculateStepSize(calculateFreq(-5)),  // E4
-    calculateStepSize(calculateFreq(-4)),  // F4
-    calculateStepSize(calculateFreq(-3)),  // F#4
-    calculateStepSize(calculateFreq(-2)),  // G4
-    calculateStepSize(calculateFreq(-1)),  // G#4
-    calculateStepSize(calculateFreq(0)),   // A4
-    calculateStepSize(calculateFreq(1)),   // A#4
-    calculateStepSize(calculateFreq(2)),   // B4
-    calculateStepSize(calculateFreq(3)),   // C5
-    calculateStepSize(calculateFreq(4)),   // C#5
-    calculateStepSize(calculateFreq(5)),   // D5
-    calculateStepSize(calculateFreq(6)),   // D#5
-    calculateStepSize(calculateFreq(7)),   // E5
-    calculateStepSize(calculateFreq(8)),   // F5
-    calculateStepSize(calculateFreq(9)),   // F#5
-    calculateStepSize(calculateFreq(10)),  // G5
-    calculateStepSize(calculateFreq(11)),  // G#5
-    calculateStepSize(calculateFreq(12)),  // A5
-    calculateStepSize(calculateFreq(13)),  // A#5
-    calculateStepSize(calculateFreq(14)),  // B5
-    calculateStepSize(calculateFreq(15)),  // C6
-    calculateStepSize(calculateFreq(16)),  // C#6
-    calculateStepSize(calculateFreq(17)),  // D6
-    calculateStepSize(calculateFreq(18)),  // D#6
-    calculateStepSize(calculateFreq(19)),  // E6
-    calculateStepSize(calculateFreq(20)),  // F6
-    calculateStepSize(calculateFreq(21)),  // F#6
-    calculateStepSize(calculateFreq(22)),  // G6
-    calculateStepSize(calculateFreq(23)),  // G#6
-    calculateStepSize(calculateFreq(24)),  // A6
-    calculateStepSize(calculateFreq(25)),  // A#6
-    calculateStepSize(calculateFreq(26)),  // B6
-    calculateStepSize(calculateFreq(27)),  // C7
-    calculateStepSize(calculateFreq(28)),  // C#7
-    calculateStepSize(calculateFreq(29)),  // D7
-    calculateStepSize(calculateFreq(30)),  // D#7
-    calculateStepSize(calculateFreq(31)),  // E7
-    calculateStepSize(calculateFreq(32)),  // F7
-    calculateStepSize(calculateFreq(33)),  // F#7
-    calculateStepSize(calculateFreq(34)),  // G7
-    calculateStepSize(calculateFreq(35)),  // G#7
-    calculateStepSize(calculateFreq(36)),  // A7
-    calculateStepSize(calculateFreq(37)),  // A#7
-    calculateStepSize(calculateFreq(38)),  // B7
-    calculateStepSize(calculateFreq(39)),  // C8
-    calculateStepSize(calculateFreq(40)),  // C#8
-    calculateStepSize(calculateFreq(41)),  // D8
-    calculateStepSize(calculateFreq(42)),  // D#8
-    calculateStepSize(calculateFreq(43)),  // E8
-    calculateStepSize(calculateFreq(44)),  // F8
-    calculateStepSize(calculateFreq(45)),  // F#8
-    calculateStepSize(calculateFreq(46)),  // G8
-    calculateStepSize(calculateFreq(47)),  // G#8
-    calculateStepSize(calculateFreq(48)),  // A8
-    calculateStepSize(calculateFreq(49)),  // A#8
-    calculateStepSize(calculateFreq(50))   // B8
-};
-
-// Linked List Struct
-struct Node
-{
-  uint32_t data = 0;
-  Node *next = nullptr;
-};
-
-struct LinkedList
-{
-  Node *head = nullptr;
-  Node *tail = nullptr;
-};
-
-
 const uint32_t interval = 100; // Display update interval
-volatile LinkedList currentStepSizes;
+VoicePool voicePool;
+VoiceAllocator voiceAllocator;
+NoteTracker noteTracker(voiceAllocator);
 
 // Display Variables
 const char *notes[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
 const char *keys[12] = {};
 const char *waves[4] = {"Saw", "Square", "Triangle", "Sine"};
-const char *effects[6] = {"Clean", "Vibrato", "Octave", "Arpegio 1", "Arpegio 2", "Chord"};
+const char *effects[9] = {"Clean", "Vibrato", "Octave", "Arpegio 1", "Arpegio 2", "Chord", "Delay", "Chorus", "Unison"};
 const char *vib[3] = {"Low", "Medium", "High"};
-const char *octaveModes[3] = {"Dual", "Pos", "Neg"};
-const char *arpeggioModes[3] = {"Low", "Medium", "High"};
-const char *chords[5] = {"Major", "Minor", "Diminished", "Augmented", "Seventh"};
 const char *canModes[3] = {"Master", "Send 1", "Send 2"};
-
-volatile int32_t sample = 0;
-const int TABLE_SIZE = 1028;
-float sinTable[TABLE_SIZE];
+const char *envelopeLabels[4] = {"A", "D", "S", "R"};
 
 // Key Matrix
 volatile uint8_t keyArray[4];
@@ -155,7 +40,6 @@ SemaphoreHandle_t keyArrayMutex;
 volatile int pressedKeys = 0;
 
 // CAN Message
-volatile uint32_t prev_message[2] = {0, 0};
 #if ENABLE_TESTING == 1
   volatile uint32_t cur_message[2] = {0b111111111111, 0b111111111111};
   volatile int octaveRX[2] = {5, 6};
@@ -166,8 +50,25 @@ volatile uint32_t prev_message[2] = {0, 0};
 
 // Knob Variables
 volatile int volume{6}, waveform{0}, effect{0}, subEffect{0}, effectVal{1}, canMode{0}, vibratoEffect{0}, arp1Effect{0}, arp2Effect{0};
+volatile int tempo{TEMPO_DEFAULT};
+volatile int echoEffect{2}, chorusEffect{0}, unisonEffect{2};
 volatile bool showCAN{false};
 
+// Envelope, knob positions 0 - 8 (times in envelopeTimesMs, sustain in eighths)
+VoiceEnvelopes voiceEnvelopes(samplingFreq);
+volatile int envAttack{1}, envDecay{4}, envSustain{8}, envRelease{2};
+volatile bool showEnvelope{false};
+
+// Echo and chorus on the mix, with their delay line
+DelayEffects delayEffects(samplingFreq);
+
+// Render time of each block, which caps the polyphony so the DAC is never starved
+RenderBudget renderBudget(samplingFreq, AUDIO_BLOCK_SIZE);
+
+// Filter on the mix and tempo, set together while the effect modifier knob is held
+volatile int filterType{FILTER_OFF}, filterCutoff{FILTER_CUTOFF_STEPS - 1}, filterResonance{0};
+volatile bool showFilter{false};
+
 // Octave Settings
 volatile int octaveSelect = 4;
 const int MIN_OCT = 2;
@@ -176,24 +77,13 @@ volatile bool OctToggle = false;
 volatile int octaveMode = 0;
 
 // Pitch Bend + Vibrato + Arpeggio
-volatile float pitchBend = 1;
-float calZero = 0;
-volatile float vibrato = 0;
-volatile bool vibToggle = false;
-volatile float arpegio = 0;
-volatile bool arpToggle = false;
+PitchModulator pitchModulator(samplingFreq);
 volatile float vibratoMulti[3] = {0.03, 0.06, 0.08};
-volatile float arpeggio1Multi[3][3] = {{0.6, 1.2, 1.8}, {0.4, 0.8, 1.2}, {0.2, 0.6, 1.0}};
-volatile float arpeggio2Multi[3][4] = {{0.6, 1.2, 1.8, 2.2}, {0.4, 0.8, 1.2, 1.6}, {0.2, 0.6, 1.0, 1.4}};
-
-// Chords + Song Bank
-volatile int intervalMajor[2] = {4, 7};
-volatile int intervalMinor[2] = {3, 7};
-volatile int intervalDiminished[2] = {3, 6};
-volatile int intervalAugmented[2] = {4, 8};
-volatile int intervalSeventh[3] = {4, 7, 11};
-volatile int chordNotes[3];
-volatile bool playSong = 0;
+const float vibratoCycles[3] = {4, 2, 1.5}; // Per beat, 8, 4 and 3 Hz at 120 BPM
+
+// Song Bank, played from the audio clock. Knob 1 starts each song in turn
+SongPlayer songPlayer(samplingFreq);
+volatile int nextSong = 0;
 volatile bool buttonToggle = 0;
 
 // Pin definitions
@@ -218,11 +108,29 @@ const int OUTR_PIN = A3;
 const int JOYY_PIN = A0;
 const int JOYX_PIN = A1;
 
-// Output multiplexer bits
-const int DEN_BIT = 3;
-const int DRST_BIT = 4;
-const int HKOW_BIT = 5;
-const int HKOE_BIT = 6;
+// Key and knob matrix, scanned a row at a time by the TIM7 interrupt for every
+// task that reads it. Key events wake scanKeysTask
+MatrixPins matrixPins({RA0_PIN, RA1_PIN, RA2_PIN}, REN_PIN, OUT_PIN, {C0_PIN, C1_PIN, C2_PIN, C3_PIN});
+KeyMatrix<MatrixPins> keyMatrix(matrixPins);
+TaskHandle_t scanKeysHandle = NULL;
+// Knob steps, decoded from the matrix frame at the scan rate
+KnobDecoder knobDecoder;
+// Key events taken by scanKeysTask, and the longest any waited in scan ticks,
+// both since the last telemetry line
+uint32_t keyEvents = 0;
+uint32_t keyEventWait = 0;
+
+void matrixTimerISR()
+{
+  const int changes = keyMatrix.tick();
+  knobDecoder.update(knobSnapshot(keyMatrix.frame()), keyMatrix.ticks());
+  if (changes > 0 && scanKeysHandle != NULL)
+  {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(scanKeysHandle, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+  }
+}
 
 // Display driver object
 U8G2_SSD1305_128X32_NONAME_F_HW_I2C u8g2(U8G2_R0);
@@ -235,318 +143,85 @@ uint8_t TX_Message[8] = {0};
 uint8_t prevTX[8] = {0};
 SemaphoreHandle_t CAN_TX_Semaphore;
 
-// Function to set outputs using key matrix
-void setOutMuxBit(const uint8_t bitIdx, const bool value)
-{
-  digitalWrite(REN_PIN, LOW);
-  digitalWrite(RA0_PIN, bitIdx & 0x01);
-  digitalWrite(RA1_PIN, bitIdx & 0x02);
-  digitalWrite(RA2_PIN, bitIdx & 0x04);
-  digitalWrite(OUT_PIN, value);
-  digitalWrite(REN_PIN, HIGH);
-  delayMicroseconds(2);
-  digitalWrite(REN_PIN, LOW);
-}
-
-uint8_t readCols()
+// Refills one half of the DAC buffer each time the DMA finishes reading it
+void audioRenderTask(void *pvParameters)
 {
-  uint8_t colVals = 0;
-  // Read column values
-  colVals |= (digitalRead(C0_PIN) << 0);
-  colVals |= (digitalRead(C1_PIN) << 1);
-  colVals |= (digitalRead(C2_PIN) << 2);
-  colVals |= (digitalRead(C3_PIN) << 3);
-
-  return colVals;
-}
-
-void setRow(uint8_t rowIdx)
-{
-  // Disable row select enable
-  digitalWrite(REN_PIN, LOW);
-  // Set row select pins
-  digitalWrite(RA0_PIN, rowIdx & 0x01);
-  digitalWrite(RA1_PIN, (rowIdx >> 1) & 0x01);
-  digitalWrite(RA2_PIN, (rowIdx >> 2) & 0x01);
-  // Enable row select enable
-  digitalWrite(REN_PIN, HIGH);
-}
-
-// Prints the contents of a linked list
-void printList(volatile LinkedList *list)
-{
-  Node *current = list->head;
-  while (current != nullptr)
-  {
-    Serial.print(current->data);
-    Serial.print(" | ");
-    current = current->next;
-  }
-  Serial.println();
-}
-
-void sampleISR()
-{
-  static uint32_t phase_accs[84] = {};
-  switch (waveform)
+  while (1)
   {
-  case 0:
-    // SAW
-    {
-      int32_t Vout = 0;
-      sample = 0;
-      Node *current = currentStepSizes.head;
-      int i = 0;
-      while (current != nullptr)
-      {
-        uint32_t stepSize = current->data;
-        phase_accs[i] += stepSize;
-        Vout = (phase_accs[i] >> 24) - 128;
-        sample += Vout;
-        current = current->next;
-        i += 1;
-      }
-      sample = sample >> (8 - volume);
-      analogWrite(OUTR_PIN, sample / i + 128);
-    }
-    break;
-  case 1:
-    // SQUARE
-    {
-      int32_t Vout = 0;
-      sample = 0;
-      Node *current = currentStepSizes.head;
-      int i = 0;
-
-      while (current != nullptr)
-      {
-        uint32_t stepSize = current->data;
-        phase_accs[i] += stepSize;
-        if (phase_accs[i] < UINT32_MAX / 2)
-        {
-          Vout = 63;
-        }
-        else
-        {
-          Vout = -64;
-        }
-        sample += Vout;
-        current = current->next;
-        i += 1;
-      }
-      sample = (int32_t)(sample * (float)volume / 8.0);
-      analogWrite(OUTR_PIN, sample / i + 64);
-    }
-    break;
-  case 2:
-    // TRIANGLE
-    {
-      int32_t Vout = 0;
-      sample = 0;
-      Node *current = currentStepSizes.head;
-      int i = 0;
-
-      while (current != nullptr)
-      {
-        uint32_t stepSize = current->data;
-        phase_accs[i] += stepSize;
-        // Ascend
-        if (phase_accs[i] < UINT32_MAX / 2)
-        {
-          Vout = (phase_accs[i] >> 24);
-        }
-        // Descend
-        else
-        {
-          Vout = (-phase_accs[i] >> 24);
-        }
-        sample += Vout;
-        current = current->next;
-        i += 1;
-      }
-      sample = (int32_t)(sample * (float)volume / 8.0);
-      analogWrite(OUTR_PIN, sample / i + 128);
-    }
-    break;
-  case 3:
-    // SINE
+#if ENABLE_TESTING == 0
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
+    const uint32_t start = renderClock();
+    renderModulatedBlock(&audioBuffer[AUDIO_BLOCK_SIZE * renderHalf], AUDIO_BLOCK_SIZE, voicePool.acquire(),
+                         voiceEnvelopes, pitchModulator, __atomic_load_n(&waveform, __ATOMIC_RELAXED),
+                         __atomic_load_n(&volume, __ATOMIC_RELAXED));
+    // The song's new notes reach the voices before the next block
+    if (songPlayer.advance(AUDIO_BLOCK_SIZE) && scanKeysHandle != NULL)
     {
-      int32_t Vout = 0;
-      sample = 0;
-      Node *current = currentStepSizes.head;
-      int i = 0;
-      while (current != nullptr)
-      {
-        uint32_t stepSize = current->data;
-        phase_accs[i] += stepSize;
-        int index = 1027 * ((float)phase_accs[i] / (float)UINT32_MAX);
-        // Get value from look-up table
-        sample += (int32_t)sinTable[index];
-        current = current->next;
-        i += 1;
-      }
-      sample = (int32_t)(sample * (float)volume / 8.0);
-      analogWrite(OUTR_PIN, sample / i + 128);
+      xTaskNotifyGive(scanKeysHandle);
     }
+    renderBudget.endBlock(renderClock() - start);
+#if ENABLE_TESTING == 1
     break;
+#endif
   }
 }
 
-
-// Add step size to linked list
-void addNode(LinkedList *list, const int data)
-{
-  struct Node *newNode = new Node;
-  newNode->data = data;
-  newNode->next = nullptr;
-  if (list->head == nullptr)
-  {
-    list->head = newNode;
-    list->tail = newNode;
-    return;
-  }
-  list->tail->next = newNode;
-  list->tail = newNode;
-}
-
-// Delete all contents of linked list
-void deleteLinkedList(LinkedList *list)
+void scanKeysTask(void *pvParameters)
 {
-  Node *current = list->head;
-  Node *next;
-
-  while (current != nullptr)
-  {
-    next = current->next;
-    delete current;
-    current = next;
-  }
-
-  list->head = nullptr;
-  list->tail = nullptr;
-}
+  const TickType_t xFrequency = 20 / portTICK_PERIOD_MS;
+  uint16_t keyStates = 0;
+  uint32_t overflows = 0;
 
-// Plays chords depending on chordType
-void playChord(int chordType, int octave, int i, LinkedList *list)
-{
-  if (chordType == 0) // MAJOR
-  {
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 4] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 7] * pitchBend));
-  }
-  if (chordType == 1) // MINOR
-  {
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 3] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 7] * pitchBend));
-  }
-  if (chordType == 2) // DIMINISHED
-  {
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 3] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 6] * pitchBend));
-  }
-  if (chordType == 3) // AUGMENTED
-  {
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 4] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 8] * pitchBend));
-  }
-  if (chordType == 4) // SEVENTH
-  {
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 4] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 7] * pitchBend));
-    addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i + 11] * pitchBend));
-  }
-}
-// Helper function to add keypress to linked list for sampler use
-void processKeyPress(LinkedList *list, uint16_t keyState, int octave, bool master)
-{
-  for (int i = 0; i < 12; i++)
+  while (1)
   {
-    if (keyState & (1 << i))
+#if ENABLE_TESTING == 0
+    // Woken by the scan interrupt as soon as a key changes, by the audio task
+    // when the song's notes change, and every 20 ms regardless for the
+    // received keys and the voice cap
+    ulTaskNotifyTake(pdTRUE, xFrequency);
+#endif
+    // Key changes in the order they happened. If any were dropped the keys
+    // are taken as they are held now
+    KeyEvent event;
+    while (keyMatrix.nextEvent(&event))
     {
-      addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 2) + i] * pitchBend));
-      keys[i] = notes[i];
-      if (effect == 2)
+      keyStates = event.pressed ? keyStates | 1u << event.key : keyStates & ~(1u << event.key);
+      const uint32_t wait = keyMatrix.ticks() - event.tick;
+      if (wait > __atomic_load_n(&keyEventWait, __ATOMIC_RELAXED))
       {
-        // +- 1 Octave
-        if (octaveMode == 0)
-        {
-          addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 3) + i] * pitchBend));
-          addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 1) + i] * pitchBend));
-        }
-        // +1 Octave
-        else if (octaveMode == 1)
-        {
-          addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 1) + i] * pitchBend));
-        }
-        // -1 Octave
-        else
-        {
-          addNode(list, (uint32_t)((float)stepSizes[12 * (octave - 3) + i] * pitchBend));
-        }
-      }
-      else if (effect == 5)
-      {
-        playChord(subEffect, octave, i, list);
+        __atomic_store_n(&keyEventWait, wait, __ATOMIC_RELAXED);
       }
+      __atomic_add_fetch(&keyEvents, 1, __ATOMIC_RELAXED);
     }
-    else
+    if (keyMatrix.overflows() != overflows)
     {
-      if (master)
-      {
-        keys[i] = 0;
-      }
+      overflows = keyMatrix.overflows();
+      keyStates = keyMatrix.keys();
     }
-  }
-}
 
-void scanKeysTask(void *pvParameters)
-{
-  const TickType_t xFrequency = 20 / portTICK_PERIOD_MS;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  LinkedList oldtodelete;
-
-  while (1)
-  {
-#if ENABLE_TESTING == 0
-    vTaskDelayUntil(&xLastWakeTime, xFrequency);
-#endif
-    LinkedList locallist;
+    KeyInputs inputs;
+    inputs.voicing = &currentVoicing();
+    voiceAllocator.beginScan();
     xSemaphoreTake(keyArrayMutex, portMAX_DELAY);
-    pressedKeys = 0;
-
-    // Read keys
-    for (size_t row = 0; row < 3; row++)
-    {
-      setRow(row);
-      delayMicroseconds(3);
-      pressedKeys |= readCols() << (4 * row);
-    }
     #if ENABLE_TESTING == 1
       pressedKeys = 0b111111111111;
     #else
-      pressedKeys = ~pressedKeys & 0x0FFF;
+      pressedKeys = keyStates;
     #endif
 
-    // Add key step sizes to linked list  (polyphony)
-    // LOCAL KEYS
-    if (canMode == 0)
+    // Local keys, received keys and the song's notes are played as master
+    inputs.local = canMode == 0;
+    if (inputs.local)
     {
-      // Process local keys
-      processKeyPress(&locallist, pressedKeys, octaveSelect, true);
-
-      // Process received keys
+      inputs.keys[NOTE_SOURCE_LOCAL] = pressedKeys;
+      inputs.octaves[NOTE_SOURCE_LOCAL] = octaveSelect;
       for (int j = 0; j < 2; j++)
       {
-        if (prev_message[j] != cur_message[j])
-        { // NEW KEY STATE
-          processKeyPress(&locallist, cur_message[j], octaveRX[j], false);
-          prev_message[j] = cur_message[j];
-        }
-        else
-        { // REPEAT OLD KEY STATE
-          processKeyPress(&locallist, prev_message[j], octaveRX[j], false);
-        }
+        inputs.keys[NOTE_SOURCE_CAN0 + j] = __atomic_load_n(&cur_message[j], __ATOMIC_RELAXED);
+        inputs.octaves[NOTE_SOURCE_CAN0 + j] = octaveRX[j];
       }
+      songPlayer.heldNotes(&inputs.song);
     }
 
     else
@@ -572,15 +247,15 @@ void scanKeysTask(void *pvParameters)
 
     xSemaphoreGive(keyArrayMutex);
 
-    // Send keys to sampler
-    __atomic_store_n(&currentStepSizes.head, locallist.head, __ATOMIC_RELAXED);
-    __atomic_store_n(&currentStepSizes.tail, locallist.tail, __ATOMIC_RELAXED); // in here for completeness, but not needed. If interrupt between head/tail, doesnt matter because head points to whole list
-
-    // Delete old linked list
-    deleteLinkedList(&oldtodelete);
-    __atomic_store_n(&oldtodelete.head, locallist.head, __ATOMIC_RELAXED);
-    __atomic_store_n(&oldtodelete.tail, locallist.tail, __ATOMIC_RELAXED);
-    // printList(&allKeysPressed);
+    // Only the notes that started or stopped go to the voices, with as many
+    // voices as the audio task has time for. The frame is republished only if
+    // the voices changed
+    noteTracker.update(inputs);
+    voiceAllocator.setPolyphony(renderBudget.voiceLimit());
+    if (voiceAllocator.endScan(voicePool.beginFrame(), voiceEnvelopes))
+    {
+      voicePool.publish();
+    }
 
 #if ENABLE_TESTING == 1
     break;
@@ -595,17 +270,32 @@ void readControlsTask(void *pvParameters)
   TickType_t xLastWakeTime = xTaskGetTickCount();
   // Knob Constructors
   Knob volumeKnob(0, 8, &volume);
-  Knob functionKnob(0, 3, &waveform);
-  Knob effectKnob(0, 5, &effect);
-  Knob subEffectKnob(0, 4, &subEffect);
+  Knob functionKnob(0, SOUND_COUNT - 1, &waveform);
+  Knob effectKnob(0, 8, &effect);
+  Knob subEffectKnob(0, CHORD_VOICING_COUNT - 1, &subEffect);
   Knob canKnob(0, 2, &canMode);
   Knob vibratoFXKnob(0, 2, &vibratoEffect);
-  Knob octaveFXKnob(0, 2, &octaveMode);
-  Knob arp1FXKnob(0, 2, &arp1Effect);
-  Knob arp2FXKnob(0, 2, &arp2Effect);
-  // Calculate the zero error (stick drift)
-  float initialY = analogRead(A1);
-  calZero = (initialY / 1023);
+  Knob octaveFXKnob(0, OCTAVE_VOICING_COUNT - 1, &octaveMode);
+  Knob arp1FXKnob(0, ARP_PATTERN_COUNT - 1, &arp1Effect);
+  Knob arp2FXKnob(0, ARP_PATTERN_COUNT - 1, &arp2Effect);
+  Knob tempoKnob(TEMPO_MIN, TEMPO_MAX, &tempo);
+  Knob echoFXKnob(0, ECHO_PRESET_COUNT - 1, &echoEffect);
+  Knob chorusFXKnob(0, CHORUS_PRESET_COUNT - 1, &chorusEffect);
+  Knob unisonFXKnob(0, UNISON_PRESET_COUNT - 1, &unisonEffect);
+  Knob attackKnob(0, ENVELOPE_STEPS - 1, &envAttack);
+  Knob decayKnob(0, ENVELOPE_STEPS - 1, &envDecay);
+  Knob sustainKnob(0, ENVELOPE_STEPS - 1, &envSustain);
+  Knob releaseKnob(0, ENVELOPE_STEPS - 1, &envRelease);
+  Knob filterTypeKnob(0, FILTER_TYPE_COUNT - 1, &filterType);
+  Knob cutoffKnob(0, FILTER_CUTOFF_STEPS - 1, &filterCutoff);
+  Knob resonanceKnob(0, FILTER_RESONANCE_STEPS - 1, &filterResonance);
+  // What each knob drives, knob 0 to 3, in each mode. The effect modifier
+  // drives the setting of the effect picked, nothing for no effect
+  Knob *const envelopeKnobs[KNOB_COUNT] = {&releaseKnob, &attackKnob, &decayKnob, &sustainKnob};
+  Knob *const filterKnobs[KNOB_COUNT] = {&resonanceKnob, &filterTypeKnob, &cutoffKnob, &tempoKnob};
+  Knob *const modifierKnobs[9] = {nullptr,        &vibratoFXKnob, &octaveFXKnob, &arp1FXKnob,  &arp2FXKnob,
+                                  &subEffectKnob, &echoFXKnob,    &chorusFXKnob, &unisonFXKnob};
+  Knob *normalKnobs[KNOB_COUNT] = {&volumeKnob, &functionKnob, &effectKnob, nullptr};
 
   while (1)
   {
@@ -613,64 +303,58 @@ void readControlsTask(void *pvParameters)
     vTaskDelayUntil(&xLastWakeTime, xFrequency);
 #endif
 
-    // Read knobs
-    for (size_t row = 3; row < 7; row++)
+    // Knob rows as the scan interrupt last read them
+    const uint32_t frame = keyMatrix.frame();
+    for (int row = MATRIX_KEY_ROWS; row < MATRIX_ROWS; row++)
     {
-      setRow(row);
-      delayMicroseconds(3);
-      keyArray[row - 3] = readCols();
+      keyArray[row - MATRIX_KEY_ROWS] = matrixRow(frame, row);
     }
 
-    functionKnob.update(keyArray[1] & 0x03); // KNOB 0       ( 0 )    ( 1 )    ( 2 )    ( 3 )
-    effectKnob.update(keyArray[0] >> 2);     // KNOB 1      [4]>>2  [4]&0x03  [3]>>2  [3]&0x03
-    
-    // Change function of effect modifier depending on effect selected
-    if (effect == 1)
+    // Holding the effect knob down turns all four knobs into attack, decay, sustain and release,
+    // holding the effect modifier turns them into filter type, cutoff, tempo and resonance
+    showEnvelope = (keyArray[2] & 0x01) == 0;
+    showFilter = !showEnvelope && (keyArray[2] & 0x02) == 0;
+    Knob *const *knobs = normalKnobs;
+    if (showEnvelope)
     {
-      vibratoFXKnob.update(keyArray[0] & 0x03);
+      knobs = envelopeKnobs;
     }
-    else if (effect == 2)
+    else if (showFilter)
     {
-      octaveFXKnob.update(keyArray[0] & 0x03);
+      knobs = filterKnobs;
     }
-    else if (effect == 3)
-    {
-      arp1FXKnob.update(keyArray[0] & 0x03);
-    }
-    else if (effect == 4)
+    else
     {
-      arp2FXKnob.update(keyArray[0] & 0x03);
+      // Knob 0 sets the CAN mode while pressed, and the volume only as master
+      const bool volumePressed = (keyArray[3] & 0x01) == 0;
+      showCAN = volumePressed || canMode != 0;
+      normalKnobs[0] = volumePressed ? &canKnob : canMode == 0 ? &volumeKnob : nullptr;
     }
-    else if (effect == 5)
+
+    // Every step the scan interrupt decoded since the last period, to
+    // whichever setting each knob now drives
+    KnobEvent event;
+    while (knobDecoder.nextEvent(&event))
     {
-      subEffectKnob.update(keyArray[0] & 0x03);
+      normalKnobs[3] = modifierKnobs[__atomic_load_n(&effect, __ATOMIC_RELAXED)];
+      if (knobs[event.knob] != nullptr)
+      {
+        knobs[event.knob]->turn(event);
+      }
     }
 
-    // Update Knobs
-    // Not pressed
-    if (keyArray[3] & 0x01 == 1)
+    // K1 press starts the next song, or stops the one playing
+    if (((keyArray[3] & 0x02) >> 1 == 0) && buttonToggle == false)
     {
-      if (canMode != 0)
+      if (songPlayer.playing() == SONG_STOPPED)
       {
-        showCAN = 1;
+        songPlayer.play(nextSong);
+        nextSong = (nextSong + 1) % SONG_COUNT;
       }
       else
       {
-        volumeKnob.update(keyArray[1] >> 2);
-        showCAN = 0;
+        songPlayer.stop();
       }
-    }
-    // Press Down
-    else
-    {
-      canKnob.update(keyArray[1] >> 2);
-      showCAN = 1;
-    }
-
-    // Play Song if K1 pressed
-    if (((keyArray[3] & 0x02) >> 1 == 0) && buttonToggle == false)
-    {
-      playSong = !playSong;
       buttonToggle = true;
     }
     if (((keyArray[3] & 0x02) >> 1 == 1) && buttonToggle == true)
@@ -680,6 +364,21 @@ void readControlsTask(void *pvParameters)
 
     octaveControl();
     pitchControl();
+    voiceEnvelopes.setShape(envAttack, envDecay, envSustain, envRelease);
+    outputFilter.set(filterType, filterCutoff, filterResonance);
+    if (effect == 6)
+    {
+      delayEffects.set(DELAY_ECHO, echoEffect, tempo);
+    }
+    else if (effect == 7)
+    {
+      delayEffects.set(DELAY_CHORUS, chorusEffect, tempo);
+    }
+    else
+    {
+      delayEffects.set(DELAY_OFF, 0, tempo);
+    }
+    voiceUnison.set(effect == 8 ? unisonEffect : UNISON_OFF);
 
 #if ENABLE_TESTING == 1
     break;
@@ -691,16 +390,77 @@ void displayKeysTask(void *pvParameters)
 {
   const TickType_t xFrequency = 100 / portTICK_PERIOD_MS;
   TickType_t xLastWakeTime = xTaskGetTickCount();
+  uint32_t refreshes = 0;
 
   while (1)
   {
 #if ENABLE_TESTING == 0
     vTaskDelayUntil(&xLastWakeTime, xFrequency);
 #endif
+    // Render load telemetry once a second
+    if (++refreshes % 10 == 0)
+    {
+      Serial.print("[Load] voices ");
+      Serial.print(renderBudget.voices());
+      Serial.print("/");
+      Serial.print(renderBudget.voiceLimit());
+      Serial.print(" headroom ");
+      Serial.print(renderBudget.headroom());
+      Serial.print("% load ");
+      Serial.print(renderBudget.load());
+      Serial.print("% quality ");
+      Serial.print(renderBudget.qualityLevel());
+      Serial.print(" overruns ");
+      Serial.println(renderBudget.overruns());
+      Serial.print("[Keys] events ");
+      Serial.print(__atomic_exchange_n(&keyEvents, 0, __ATOMIC_RELAXED));
+      Serial.print(" longest wait ");
+      Serial.print(__atomic_exchange_n(&keyEventWait, 0, __ATOMIC_RELAXED) * 1000000 / MATRIX_TICK_HZ);
+      Serial.print(" us dropped ");
+      Serial.println(keyMatrix.overflows());
+      // Fewest stack words the time-critical tasks have had spare
+      Serial.print("[Stack] audioRender ");
+      Serial.print(uxTaskGetStackHighWaterMark(audioRenderHandle));
+      Serial.print(" scanKeys ");
+      Serial.println(uxTaskGetStackHighWaterMark(scanKeysHandle));
+    }
+
     u8g2.setFont(u8g2_font_profont10_tf);
     u8g2.clearBuffer();
 
-    if (showCAN == 0)
+    if (showEnvelope)
+    {
+      // Attack, decay and release in ms, sustain in eighths of full level
+      const int envelope[4] = {envAttack, envDecay, envSustain, envRelease};
+      u8g2.setCursor(2, 10);
+      u8g2.print("ENVELOPE");
+      for (int i = 0; i < 4; i++)
+      {
+        u8g2.setCursor(2 + 32 * i, 25);
+        u8g2.print(envelopeLabels[i]);
+        u8g2.print(":");
+        u8g2.print(i == 2 ? envelope[i] : envelopeTimesMs[envelope[i]]);
+      }
+      u8g2.sendBuffer();
+    }
+    else if (showFilter)
+    {
+      u8g2.setCursor(2, 10);
+      u8g2.print("FILTER");
+      u8g2.setCursor(80, 10);
+      u8g2.print("BPM:");
+      u8g2.print(tempo);
+      u8g2.setCursor(2, 25);
+      u8g2.print(filterTypeNames[filterType]);
+      u8g2.setCursor(34, 25);
+      u8g2.print(filterCutoffHz(filterCutoff, samplingFreq));
+      u8g2.print("Hz");
+      u8g2.setCursor(80, 25);
+      u8g2.print("Res:");
+      u8g2.print(filterResonance);
+      u8g2.sendBuffer();
+    }
+    else if (showCAN == 0)
     {
       u8g2.setCursor(100, 10);
       u8g2.print("Vol:");
@@ -712,7 +472,14 @@ void displayKeysTask(void *pvParameters)
 
       u8g2.setCursor(2, 20);
       u8g2.print("WAVE:");
-      u8g2.print(waves[waveform]);
+      if (waveform >= WAVE_SAMPLE)
+      {
+        u8g2.print(samplerBank[waveform - WAVE_SAMPLE]->name);
+      }
+      else
+      {
+        u8g2.print(waveform < WAVE_USER ? waves[waveform] : userWaveNames[waveform - WAVE_USER]);
+      }
 
       u8g2.setCursor(2, 30);
       u8g2.print("FX:");
@@ -722,7 +489,7 @@ void displayKeysTask(void *pvParameters)
       {
         u8g2.setCursor(50, 30);
         u8g2.print("-> ");
-        u8g2.print(chords[subEffect]);
+        u8g2.print(chordVoicings[subEffect].name);
       }
       else if (effect == 1)
       {
@@ -734,26 +501,53 @@ void displayKeysTask(void *pvParameters)
       {
         u8g2.setCursor(50, 30);
         u8g2.print("-> ");
-        u8g2.print(octaveModes[octaveMode]);
+        u8g2.print(octaveVoicings[octaveMode].name);
       }
       else if (effect == 3)
       {
         u8g2.setCursor(64, 30);
         u8g2.print("-> ");
-        u8g2.print(arpeggioModes[arp1Effect]);
+        u8g2.print(arpPatterns[arp1Effect].name);
       }
       else if (effect == 4)
       {
         u8g2.setCursor(64, 30);
         u8g2.print("-> ");
-        u8g2.print(arpeggioModes[arp2Effect]);
+        u8g2.print(arpPatterns[arp2Effect].name);
+      }
+      else if (effect == 6)
+      {
+        u8g2.setCursor(50, 30);
+        u8g2.print("-> ");
+        u8g2.print(echoPresets[echoEffect].name);
+      }
+      else if (effect == 7)
+      {
+        u8g2.setCursor(54, 30);
+        u8g2.print("-> ");
+        u8g2.print(chorusPresets[chorusEffect].name);
+      }
+      else if (effect == 8)
+      {
+        u8g2.setCursor(54, 30);
+        u8g2.print("-> ");
+        u8g2.print(unisonPresets[unisonEffect].name);
       }
 
       u8g2.setCursor(2, 10);
-      u8g2.print("KEY: ");
-      for (size_t i = 0; i < 12; i++)
+      int song = songPlayer.playing();
+      if (song != SONG_STOPPED)
       {
-        u8g2.print(keys[i]);
+        u8g2.print("SONG: ");
+        u8g2.print(songs[song].name);
+      }
+      else
+      {
+        u8g2.print("KEY: ");
+        for (size_t i = 0; i < 12; i++)
+        {
+          u8g2.print(keys[i]);
+        }
       }
       u8g2.sendBuffer();
     }
@@ -823,13 +617,10 @@ void decodeTask(void *pVparameters)
 #if ENABLE_TESTING == 0
     xQueueReceive(msgInQ, RX_Message, portMAX_DELAY); // wait for message
 #endif
-    cur_message[RX_Message[0]] = 0;
-    // Create the keyboard array
-    cur_message[RX_Message[0]] |= RX_Message[1];
-    cur_message[RX_Message[0]] <<= 4;
-    cur_message[RX_Message[0]] |= RX_Message[2];
-    cur_message[RX_Message[0]] <<= 4;
-    cur_message[RX_Message[0]] |= RX_Message[3];
+    // Create the keyboard array, stored in one go so the key scan never sees
+    // it half built
+    uint32_t received = (RX_Message[1] & 0xF) << 8 | (RX_Message[2] & 0xF) << 4 | (RX_Message[3] & 0xF);
+    __atomic_store_n(&cur_message[RX_Message[0]], received, __ATOMIC_RELAXED);
     // Set the keyboard octave
     octaveRX[RX_Message[0]] = RX_Message[4];
     // Serial.println(cur_message[0]);
@@ -842,34 +633,24 @@ void decodeTask(void *pVparameters)
 void setup()
 {
   // Set pin directions
-  pinMode(RA0_PIN, OUTPUT);
-  pinMode(RA1_PIN, OUTPUT);
-  pinMode(RA2_PIN, OUTPUT);
-  pinMode(REN_PIN, OUTPUT);
-  pinMode(OUT_PIN, OUTPUT);
-  pinMode(OUTL_PIN, OUTPUT);
-  pinMode(OUTR_PIN, OUTPUT);
+  matrixPins.begin();
+  pinMode(OUTL_PIN, INPUT_ANALOG);
+  pinMode(OUTR_PIN, INPUT_ANALOG);
   pinMode(LED_BUILTIN, OUTPUT);
+  pinMode(JOYX_PIN, INPUT_ANALOG);
+  pinMode(JOYY_PIN, INPUT_ANALOG);
 
-  pinMode(C0_PIN, INPUT);
-  pinMode(C1_PIN, INPUT);
-  pinMode(C2_PIN, INPUT);
-  pinMode(C3_PIN, INPUT);
-  pinMode(JOYX_PIN, INPUT);
-  pinMode(JOYY_PIN, INPUT);
+  // Joystick sampled continuously from here on, x on PA1 (ADC1 channel 6)
+  // and y on PA0 (channel 5). The first samples set each axis's centre
+  initJoystickInput(ADC_CHANNEL_6, ADC_CHANNEL_5);
 
   // Initialise display
-  setOutMuxBit(DRST_BIT, LOW); // Assert display logic reset
+  keyMatrix.setOutput(MATRIX_DRST_BIT, LOW); // Assert display logic reset
   delayMicroseconds(2);
-  setOutMuxBit(DRST_BIT, HIGH); // Release display logic reset
+  keyMatrix.setOutput(MATRIX_DRST_BIT, HIGH); // Release display logic reset
   u8g2.begin();
-  setOutMuxBit(DEN_BIT, HIGH); // Enable display power supply
+  keyMatrix.setOutput(MATRIX_DEN_BIT, HIGH); // Enable display power supply
 
-  // Initalise SINE
-  for (int i = 0; i < TABLE_SIZE; i++)
-  {
-    sinTable[i] = 127 * sin((float)i / (float)TABLE_SIZE * 2.0 * PI);
-  }
 
   // Initialise UART
   Serial.begin(9600);
@@ -892,17 +673,18 @@ void setup()
   msgOutQ = xQueueCreate(36, 8);                     // create queue for transmitted messages
   CAN_TX_Semaphore = xSemaphoreCreateCounting(3, 3); // 3 slots for outgoing messages, start with 3 slots available. Max count = 3 so a 4th attempt is blocked
 
-  // Create timer for audio
-  TIM_TypeDef *Instance = TIM1;
-  HardwareTimer *sampleTimer = new HardwareTimer(Instance);
+  // Render times are counted in core clock cycles
+  renderBudget.start(SystemCoreClock);
 
 #if ENABLE_TESTING == 0
-  sampleTimer->setOverflow(22050, HERTZ_FORMAT);
-  sampleTimer->attachInterrupt(sampleISR);
-  sampleTimer->resume();
-
-  TaskHandle_t scanKeysHandle = NULL;
-  xTaskCreate(scanKeysTask, "scanKeys", 64, NULL, 5, &scanKeysHandle);
+  // Audio is rendered in blocks and streamed to the DAC by DMA. Its call chain
+  // down to the unison mix and scanKeysTask's through the note tracker and
+  // voice allocator both need over 128 words with the context switch frame;
+  // the [Stack] telemetry line shows what they leave spare
+  xTaskCreate(audioRenderTask, "audioRender", 256, NULL, 6, &audioRenderHandle);
+  initAudioOutput(samplingFreq);
+
+  xTaskCreate(scanKeysTask, "scanKeys", 256, NULL, 5, &scanKeysHandle);
   TaskHandle_t displayKeysHandle = NULL;
   xTaskCreate(displayKeysTask, "displayKeys", 256, NULL, 1, &displayKeysHandle);
   TaskHandle_t readControlsHandle = NULL;
@@ -911,15 +693,48 @@ void setup()
   xTaskCreate(decodeTask, "decode", 256, NULL, 2, &decodeTaskHandle);
   TaskHandle_t CAN_TX_TaskHandle = NULL;
   xTaskCreate(CAN_TX_Task, "CAN_TX", 256, NULL, 3, &CAN_TX_TaskHandle);
+
+  // Matrix scanning, one row per tick, once scanKeysTask can be woken. A
+  // whole frame is read first so the knobs start from where they are
+  keyMatrix.scan();
+  knobDecoder.update(knobSnapshot(keyMatrix.frame()), 0);
+  keyMatrix.start();
+  startMatrixTimer(TIM7, matrixTimerISR);
 #endif
 
 #if ENABLE_TESTING == 1
 
   Serial.println("-=-=-=-=-=-=-=-=-=-=-=-=-=-");
-  // SCAN KEYS
+  // MATRIX SCAN, all seven rows including the settling time of each
   uint32_t startTime = micros();
   uint32_t finishTime = 0;
   for (int iter = 0; iter < 64; iter++)
+  {
+    keyMatrix.scan();
+  }
+  finishTime = micros() - startTime;
+  Serial.print("matrix scan:\t\t");
+  Serial.print(finishTime / 64);
+  Serial.println("\tmicros / frame");
+
+  // MATRIX TICK, the scan interrupt's work for one row
+  keyMatrix.start();
+  startTime = micros();
+  for (int iter = 0; iter < 1024; iter++)
+  {
+    keyMatrix.tick();
+  }
+  finishTime = micros() - startTime;
+  Serial.print("matrix tick:\t\t");
+  Serial.print(finishTime * 1000 / 1024);
+  Serial.print("\tnanos / tick");
+  Serial.print("\tCPU: ");
+  Serial.print((float)finishTime * MATRIX_TICK_HZ / 1024 / 10000);
+  Serial.println("%");
+
+  // SCAN KEYS
+  startTime = micros();
+  for (int iter = 0; iter < 64; iter++)
   {
     scanKeysTask(NULL);
   }
@@ -959,19 +774,54 @@ void setup()
   Serial.print((float)finishTime / (float)20000);
   Serial.println("%");
 
-  // SAMPLEISR
+  // AUDIO RENDER
   startTime = micros();
   for (int iter = 0; iter < 64; iter++)
   {
-    sampleISR();
+    audioRenderTask(NULL);
   }
   finishTime = micros() - startTime;
-  Serial.print("sampleISR:\t\t");
+  Serial.print("audioRenderTask:\t");
   Serial.print(finishTime / 64);
-  Serial.print("\tmicros / iter");
+  Serial.print("\tmicros / block");
   Serial.print("\tCPU: ");
-  Serial.print((float)finishTime / (float)45.45);
+  Serial.print((float)finishTime / (float)(64 * AUDIO_BLOCK_SIZE) / (float)45.45 * 100);
   Serial.println("%");
+  Serial.print("voice limit:\t\t");
+  Serial.print(renderBudget.voiceLimit());
+  Serial.print("\tvoices: ");
+  Serial.println(renderBudget.voices());
+
+  // UNISON KERNELS, one 7 oscillator saw voice, to decide UNISON_PACKED
+  {
+    Unison unison;
+    unison.set(UNISON_PRESET_COUNT - 1);
+    const int sides = unison.update();
+    const uint32_t increment = stepSizes[24];
+    int32_t steps[UNISON_MAX_SIDES];
+    unison.detuneSteps(increment, steps);
+    const int16_t *table = sawTables.levels[mipLevel(increment)];
+    uint32_t phase = 0;
+    uint32_t phases[UNISON_MAX_SIDES] = {};
+    volatile int32_t sink = 0;
+    for (int packed = 0; packed < 2; packed++)
+    {
+      startTime = renderClock();
+      for (int iter = 0; iter < 64 * AUDIO_BLOCK_SIZE; iter++)
+      {
+        phase += increment;
+        sink = packed ? unisonSample<MIP_TABLE_BITS, true>(table, phase, increment, phases, steps, sides,
+                                                          unison.centreGain(), unison.sideGains())
+                      : unisonSample<MIP_TABLE_BITS, false>(table, phase, increment, phases, steps, sides,
+                                                           unison.centreGain(), unison.sideGains());
+      }
+      finishTime = renderClock() - startTime;
+      Serial.print(packed ? "unison packed:\t\t" : "unison scalar:\t\t");
+      Serial.print(finishTime / (64 * AUDIO_BLOCK_SIZE));
+      Serial.println("\tcycles / voice-sample");
+    }
+    (void)sink;
+  }
 
   //RECIEVING
   uint8_t msgOut[8] = {0};
@@ -1038,9 +888,5 @@ void setup()
 
 void loop()
 {
-  // For fun, added a song bank feature (press knob1 to toggle)
-  if (playSong)
-  {
-    songBank1();
-  }
+  // Everything, songs included, runs in the FreeRTOS tasks
 }